@@ -144,6 +144,7 @@ static inline void flush_tlb_range(struct vm_area_struct *vma,
 
 void native_flush_tlb_others(const struct cpumask *cpumask,
 			     struct mm_struct *mm, unsigned long va);
+extern void flush_tlb_batched(const struct cpumask *cpumask);
 
 #define TLBSTATE_OK	1
 #define TLBSTATE_LAZY	2
@@ -1454,6 +1454,8 @@ x86_pmu_notifier(struct notifier_block *self, unsigned long action, void *hcpu)
 		break;
 
 	case CPU_STARTING:
+		/* let tasks read their own counters, see x86_pmu_event_idx() */
+		set_in_cr4(X86_CR4_PCE);
 		if (x86_pmu.cpu_starting)
 			x86_pmu.cpu_starting(cpu);
 		break;
@@ -1745,6 +1747,25 @@ static int x86_pmu_event_init(struct perf_event *event)
 	return err;
 }
 
+/*
+ * The value of the mmap page's index for user space rdpmc: fixed counters
+ * are selected by bit 30 of ecx.
+ */
+static int x86_pmu_event_idx(struct perf_event *event)
+{
+	int idx = event->hw.idx;
+
+	if (idx == X86_PMC_IDX_FIXED_BTS)
+		return 0;
+
+	if (x86_pmu.num_counters_fixed && idx >= X86_PMC_IDX_FIXED) {
+		idx -= X86_PMC_IDX_FIXED;
+		idx |= 1 << 30;
+	}
+
+	return idx + 1;
+}
+
 static struct pmu pmu = {
 	.pmu_enable	= x86_pmu_enable,
 	.pmu_disable	= x86_pmu_disable,
@@ -1757,11 +1778,23 @@ static struct pmu pmu = {
 	.stop		= x86_pmu_stop,
 	.read		= x86_pmu_read,
 
+	.event_idx	= x86_pmu_event_idx,
+
 	.start_txn	= x86_pmu_start_txn,
 	.cancel_txn	= x86_pmu_cancel_txn,
 	.commit_txn	= x86_pmu_commit_txn,
 };
 
+void arch_perf_update_userpage(struct perf_event *event,
+			       struct perf_event_mmap_page *userpg)
+{
+	if (!is_x86_event(event))
+		return;
+
+	userpg->cap_usr_rdpmc = 1;
+	userpg->pmc_width = x86_pmu.cntval_bits;
+}
+
 /*
  * callchain support
  */
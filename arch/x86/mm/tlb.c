@@ -152,7 +152,8 @@ void smp_invalidate_interrupt(struct pt_regs *regs)
 		 * BUG();
 		 */
 
-	if (f->flush_mm == percpu_read(cpu_tlbstate.active_mm)) {
+	/* a NULL flush_mm flushes whatever mm the cpu is running */
+	if (!f->flush_mm || f->flush_mm == percpu_read(cpu_tlbstate.active_mm)) {
 		if (percpu_read(cpu_tlbstate.state) == TLBSTATE_OK) {
 			if (f->flush_va == TLB_FLUSH_ALL)
 				local_flush_tlb();
@@ -319,6 +320,23 @@ void flush_tlb_page(struct vm_area_struct *vma, unsigned long va)
 	preempt_enable();
 }
 
+/*
+ * Flush the user TLB entries of every cpu in @cpumask, whichever mm each
+ * of them is running.  Used by reclaim to flush the ptes it has cleared
+ * in several mms with a single round of IPIs.
+ */
+void flush_tlb_batched(const struct cpumask *cpumask)
+{
+	preempt_disable();
+
+	if (cpumask_test_cpu(smp_processor_id(), cpumask))
+		local_flush_tlb();
+	if (cpumask_any_but(cpumask, smp_processor_id()) < nr_cpu_ids)
+		flush_tlb_others(cpumask, NULL, TLB_FLUSH_ALL);
+
+	preempt_enable();
+}
+
 static void do_flush_tlb_all(void *info)
 {
 	__flush_tlb_all();
@@ -0,0 +1,412 @@
+/*
+ * GCM-AES: Galois/Counter Mode with AES in a single pass.
+ *
+ * The gcm template runs CTR and GHASH as two passes over the data, each
+ * through its own scatterlist walk, and GHASH multiplies one block at a
+ * time.  This driver encrypts and hashes GCM_AES_BLOCKS blocks at a time
+ * while they are in cache, and hashes them with the tables of the powers
+ * of H so that the products are reduced once for all of them:
+ *
+ *   Y' = (Y + C1) * H^4 + C2 * H^3 + C3 * H^2 + C4 * H
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/gf128mul.h>
+#include <crypto/internal/aead.h>
+#include <crypto/scatterwalk.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#define GCM_AES_BLOCKS	4	/* blocks per pass, and powers of H */
+
+struct gcm_aes_ctx {
+	struct crypto_cipher *aes;
+	/* h[i] multiplies by H^(GCM_AES_BLOCKS - i), h[GCM_AES_BLOCKS-1] by H */
+	struct gf128mul_4k *h[GCM_AES_BLOCKS];
+};
+
+struct gcm_aes_state {
+	be128 hash;
+	u8 ctr[AES_BLOCK_SIZE];
+	u8 buf[AES_BLOCK_SIZE];		/* partial block to hash */
+	unsigned int buflen;
+	u8 ks[AES_BLOCK_SIZE];		/* keystream left of the last block */
+	unsigned int ksoff;
+};
+
+static void gcm_aes_free_tables(struct gcm_aes_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < GCM_AES_BLOCKS; i++) {
+		if (ctx->h[i])
+			gf128mul_free_4k(ctx->h[i]);
+		ctx->h[i] = NULL;
+	}
+}
+
+static int gcm_aes_setkey(struct crypto_aead *aead, const u8 *key,
+			  unsigned int keylen)
+{
+	struct gcm_aes_ctx *ctx = crypto_aead_ctx(aead);
+	be128 h, hn;
+	int err, i;
+
+	crypto_cipher_clear_flags(ctx->aes, CRYPTO_TFM_REQ_MASK);
+	crypto_cipher_set_flags(ctx->aes, crypto_aead_get_flags(aead) &
+				CRYPTO_TFM_REQ_MASK);
+
+	err = crypto_cipher_setkey(ctx->aes, key, keylen);
+	crypto_aead_set_flags(aead, crypto_cipher_get_flags(ctx->aes) &
+			      CRYPTO_TFM_RES_MASK);
+	if (err)
+		return err;
+
+	memset(&h, 0, sizeof(h));
+	crypto_cipher_encrypt_one(ctx->aes, (u8 *)&h, (u8 *)&h);
+
+	gcm_aes_free_tables(ctx);
+	hn = h;
+	for (i = GCM_AES_BLOCKS - 1; i >= 0; i--) {
+		ctx->h[i] = gf128mul_init_4k_lle(&hn);
+		if (!ctx->h[i]) {
+			gcm_aes_free_tables(ctx);
+			return -ENOMEM;
+		}
+		gf128mul_lle(&hn, &h);
+	}
+
+	return 0;
+}
+
+static int gcm_aes_setauthsize(struct crypto_aead *tfm, unsigned int authsize)
+{
+	switch (authsize) {
+	case 4:
+	case 8:
+	case 12:
+	case 13:
+	case 14:
+	case 15:
+	case 16:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Hash whole blocks, GCM_AES_BLOCKS of them at a time while there are */
+static void gcm_aes_ghash(struct gcm_aes_ctx *ctx, be128 *hash,
+			  const u8 *src, unsigned int nblocks)
+{
+	be128 x[GCM_AES_BLOCKS];
+
+	while (nblocks >= GCM_AES_BLOCKS) {
+		memcpy(x, src, sizeof(x));
+		be128_xor(&x[0], &x[0], hash);
+		gf128mul_4k_lle_sum(hash, x, ctx->h, GCM_AES_BLOCKS);
+		src += sizeof(x);
+		nblocks -= GCM_AES_BLOCKS;
+	}
+
+	while (nblocks--) {
+		crypto_xor((u8 *)hash, src, AES_BLOCK_SIZE);
+		gf128mul_4k_lle(hash, ctx->h[GCM_AES_BLOCKS - 1]);
+		src += AES_BLOCK_SIZE;
+	}
+}
+
+static void gcm_aes_ghash_update(struct gcm_aes_ctx *ctx,
+				 struct gcm_aes_state *st,
+				 const u8 *src, unsigned int len)
+{
+	unsigned int n;
+
+	if (st->buflen) {
+		n = min(len, AES_BLOCK_SIZE - st->buflen);
+		memcpy(st->buf + st->buflen, src, n);
+		st->buflen += n;
+		src += n;
+		len -= n;
+		if (st->buflen < AES_BLOCK_SIZE)
+			return;
+		gcm_aes_ghash(ctx, &st->hash, st->buf, 1);
+		st->buflen = 0;
+	}
+
+	gcm_aes_ghash(ctx, &st->hash, src, len / AES_BLOCK_SIZE);
+	src += len & ~(AES_BLOCK_SIZE - 1);
+	len &= AES_BLOCK_SIZE - 1;
+
+	memcpy(st->buf, src, len);
+	st->buflen = len;
+}
+
+/* GCM pads the associated data and the ciphertext to whole blocks */
+static void gcm_aes_ghash_pad(struct gcm_aes_ctx *ctx,
+			      struct gcm_aes_state *st)
+{
+	if (!st->buflen)
+		return;
+
+	memset(st->buf + st->buflen, 0, AES_BLOCK_SIZE - st->buflen);
+	gcm_aes_ghash(ctx, &st->hash, st->buf, 1);
+	st->buflen = 0;
+}
+
+static void gcm_aes_ghash_sg(struct gcm_aes_ctx *ctx,
+			     struct gcm_aes_state *st,
+			     struct scatterlist *sg, unsigned int len)
+{
+	struct scatter_walk walk;
+	unsigned int n;
+	u8 *vaddr;
+
+	if (!len)
+		return;
+
+	scatterwalk_start(&walk, sg);
+	while (len) {
+		n = scatterwalk_clamp(&walk, len);
+		vaddr = scatterwalk_map(&walk, 0);
+		gcm_aes_ghash_update(ctx, st, vaddr, n);
+		scatterwalk_unmap(vaddr, 0);
+		scatterwalk_advance(&walk, n);
+		len -= n;
+		scatterwalk_done(&walk, 0, len);
+	}
+}
+
+static void gcm_aes_keystream(struct gcm_aes_ctx *ctx, u8 *ctr, u8 *ks,
+			      unsigned int nblocks)
+{
+	while (nblocks--) {
+		crypto_cipher_encrypt_one(ctx->aes, ks, ctr);
+		crypto_inc(ctr + 12, 4);
+		ks += AES_BLOCK_SIZE;
+	}
+}
+
+/*
+ * XOR len bytes of src with the keystream in ks into dst, hashing the
+ * ciphertext: src when decrypting, which may be dst, and dst otherwise.
+ */
+static void gcm_aes_xor(struct gcm_aes_ctx *ctx, struct gcm_aes_state *st,
+			u8 *dst, const u8 *src, u8 *ks, unsigned int len,
+			int enc)
+{
+	if (!enc)
+		gcm_aes_ghash_update(ctx, st, src, len);
+	crypto_xor(ks, src, len);
+	memcpy(dst, ks, len);
+	if (enc)
+		gcm_aes_ghash_update(ctx, st, dst, len);
+}
+
+static void gcm_aes_crypt_chunk(struct gcm_aes_ctx *ctx,
+				struct gcm_aes_state *st,
+				u8 *dst, const u8 *src, unsigned int len,
+				int enc)
+{
+	u8 ks[GCM_AES_BLOCKS * AES_BLOCK_SIZE];
+	unsigned int n;
+
+	/* the rest of the last block of the previous chunk */
+	if (st->ksoff < AES_BLOCK_SIZE) {
+		n = min(len, AES_BLOCK_SIZE - st->ksoff);
+		gcm_aes_xor(ctx, st, dst, src, st->ks + st->ksoff, n, enc);
+		st->ksoff += n;
+		dst += n;
+		src += n;
+		len -= n;
+	}
+
+	/* from here on the blocks to hash are whole ones, st->buflen is 0 */
+	while (len >= sizeof(ks)) {
+		gcm_aes_keystream(ctx, st->ctr, ks, GCM_AES_BLOCKS);
+		gcm_aes_xor(ctx, st, dst, src, ks, sizeof(ks), enc);
+		dst += sizeof(ks);
+		src += sizeof(ks);
+		len -= sizeof(ks);
+	}
+
+	while (len >= AES_BLOCK_SIZE) {
+		gcm_aes_keystream(ctx, st->ctr, ks, 1);
+		gcm_aes_xor(ctx, st, dst, src, ks, AES_BLOCK_SIZE, enc);
+		dst += AES_BLOCK_SIZE;
+		src += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	}
+
+	if (len) {
+		gcm_aes_keystream(ctx, st->ctr, st->ks, 1);
+		gcm_aes_xor(ctx, st, dst, src, st->ks, len, enc);
+		st->ksoff = len;
+	}
+}
+
+static void gcm_aes_crypt_sg(struct gcm_aes_ctx *ctx,
+			     struct gcm_aes_state *st,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int len, int enc)
+{
+	struct scatter_walk in, out;
+	unsigned int n;
+	u8 *vsrc, *vdst;
+
+	if (!len)
+		return;
+
+	scatterwalk_start(&in, src);
+	scatterwalk_start(&out, dst);
+	while (len) {
+		n = scatterwalk_clamp(&in, len);
+		n = scatterwalk_clamp(&out, n);
+		vsrc = scatterwalk_map(&in, 0);
+		vdst = scatterwalk_map(&out, 1);
+		gcm_aes_crypt_chunk(ctx, st, vdst, vsrc, n, enc);
+		scatterwalk_unmap(vdst, 1);
+		scatterwalk_unmap(vsrc, 0);
+		scatterwalk_advance(&in, n);
+		scatterwalk_advance(&out, n);
+		len -= n;
+		scatterwalk_done(&in, 0, len);
+		scatterwalk_done(&out, 1, len);
+	}
+}
+
+/* Returns the tag over the associated data and cryptlen bytes of req */
+static void gcm_aes_crypt(struct aead_request *req, unsigned int cryptlen,
+			  u8 *tag, int enc)
+{
+	struct gcm_aes_ctx *ctx = crypto_aead_ctx(crypto_aead_reqtfm(req));
+	struct gcm_aes_state st;
+	u8 j0[AES_BLOCK_SIZE];
+	be128 lengths;
+
+	memset(&st, 0, sizeof(st));
+	st.ksoff = AES_BLOCK_SIZE;
+
+	/* the IV is 12 bytes, the rest of the 16 is left for the counter */
+	memcpy(j0, req->iv, 12);
+	*(__be32 *)(j0 + 12) = cpu_to_be32(1);
+	memcpy(st.ctr, j0, AES_BLOCK_SIZE);
+	crypto_inc(st.ctr + 12, 4);
+
+	gcm_aes_ghash_sg(ctx, &st, req->assoc, req->assoclen);
+	gcm_aes_ghash_pad(ctx, &st);
+
+	gcm_aes_crypt_sg(ctx, &st, req->dst, req->src, cryptlen, enc);
+	gcm_aes_ghash_pad(ctx, &st);
+
+	lengths.a = cpu_to_be64((u64)req->assoclen * 8);
+	lengths.b = cpu_to_be64((u64)cryptlen * 8);
+	gcm_aes_ghash(ctx, &st.hash, (u8 *)&lengths, 1);
+
+	crypto_cipher_encrypt_one(ctx->aes, tag, j0);
+	crypto_xor(tag, (u8 *)&st.hash, AES_BLOCK_SIZE);
+}
+
+static int gcm_aes_encrypt(struct aead_request *req)
+{
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	u8 tag[AES_BLOCK_SIZE];
+
+	gcm_aes_crypt(req, req->cryptlen, tag, 1);
+	scatterwalk_map_and_copy(tag, req->dst, req->cryptlen,
+				 crypto_aead_authsize(aead), 1);
+	return 0;
+}
+
+static int gcm_aes_decrypt(struct aead_request *req)
+{
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	unsigned int authsize = crypto_aead_authsize(aead);
+	u8 tag[AES_BLOCK_SIZE], itag[AES_BLOCK_SIZE];
+	unsigned int cryptlen = req->cryptlen;
+
+	if (cryptlen < authsize)
+		return -EINVAL;
+	cryptlen -= authsize;
+
+	gcm_aes_crypt(req, cryptlen, tag, 0);
+	scatterwalk_map_and_copy(itag, req->src, cryptlen, authsize, 0);
+	return memcmp(itag, tag, authsize) ? -EBADMSG : 0;
+}
+
+static int gcm_aes_init_tfm(struct crypto_tfm *tfm)
+{
+	struct gcm_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+	struct crypto_cipher *aes;
+
+	aes = crypto_alloc_cipher("aes", 0, 0);
+	if (IS_ERR(aes))
+		return PTR_ERR(aes);
+
+	ctx->aes = aes;
+	return 0;
+}
+
+static void gcm_aes_exit_tfm(struct crypto_tfm *tfm)
+{
+	struct gcm_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	gcm_aes_free_tables(ctx);
+	crypto_free_cipher(ctx->aes);
+}
+
+/*
+ * Above gcm(aes) built from the generic or assembler AES and ghash, below
+ * the one built from ctr-aes-aesni, which goes through PCLMULQDQ.
+ */
+static struct crypto_alg gcm_aes_alg = {
+	.cra_name		= "gcm(aes)",
+	.cra_driver_name	= "gcm-aes-generic",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_AEAD,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct gcm_aes_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_aead_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(gcm_aes_alg.cra_list),
+	.cra_init		= gcm_aes_init_tfm,
+	.cra_exit		= gcm_aes_exit_tfm,
+	.cra_u			= {
+		.aead = {
+			.ivsize		= 16,
+			.maxauthsize	= 16,
+			.setkey		= gcm_aes_setkey,
+			.setauthsize	= gcm_aes_setauthsize,
+			.encrypt	= gcm_aes_encrypt,
+			.decrypt	= gcm_aes_decrypt,
+		}
+	}
+};
+
+static int __init gcm_aes_mod_init(void)
+{
+	return crypto_register_alg(&gcm_aes_alg);
+}
+
+static void __exit gcm_aes_mod_exit(void)
+{
+	crypto_unregister_alg(&gcm_aes_alg);
+}
+
+module_init(gcm_aes_mod_init);
+module_exit(gcm_aes_mod_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Single-pass GCM-AES");
+MODULE_ALIAS("gcm(aes)");
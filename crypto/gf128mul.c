@@ -182,7 +182,7 @@ void gf128mul_lle(be128 *r, const be128 *b)
 	for (i = 0; i < 7; ++i)
 		gf128mul_x_lle(&p[i + 1], &p[i]);
 
-	memset(r, 0, sizeof(r));
+	memset(r, 0, sizeof(*r));
 	for (i = 0;;) {
 		u8 ch = ((u8 *)b)[15 - i];
 
@@ -220,7 +220,7 @@ void gf128mul_bbe(be128 *r, const be128 *b)
 	for (i = 0; i < 7; ++i)
 		gf128mul_x_bbe(&p[i + 1], &p[i]);
 
-	memset(r, 0, sizeof(r));
+	memset(r, 0, sizeof(*r));
 	for (i = 0;;) {
 		u8 ch = ((u8 *)b)[i];
 
@@ -458,6 +458,31 @@ void gf128mul_4k_lle(be128 *a, struct gf128mul_4k *t)
 }
 EXPORT_SYMBOL(gf128mul_4k_lle);
 
+/*	Multiply each of the n values in a by the value of its own table in
+    t and add up the products.  Multiplying by x^8 is linear, so the sum
+    can be accumulated byte by byte for all values at once, and the
+    reduction that multiplying by x^8 involves is then done once per byte
+    instead of once per byte and value.  GCM uses this with the tables of
+    H^n .. H^1 to hash n blocks in one go.
+*/
+void gf128mul_4k_lle_sum(be128 *r, const be128 *a, struct gf128mul_4k **t,
+			 int n)
+{
+	be128 z[1];
+	int i = 15, k;
+
+	*z = t[0]->t[((const u8 *)&a[0])[15]];
+	for (k = 1; k < n; k++)
+		be128_xor(z, z, &t[k]->t[((const u8 *)&a[k])[15]]);
+	while (i--) {
+		gf128mul_x8_lle(z);
+		for (k = 0; k < n; k++)
+			be128_xor(z, z, &t[k]->t[((const u8 *)&a[k])[i]]);
+	}
+	*r = *z;
+}
+EXPORT_SYMBOL(gf128mul_4k_lle_sum);
+
 void gf128mul_4k_bbe(be128 *a, struct gf128mul_4k *t)
 {
 	u8 *ap = (u8 *)a;
@@ -22,6 +22,7 @@
  *
  */
 
+#include <crypto/aead.h>
 #include <crypto/hash.h>
 #include <linux/err.h>
 #include <linux/init.h>
@@ -240,6 +241,191 @@ out:
 	crypto_free_blkcipher(tfm);
 }
 
+static int test_aead_jiffies(struct aead_request *req, int enc,
+			     int blen, int sec)
+{
+	unsigned long start, end;
+	int bcount;
+	int ret;
+
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		if (enc)
+			ret = crypto_aead_encrypt(req);
+		else
+			ret = crypto_aead_decrypt(req);
+
+		if (ret)
+			return ret;
+	}
+
+	printk("%d operations in %d seconds (%ld bytes)\n",
+	       bcount, sec, (long)bcount * blen);
+	return 0;
+}
+
+static int test_aead_cycles(struct aead_request *req, int enc, int blen)
+{
+	unsigned long cycles = 0;
+	int ret = 0;
+	int i;
+
+	local_bh_disable();
+	local_irq_disable();
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		if (enc)
+			ret = crypto_aead_encrypt(req);
+		else
+			ret = crypto_aead_decrypt(req);
+
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		if (enc)
+			ret = crypto_aead_encrypt(req);
+		else
+			ret = crypto_aead_decrypt(req);
+		end = get_cycles();
+
+		if (ret)
+			goto out;
+
+		cycles += end - start;
+	}
+
+out:
+	local_irq_enable();
+	local_bh_enable();
+
+	if (ret == 0)
+		printk("1 operation in %lu cycles (%d bytes)\n",
+		       (cycles + 4) / 8, blen);
+
+	return ret;
+}
+
+/* 8 bytes of associated data and a 16 byte tag, as with ESP */
+#define AEAD_ASSOC_SIZE		8
+#define AEAD_AUTH_SIZE		16
+
+static u32 aead_sizes[] = { 16, 64, 256, 512, 1024, 1420, 4096, 0 };
+
+/*
+ * The data is encrypted in place in tvmem[1] and tvmem[2].  To decrypt
+ * it has to be encrypted once, and is then decrypted into tvmem[3] so
+ * that it stays valid.
+ */
+static void test_aead_speed(const char *algo, int enc, unsigned int sec,
+			    u8 *keysize)
+{
+	unsigned int ret, i, iv_len;
+	u8 iv[128], *key;
+	struct crypto_aead *tfm;
+	struct aead_request *req;
+	struct scatterlist asg[1], sg[2], dsg[1];
+	const char *e;
+	u32 *b_size;
+
+	if (enc == ENCRYPT)
+		e = "encryption";
+	else
+		e = "decryption";
+
+	tfm = crypto_alloc_aead(algo, 0, CRYPTO_ALG_ASYNC);
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	printk("\ntesting speed of %s (%s) %s\n", algo,
+	       crypto_tfm_alg_driver_name(crypto_aead_tfm(tfm)), e);
+
+	req = aead_request_alloc(tfm, GFP_KERNEL);
+	if (!req) {
+		printk("failed to allocate request for %s\n", algo);
+		goto out_free_tfm;
+	}
+	aead_request_set_callback(req, 0, NULL, NULL);
+
+	ret = crypto_aead_setauthsize(tfm, AEAD_AUTH_SIZE);
+	if (ret) {
+		printk("setauthsize() failed\n");
+		goto out;
+	}
+
+	memset(tvmem[0], 0xff, PAGE_SIZE);
+	sg_init_one(asg, tvmem[0], AEAD_ASSOC_SIZE);
+	key = (u8 *)tvmem[0] + AEAD_ASSOC_SIZE;
+
+	sg_init_table(sg, 2);
+	sg_set_buf(&sg[0], tvmem[1], PAGE_SIZE);
+	sg_set_buf(&sg[1], tvmem[2], PAGE_SIZE);
+	sg_init_one(dsg, tvmem[3], PAGE_SIZE);
+
+	iv_len = crypto_aead_ivsize(tfm);
+	memset(iv, 0xff, iv_len);
+
+	i = 0;
+	do {
+		b_size = aead_sizes;
+		do {
+			printk("test %u (%d bit key, %d byte blocks): ", i,
+			       *keysize * 8, *b_size);
+
+			ret = crypto_aead_setkey(tfm, key, *keysize);
+			if (ret) {
+				printk("setkey() failed flags=%x\n",
+				       crypto_aead_get_flags(tfm));
+				goto out;
+			}
+
+			memset(tvmem[1], 0xff, PAGE_SIZE);
+			memset(tvmem[2], 0xff, PAGE_SIZE);
+			aead_request_set_assoc(req, asg, AEAD_ASSOC_SIZE);
+			aead_request_set_crypt(req, sg, sg, *b_size, iv);
+
+			if (!enc) {
+				ret = crypto_aead_encrypt(req);
+				if (ret) {
+					printk("encryption failed\n");
+					break;
+				}
+				aead_request_set_crypt(req, sg, dsg,
+						       *b_size + AEAD_AUTH_SIZE,
+						       iv);
+			}
+
+			if (sec)
+				ret = test_aead_jiffies(req, enc, *b_size,
+							sec);
+			else
+				ret = test_aead_cycles(req, enc, *b_size);
+
+			if (ret) {
+				printk("%s() failed ret=%d\n", e, ret);
+				break;
+			}
+			b_size++;
+			i++;
+		} while (*b_size);
+		keysize++;
+	} while (*keysize);
+
+out:
+	aead_request_free(req);
+out_free_tfm:
+	crypto_free_aead(tfm);
+}
+
 static int test_hash_jiffies_digest(struct hash_desc *desc,
 				    struct scatterlist *sg, int blen,
 				    char *out, int sec)
@@ -1075,6 +1261,18 @@ static int do_test(int m)
 				  speed_template_16_32);
 		break;
 
+	case 207:
+		test_aead_speed("gcm(aes)", ENCRYPT, sec,
+				speed_template_16_24_32);
+		test_aead_speed("gcm(aes)", DECRYPT, sec,
+				speed_template_16_24_32);
+		/* the two passes of the GCM template, for comparison */
+		test_aead_speed("gcm_base(ctr(aes),ghash-generic)",
+				ENCRYPT, sec, speed_template_16_24_32);
+		test_aead_speed("gcm_base(ctr(aes),ghash-generic)",
+				DECRYPT, sec, speed_template_16_24_32);
+		break;
+
 	case 300:
 		/* fall through */
 
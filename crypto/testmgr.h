@@ -2982,8 +2982,8 @@ static struct cipher_testvec cast6_dec_tv_template[] = {
 #define AES_CTR_DEC_TEST_VECTORS 3
 #define AES_CTR_3686_ENC_TEST_VECTORS 7
 #define AES_CTR_3686_DEC_TEST_VECTORS 6
-#define AES_GCM_ENC_TEST_VECTORS 9
-#define AES_GCM_DEC_TEST_VECTORS 8
+#define AES_GCM_ENC_TEST_VECTORS 10
+#define AES_GCM_DEC_TEST_VECTORS 9
 #define AES_GCM_4106_ENC_TEST_VECTORS 7
 #define AES_GCM_4106_DEC_TEST_VECTORS 7
 #define AES_CCM_ENC_TEST_VECTORS 7
@@ -5663,6 +5663,52 @@ static struct aead_testvec aes_gcm_enc_tv_template[] = {
 		.result	= "\x53\x0f\x8a\xfb\xc7\x45\x36\xb9"
 			  "\xa9\x63\xb4\xf1\xc4\xcb\x73\x8b",
 		.rlen	= 16,
+	}, { /* Six blocks and a partial one, to go through the multi-block path */
+		.key	= "\x3c\x21\x06\x6b\x48\xad\x92\xf7"
+			  "\xd4\x39\x1e\x03\x60\x45\xaa\x8f",
+		.klen	= 16,
+		.iv	= "\xa1\xa8\xaf\xb6\xbd\xc4\xcb\xd2"
+			  "\xd9\xe0\xe7\xee",
+		.input	= "\x0b\x30\x55\x7a\x9f\xc4\xe9\x0e"
+			  "\x33\x58\x7d\xa2\xc7\xec\x11\x36"
+			  "\x5b\x80\xa5\xca\xef\x14\x39\x5e"
+			  "\x83\xa8\xcd\xf2\x17\x3c\x61\x86"
+			  "\xab\xd0\xf5\x1a\x3f\x64\x89\xae"
+			  "\xd3\xf8\x1d\x42\x67\x8c\xb1\xd6"
+			  "\xfb\x20\x45\x6a\x8f\xb4\xd9\xfe"
+			  "\x23\x48\x6d\x92\xb7\xdc\x01\x26"
+			  "\x4b\x70\x95\xba\xdf\x04\x29\x4e"
+			  "\x73\x98\xbd\xe2\x07\x2c\x51\x76"
+			  "\x9b\xc0\xe5\x0a\x2f\x54\x79\x9e"
+			  "\xc3\xe8\x0d\x32\x57\x7c\xa1\xc6"
+			  "\xeb\x10\x35\x5a\x7f\xa4\xc9\xee"
+			  "\x13\x38\x5d\x82\xa7",
+		.ilen	= 109,
+		.assoc	= "\x40\x43\x46\x49\x4c\x4f\x52\x55"
+			  "\x58\x5b\x5e\x61\x64\x67\x6a\x6d"
+			  "\x70\x73\x76\x79",
+		.alen	= 20,
+		.result	= "\xe1\xa5\x08\x34\x7e\x6f\x2a\xef"
+			  "\x5b\x7f\x3a\xa8\x81\x8a\x42\xcf"
+			  "\x6b\x20\xba\xd7\xa0\x5f\x39\xa5"
+			  "\x79\x43\x67\x25\x68\xcc\xcd\x82"
+			  "\xb8\x5c\x9f\xc2\x28\x38\x2e\x20"
+			  "\x9e\x5f\xb5\x32\xd1\x1b\x70\xfe"
+			  "\x89\x69\x7a\xda\xf4\x1f\x04\xc5"
+			  "\xb2\x8b\xe6\x90\x69\xb9\xa0\x85"
+			  "\xd8\xc2\x4d\x35\x16\x7f\xff\x0a"
+			  "\x84\x33\xe4\xb7\x3d\xa4\xf0\x55"
+			  "\xaa\x0c\x1f\x09\x58\x49\xb3\x42"
+			  "\xa1\x52\x4e\xb3\x9c\x0d\xdb\xda"
+			  "\x4b\xd5\x6e\xfb\x93\x3e\x5b\xb5"
+			  "\x9e\x56\x46\x44\x7e\x3f\xbb\xdf"
+			  "\x6c\xcf\x44\xc3\xb4\x46\xdd\x13"
+			  "\x92\x47\x86\xff\xc3",
+		.rlen	= 125,
+		.np	= 3,
+		.tap	= { 37, 50, 22 },
+		.anp	= 2,
+		.atap	= { 5, 15 }
 	}
 };
 
@@ -5865,6 +5911,52 @@ static struct aead_testvec aes_gcm_dec_tv_template[] = {
 			  "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57"
 			  "\xba\x63\x7b\x39",
 		.rlen	= 60,
+	}, { /* Six blocks and a partial one, to go through the multi-block path */
+		.key	= "\x3c\x21\x06\x6b\x48\xad\x92\xf7"
+			  "\xd4\x39\x1e\x03\x60\x45\xaa\x8f",
+		.klen	= 16,
+		.iv	= "\xa1\xa8\xaf\xb6\xbd\xc4\xcb\xd2"
+			  "\xd9\xe0\xe7\xee",
+		.input	= "\xe1\xa5\x08\x34\x7e\x6f\x2a\xef"
+			  "\x5b\x7f\x3a\xa8\x81\x8a\x42\xcf"
+			  "\x6b\x20\xba\xd7\xa0\x5f\x39\xa5"
+			  "\x79\x43\x67\x25\x68\xcc\xcd\x82"
+			  "\xb8\x5c\x9f\xc2\x28\x38\x2e\x20"
+			  "\x9e\x5f\xb5\x32\xd1\x1b\x70\xfe"
+			  "\x89\x69\x7a\xda\xf4\x1f\x04\xc5"
+			  "\xb2\x8b\xe6\x90\x69\xb9\xa0\x85"
+			  "\xd8\xc2\x4d\x35\x16\x7f\xff\x0a"
+			  "\x84\x33\xe4\xb7\x3d\xa4\xf0\x55"
+			  "\xaa\x0c\x1f\x09\x58\x49\xb3\x42"
+			  "\xa1\x52\x4e\xb3\x9c\x0d\xdb\xda"
+			  "\x4b\xd5\x6e\xfb\x93\x3e\x5b\xb5"
+			  "\x9e\x56\x46\x44\x7e\x3f\xbb\xdf"
+			  "\x6c\xcf\x44\xc3\xb4\x46\xdd\x13"
+			  "\x92\x47\x86\xff\xc3",
+		.ilen	= 125,
+		.assoc	= "\x40\x43\x46\x49\x4c\x4f\x52\x55"
+			  "\x58\x5b\x5e\x61\x64\x67\x6a\x6d"
+			  "\x70\x73\x76\x79",
+		.alen	= 20,
+		.result	= "\x0b\x30\x55\x7a\x9f\xc4\xe9\x0e"
+			  "\x33\x58\x7d\xa2\xc7\xec\x11\x36"
+			  "\x5b\x80\xa5\xca\xef\x14\x39\x5e"
+			  "\x83\xa8\xcd\xf2\x17\x3c\x61\x86"
+			  "\xab\xd0\xf5\x1a\x3f\x64\x89\xae"
+			  "\xd3\xf8\x1d\x42\x67\x8c\xb1\xd6"
+			  "\xfb\x20\x45\x6a\x8f\xb4\xd9\xfe"
+			  "\x23\x48\x6d\x92\xb7\xdc\x01\x26"
+			  "\x4b\x70\x95\xba\xdf\x04\x29\x4e"
+			  "\x73\x98\xbd\xe2\x07\x2c\x51\x76"
+			  "\x9b\xc0\xe5\x0a\x2f\x54\x79\x9e"
+			  "\xc3\xe8\x0d\x32\x57\x7c\xa1\xc6"
+			  "\xeb\x10\x35\x5a\x7f\xa4\xc9\xee"
+			  "\x13\x38\x5d\x82\xa7",
+		.rlen	= 109,
+		.np	= 3,
+		.tap	= { 37, 50, 38 },
+		.anp	= 2,
+		.atap	= { 5, 15 }
 	}
 };
 
@@ -95,6 +95,16 @@
  * Nonetheless, these numbers should be useful for the vast majority
  * of purposes.
  *
+ * Output that does not need entropy accounting, i.e. /dev/urandom and
+ * get_random_bytes(), does not hash the pools directly.  Instead each
+ * CPU runs its own ChaCha20 keystream generator (a "crng"), keyed from
+ * a primary crng which is in turn reseeded from the nonblocking pool
+ * every CRNG_RESEED_INTERVAL.  After every request the per-CPU key is
+ * replaced by fresh keystream, so a later compromise of the state
+ * does not reveal earlier output.  Readers on different CPUs share no
+ * locks or cachelines on this path, and only the occasional reseed
+ * touches the pools.
+ *
  * Exported interfaces ---- output
  * ===============================
  *
@@ -266,6 +276,17 @@
 #define SEC_XFER_SIZE 512
 #define EXTRACT_SIZE 10
 
+/*
+ * How often the primary crng pulls a new key from the nonblocking pool,
+ * and how often the per-CPU crngs rekey from the primary.  Until the
+ * input pool has gathered CRNG_SEEDED_BITS of entropy at reseed time we
+ * reseed once a second instead, so that early boot output picks up new
+ * entropy quickly.
+ */
+#define CRNG_RESEED_INTERVAL (300 * HZ)
+#define CRNG_SEEDED_BITS 256
+#define CRNG_BATCH (4 * CHACHA20_BLOCK_SIZE)
+
 /*
  * The minimum number of bits of entropy before we wake up a read on
  * /dev/random.  Should be enough to do a significant reseed.
@@ -925,6 +946,147 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
 	return ret;
 }
 
+/*********************************************************************
+ *
+ * Per-CPU ChaCha20 output generators
+ *
+ *********************************************************************/
+
+struct crng_state {
+	__u32 state[16];
+	unsigned long init_time;
+	unsigned long generation;
+	int cpu;			/* the CPU it was keyed on */
+};
+
+/*
+ * primary_crng is only used to key the per-CPU crngs; crng_generation
+ * counts its reseeds, and a per-CPU crng whose generation lags behind
+ * rekeys on its next use.  Generation 0 means "never seeded".
+ */
+static struct crng_state primary_crng;
+static DEFINE_SPINLOCK(primary_crng_lock);
+static unsigned long crng_generation;
+static bool crng_fully_seeded;
+static bool crng_reseed_pending;
+
+/*
+ * get_random_bytes() is used before setup_per_cpu_areas(), to pick the
+ * stack canary, and then keys the per-CPU template that every CPU gets a
+ * copy of.  The CPU each crng was keyed on is kept with it, so that all
+ * the copies but one rekey on first use instead of sharing a keystream.
+ */
+static DEFINE_PER_CPU(struct crng_state, crng_cpu_state);
+
+static inline unsigned long crng_reseed_interval(void)
+{
+	return crng_fully_seeded ? CRNG_RESEED_INTERVAL : HZ;
+}
+
+/*
+ * Mix a fresh key from the nonblocking pool into the primary crng.  The
+ * pool does all of the entropy accounting, so /dev/random keeps exactly
+ * the same reservation against urandom users as before.
+ *
+ * Called with primary_crng_lock held and interrupts disabled.
+ */
+static void crng_reseed(void)
+{
+	__u32 key[CHACHA20_KEY_SIZE / sizeof(__u32)];
+	int i;
+
+	if (!crng_fully_seeded &&
+	    input_pool.entropy_count >= CRNG_SEEDED_BITS)
+		crng_fully_seeded = true;
+
+	extract_entropy(&nonblocking_pool, key, sizeof(key), 0, 0);
+	if (!crng_generation) {
+		chacha20_init_state(primary_crng.state, key);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(key); i++)
+			primary_crng.state[4 + i] ^= key[i];
+	}
+	memset(key, 0, sizeof(key));
+
+	if (!++crng_generation)
+		crng_generation = 1;
+	primary_crng.init_time = jiffies;
+	crng_reseed_pending = false;
+}
+
+/*
+ * Give this CPU's crng a new key and nonce from the primary crng,
+ * reseeding the primary first if it is due.
+ *
+ * Called with interrupts disabled.
+ */
+static void crng_rekey(struct crng_state *crng)
+{
+	__u32 buf[CHACHA20_BLOCK_SIZE / sizeof(__u32)];
+
+	spin_lock(&primary_crng_lock);
+	if (!crng_generation || crng_reseed_pending ||
+	    time_after(jiffies, primary_crng.init_time +
+				crng_reseed_interval()))
+		crng_reseed();
+
+	chacha20_block(primary_crng.state, buf);
+	chacha20_init_state(crng->state, buf);
+	crng->state[13] = buf[8];
+	crng->state[14] = buf[9];
+	crng->state[15] = buf[10];
+	crng->generation = crng_generation;
+	crng->init_time = jiffies;
+	crng->cpu = smp_processor_id();
+
+	/* don't let the primary's next output be derived from this one */
+	chacha20_block(primary_crng.state, buf);
+	memcpy(&primary_crng.state[4], buf, CHACHA20_KEY_SIZE);
+	spin_unlock(&primary_crng_lock);
+
+	memset(buf, 0, sizeof(buf));
+}
+
+/*
+ * Fill @out with up to CRNG_BATCH bytes from this CPU's crng.
+ *
+ * Interrupts are disabled rather than just preemption because
+ * get_random_bytes() may be called from interrupt context, and an
+ * interrupted block must not be generated twice.
+ */
+static void crng_extract(__u8 *out, int nbytes)
+{
+	struct crng_state *crng;
+	__u8 tmp[CHACHA20_BLOCK_SIZE];
+	unsigned long flags;
+
+	local_irq_save(flags);
+	crng = &__get_cpu_var(crng_cpu_state);
+	if (unlikely(crng->generation != ACCESS_ONCE(crng_generation) ||
+		     !crng->generation || crng_reseed_pending ||
+		     crng->cpu != smp_processor_id() ||
+		     time_after(jiffies, crng->init_time +
+					 crng_reseed_interval())))
+		crng_rekey(crng);
+
+	while (nbytes >= CHACHA20_BLOCK_SIZE) {
+		chacha20_block(crng->state, out);
+		out += CHACHA20_BLOCK_SIZE;
+		nbytes -= CHACHA20_BLOCK_SIZE;
+	}
+	if (nbytes) {
+		chacha20_block(crng->state, tmp);
+		memcpy(out, tmp, nbytes);
+	}
+
+	/* Fast key erasure: output already returned can't be regenerated */
+	chacha20_block(crng->state, tmp);
+	memcpy(&crng->state[4], tmp, CHACHA20_KEY_SIZE);
+	local_irq_restore(flags);
+
+	memset(tmp, 0, sizeof(tmp));
+}
+
 /*
  * This function is the exported kernel interface.  It returns some
  * number of good random numbers, suitable for seeding TCP sequence
@@ -932,7 +1094,15 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
  */
 void get_random_bytes(void *buf, int nbytes)
 {
-	extract_entropy(&nonblocking_pool, buf, nbytes, 0, 0);
+	__u8 *p = buf;
+
+	while (nbytes > 0) {
+		int i = min_t(int, nbytes, CRNG_BATCH);
+
+		crng_extract(p, i);
+		p += i;
+		nbytes -= i;
+	}
 }
 EXPORT_SYMBOL(get_random_bytes);
 
@@ -1060,7 +1230,35 @@ random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 static ssize_t
 urandom_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+	ssize_t ret = 0, i;
+	__u8 tmp[CRNG_BATCH];
+
+	while (nbytes) {
+		if (need_resched()) {
+			if (signal_pending(current)) {
+				if (ret == 0)
+					ret = -ERESTARTSYS;
+				break;
+			}
+			schedule();
+		}
+
+		i = min_t(size_t, nbytes, sizeof(tmp));
+		crng_extract(tmp, i);
+		if (copy_to_user(buf, tmp, i)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		nbytes -= i;
+		buf += i;
+		ret += i;
+	}
+
+	/* Wipe data just returned from memory */
+	memset(tmp, 0, sizeof(tmp));
+
+	return ret;
 }
 
 static unsigned int
@@ -1112,6 +1310,9 @@ static ssize_t random_write(struct file *file, const char __user *buffer,
 	if (ret)
 		return ret;
 
+	/* let the crngs pick up what was written on their next use */
+	crng_reseed_pending = true;
+
 	return (ssize_t)count;
 }
 
@@ -1148,6 +1349,7 @@ static long random_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 		if (retval < 0)
 			return retval;
 		credit_entropy_bits(&input_pool, ent_count);
+		crng_reseed_pending = true;
 		return 0;
 	case RNDZAPENTCNT:
 	case RNDCLEARPOOL:
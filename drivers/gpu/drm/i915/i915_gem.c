@@ -31,6 +31,7 @@
 #include "i915_drv.h"
 #include "i915_trace.h"
 #include "intel_drv.h"
+#include <linux/shmem_fs.h>
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/pci.h>
@@ -361,8 +362,9 @@ i915_gem_shmem_pread_fast(struct drm_device *dev,
 		if ((page_offset + remain) > PAGE_SIZE)
 			page_length = PAGE_SIZE - page_offset;
 
-		page = read_cache_page_gfp(mapping, offset >> PAGE_SHIFT,
-					   GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		page = shmem_read_mapping_page_gfp(mapping,
+					offset >> PAGE_SHIFT,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (IS_ERR(page))
 			return PTR_ERR(page);
 
@@ -465,8 +467,9 @@ i915_gem_shmem_pread_slow(struct drm_device *dev,
 		if ((data_page_offset + page_length) > PAGE_SIZE)
 			page_length = PAGE_SIZE - data_page_offset;
 
-		page = read_cache_page_gfp(mapping, offset >> PAGE_SHIFT,
-					   GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		page = shmem_read_mapping_page_gfp(mapping,
+					offset >> PAGE_SHIFT,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (IS_ERR(page))
 			return PTR_ERR(page);
 
@@ -798,8 +801,9 @@ i915_gem_shmem_pwrite_fast(struct drm_device *dev,
 		if ((page_offset + remain) > PAGE_SIZE)
 			page_length = PAGE_SIZE - page_offset;
 
-		page = read_cache_page_gfp(mapping, offset >> PAGE_SHIFT,
-					   GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		page = shmem_read_mapping_page_gfp(mapping,
+					offset >> PAGE_SHIFT,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (IS_ERR(page))
 			return PTR_ERR(page);
 
@@ -908,8 +912,9 @@ i915_gem_shmem_pwrite_slow(struct drm_device *dev,
 		if ((data_page_offset + page_length) > PAGE_SIZE)
 			page_length = PAGE_SIZE - data_page_offset;
 
-		page = read_cache_page_gfp(mapping, offset >> PAGE_SHIFT,
-					   GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		page = shmem_read_mapping_page_gfp(mapping,
+					offset >> PAGE_SHIFT,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (IS_ERR(page)) {
 			ret = PTR_ERR(page);
 			goto out;
@@ -1559,11 +1564,11 @@ i915_gem_object_get_pages_gtt(struct drm_i915_gem_object *obj,
 	inode = obj->base.filp->f_path.dentry->d_inode;
 	mapping = inode->i_mapping;
 	for (i = 0; i < page_count; i++) {
-		page = read_cache_page_gfp(mapping, i,
-					   GFP_HIGHUSER |
-					   __GFP_COLD |
-					   __GFP_RECLAIMABLE |
-					   gfpmask);
+		page = shmem_read_mapping_page_gfp(mapping, i,
+						   GFP_HIGHUSER |
+						   __GFP_COLD |
+						   __GFP_RECLAIMABLE |
+						   gfpmask);
 		if (IS_ERR(page))
 			goto err_pages;
 
@@ -1705,9 +1710,7 @@ i915_gem_object_truncate(struct drm_i915_gem_object *obj)
 	 * when by shmem_delete_inode() to release the backing store.
 	 */
 	inode = obj->base.filp->f_path.dentry->d_inode;
-	truncate_inode_pages(inode->i_mapping, 0);
-	if (inode->i_op->truncate_range)
-		inode->i_op->truncate_range(inode, 0, (loff_t)-1);
+	shmem_truncate_range(inode, 0, (loff_t)-1);
 
 	obj->madv = __I915_MADV_PURGED;
 }
@@ -3954,8 +3957,8 @@ void i915_gem_detach_phys_object(struct drm_device *dev,
 
 	page_count = obj->base.size / PAGE_SIZE;
 	for (i = 0; i < page_count; i++) {
-		struct page *page = read_cache_page_gfp(mapping, i,
-							GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		struct page *page = shmem_read_mapping_page_gfp(mapping, i,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (!IS_ERR(page)) {
 			char *dst = kmap_atomic(page);
 			memcpy(dst, vaddr + i*PAGE_SIZE, PAGE_SIZE);
@@ -4016,8 +4019,8 @@ i915_gem_attach_phys_object(struct drm_device *dev,
 		struct page *page;
 		char *dst, *src;
 
-		page = read_cache_page_gfp(mapping, i,
-					   GFP_HIGHUSER | __GFP_RECLAIMABLE);
+		page = shmem_read_mapping_page_gfp(mapping, i,
+					GFP_HIGHUSER | __GFP_RECLAIMABLE);
 		if (IS_ERR(page))
 			return PTR_ERR(page);
 
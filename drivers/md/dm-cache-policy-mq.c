@@ -0,0 +1,444 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Multiqueue cache policy: promotes the blocks that are hit most often.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+/*
+ * Every origin block the policy knows about has an entry with a hit
+ * count.  The entries of the blocks in the cache sit on one multiqueue,
+ * the others on a second one, at the level given by the log of their hit
+ * count, least recently hit first within a level.
+ *
+ * A block is promoted once it has been hit promote_threshold times and,
+ * when the cache is full, more often than the coldest block in the cache,
+ * which it replaces.  So the cache settles on the hottest blocks without
+ * churning on blocks that are only touched once.  The hit counts are
+ * halved every so often, so that the policy follows a changing working
+ * set.  The entries for the blocks not in the cache are recycled coldest
+ * first.
+ */
+
+#define NR_QUEUE_LEVELS		16
+#define DEFAULT_PROMOTE_THRESHOLD 2
+#define MIN_ENTRIES		128
+
+struct queue {
+	struct list_head qs[NR_QUEUE_LEVELS];
+};
+
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	unsigned hit_count;
+	bool in_cache;
+};
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	dm_cblock_t cache_size;
+	dm_cblock_t nr_allocated;
+	dm_cblock_t next_free;
+	unsigned long *allocated;
+
+	struct queue pre_cache;
+	struct queue cache;
+
+	unsigned nr_entries;
+	struct entry *entries;
+	struct list_head free;
+
+	unsigned hash_bits;
+	struct hlist_head *table;
+
+	unsigned promote_threshold;
+
+	/* accesses since the hit counts were last halved */
+	unsigned nr_accesses;
+};
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+/*----------------------------------------------------------------*/
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		INIT_LIST_HEAD(q->qs + i);
+}
+
+static unsigned queue_level(struct entry *e)
+{
+	return min((unsigned)ilog2(e->hit_count + 1), NR_QUEUE_LEVELS - 1u);
+}
+
+static void queue_push(struct queue *q, struct entry *e)
+{
+	list_add_tail(&e->list, q->qs + queue_level(e));
+}
+
+static void queue_requeue(struct queue *q, struct entry *e)
+{
+	list_del(&e->list);
+	queue_push(q, e);
+}
+
+/* The least recently hit entry of the lowest level */
+static struct entry *queue_peek(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		if (!list_empty(q->qs + i))
+			return list_first_entry(q->qs + i, struct entry, list);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct hlist_head *bucket = mq->table + hash_64(oblock, mq->hash_bits);
+	struct hlist_node *tmp;
+	struct entry *e;
+
+	hlist_for_each_entry(e, tmp, bucket, hlist)
+		if (e->oblock == oblock)
+			return e;
+
+	return NULL;
+}
+
+static void hash_insert(struct mq_policy *mq, struct entry *e)
+{
+	hlist_add_head(&e->hlist, mq->table + hash_64(e->oblock, mq->hash_bits));
+}
+
+/*
+ * A new entry for @oblock, taking the coldest one of the blocks not in the
+ * cache if there are no free ones left.
+ */
+static struct entry *alloc_entry(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e;
+
+	if (!list_empty(&mq->free)) {
+		e = list_first_entry(&mq->free, struct entry, list);
+		list_del(&e->list);
+	} else {
+		e = queue_peek(&mq->pre_cache);
+		if (!e)
+			return NULL;
+		list_del(&e->list);
+		hlist_del(&e->hlist);
+	}
+
+	e->oblock = oblock;
+	e->hit_count = 0;
+	e->in_cache = false;
+	hash_insert(mq, e);
+	queue_push(&mq->pre_cache, e);
+
+	return e;
+}
+
+static void free_entry(struct mq_policy *mq, struct entry *e)
+{
+	list_del(&e->list);
+	hlist_del(&e->hlist);
+	list_add(&e->list, &mq->free);
+}
+
+static int alloc_cblock(struct mq_policy *mq, dm_cblock_t *result)
+{
+	unsigned long b;
+
+	if (mq->nr_allocated == mq->cache_size)
+		return -ENOSPC;
+
+	b = find_next_zero_bit(mq->allocated, mq->cache_size, mq->next_free);
+	if (b >= mq->cache_size)
+		b = find_first_zero_bit(mq->allocated, mq->cache_size);
+
+	__set_bit(b, mq->allocated);
+	mq->nr_allocated++;
+	mq->next_free = b + 1;
+	*result = b;
+
+	return 0;
+}
+
+static void free_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	__clear_bit(cblock, mq->allocated);
+	mq->nr_allocated--;
+}
+
+/*
+ * Halve all the hit counts, so that blocks that were hot a while ago but
+ * are no longer don't hold on to the cache forever.
+ */
+static void age_queue(struct queue *q)
+{
+	struct entry *e, *tmp;
+	LIST_HEAD(all);
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		list_splice_tail_init(q->qs + i, &all);
+
+	list_for_each_entry_safe(e, tmp, &all, list) {
+		e->hit_count >>= 1;
+		list_del(&e->list);
+		queue_push(q, e);
+	}
+}
+
+static void tick(struct mq_policy *mq)
+{
+	if (++mq->nr_accesses < mq->nr_entries)
+		return;
+
+	mq->nr_accesses = 0;
+	age_queue(&mq->pre_cache);
+	age_queue(&mq->cache);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool should_promote(struct mq_policy *mq, unsigned hit_count)
+{
+	struct entry *victim;
+
+	if (hit_count < mq->promote_threshold)
+		return false;
+
+	if (mq->nr_allocated < mq->cache_size)
+		return true;
+
+	victim = queue_peek(&mq->cache);
+	return victim && hit_count > victim->hit_count;
+}
+
+static void promote(struct mq_policy *mq, struct entry *e,
+		    struct policy_result *result)
+{
+	struct entry *victim;
+
+	if (!alloc_cblock(mq, &e->cblock))
+		result->op = POLICY_NEW;
+	else {
+		/* demote the coldest block, it keeps its hit count */
+		victim = queue_peek(&mq->cache);
+		list_del(&victim->list);
+		victim->in_cache = false;
+		queue_push(&mq->pre_cache, victim);
+
+		result->op = POLICY_REPLACE;
+		result->old_oblock = victim->oblock;
+		e->cblock = victim->cblock;
+	}
+
+	list_del(&e->list);
+	e->in_cache = true;
+	queue_push(&mq->cache, e);
+	result->cblock = e->cblock;
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_migrate, bool write, struct policy_result *result)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (e && e->in_cache) {
+		e->hit_count++;
+		queue_requeue(&mq->cache, e);
+		tick(mq);
+		result->op = POLICY_HIT;
+		result->cblock = e->cblock;
+		return 0;
+	}
+
+	if (!can_migrate && should_promote(mq, e ? e->hit_count + 1 : 1))
+		return -EWOULDBLOCK;
+
+	if (!e)
+		e = alloc_entry(mq, oblock);
+
+	tick(mq);
+	result->op = POLICY_MISS;
+	if (!e)
+		return 0;
+
+	e->hit_count++;
+	queue_requeue(&mq->pre_cache, e);
+
+	if (can_migrate && should_promote(mq, e->hit_count))
+		promote(mq, e, result);
+
+	return 0;
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p, dm_oblock_t oblock,
+			   dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	if (cblock >= mq->cache_size || test_bit(cblock, mq->allocated))
+		return -EINVAL;
+
+	/* a block that was demoted keeps its entry, and its hit count */
+	e = hash_lookup(mq, oblock);
+	if (e && e->in_cache)
+		return -EINVAL;
+
+	if (!e)
+		e = alloc_entry(mq, oblock);
+	if (!e)
+		return -ENOMEM;
+
+	__set_bit(cblock, mq->allocated);
+	mq->nr_allocated++;
+
+	list_del(&e->list);
+	e->cblock = cblock;
+	e->in_cache = true;
+	queue_push(&mq->cache, e);
+
+	return 0;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (!e || !e->in_cache)
+		return;
+
+	free_cblock(mq, e->cblock);
+	free_entry(mq, e);
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	return to_mq_policy(p)->nr_allocated;
+}
+
+static int mq_set_config_value(struct dm_cache_policy *p,
+			       const char *key, const char *value)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	unsigned long tmp;
+
+	if (strict_strtoul(value, 10, &tmp))
+		return -EINVAL;
+
+	if (!strcasecmp(key, "promote_threshold") && tmp)
+		mq->promote_threshold = tmp;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	vfree(mq->table);
+	vfree(mq->entries);
+	vfree(mq->allocated);
+	kfree(mq);
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 sector_t origin_size,
+					 sector_t block_size)
+{
+	struct mq_policy *mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+	unsigned i;
+
+	if (!mq)
+		return NULL;
+
+	mq->policy.map = mq_map;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.residency = mq_residency;
+	mq->policy.set_config_value = mq_set_config_value;
+	mq->policy.destroy = mq_destroy;
+
+	mq->cache_size = cache_size;
+	mq->promote_threshold = DEFAULT_PROMOTE_THRESHOLD;
+	queue_init(&mq->pre_cache);
+	queue_init(&mq->cache);
+	INIT_LIST_HEAD(&mq->free);
+
+	/* as many entries for blocks not in the cache as for those in it */
+	mq->nr_entries = max(2 * cache_size, (dm_cblock_t)MIN_ENTRIES);
+	mq->hash_bits = ilog2(roundup_pow_of_two(mq->nr_entries));
+
+	mq->allocated = vzalloc(BITS_TO_LONGS(cache_size) *
+				sizeof(unsigned long));
+	mq->entries = vzalloc(mq->nr_entries * sizeof(*mq->entries));
+	mq->table = vzalloc((1 << mq->hash_bits) * sizeof(*mq->table));
+	if (!mq->allocated || !mq->entries || !mq->table) {
+		mq_destroy(&mq->policy);
+		return NULL;
+	}
+
+	for (i = 0; i < mq->nr_entries; i++)
+		list_add_tail(&mq->entries[i].list, &mq->free);
+
+	return &mq->policy;
+}
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.owner = THIS_MODULE,
+	.create = mq_create,
+};
+
+static int __init mq_init(void)
+{
+	int r = dm_cache_policy_register(&mq_policy_type);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+	else
+		DMINFO("version 1.0.0 loaded");
+
+	return r;
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&mq_policy_type);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_DESCRIPTION(DM_NAME " multiqueue cache policy");
+MODULE_LICENSE("GPL");
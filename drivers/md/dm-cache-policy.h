@@ -0,0 +1,108 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#ifndef DM_CACHE_POLICY_H
+#define DM_CACHE_POLICY_H
+
+#include <linux/device-mapper.h>
+
+/*
+ * The cache target leaves the decision of which origin blocks live on
+ * the cache device to a policy.  The target tells the policy about every
+ * bio, and the policy answers where the bio goes and whether a block has
+ * to be promoted to the cache, possibly replacing another one.  The
+ * target then moves the data and updates the metadata.
+ */
+
+typedef u64 dm_oblock_t;	/* block number on the origin device */
+typedef u32 dm_cblock_t;	/* block number on the cache device */
+
+enum policy_operation {
+	POLICY_HIT,		/* the block is in the cache at cblock */
+	POLICY_MISS,		/* leave the bio on the origin */
+	POLICY_NEW,		/* promote the block to the free cblock */
+	POLICY_REPLACE,		/* demote old_oblock, promote to its cblock */
+};
+
+struct policy_result {
+	enum policy_operation op;
+	dm_oblock_t old_oblock;	/* POLICY_REPLACE */
+	dm_cblock_t cblock;	/* POLICY_HIT, POLICY_NEW, POLICY_REPLACE */
+};
+
+struct dm_cache_policy_type;
+
+struct dm_cache_policy {
+	/*
+	 * Called for every bio, with the cache's spinlock held, so it must
+	 * not block.
+	 *
+	 * When @can_migrate is false the policy may not answer
+	 * POLICY_NEW or POLICY_REPLACE.  If it would like to, it returns
+	 * -EWOULDBLOCK without counting the access; the target will ask
+	 * again, from a context that can migrate.
+	 *
+	 * The mapping the policy answers with takes effect at once, as far
+	 * as the policy is concerned.
+	 */
+	int (*map)(struct dm_cache_policy *p, dm_oblock_t oblock,
+		   bool can_migrate, bool write, struct policy_result *result);
+
+	/*
+	 * Called for every mapping found in the metadata when the cache is
+	 * created, before any map().  Also puts back the block a failed
+	 * POLICY_REPLACE demoted, once the new block has been removed.
+	 */
+	int (*load_mapping)(struct dm_cache_policy *p, dm_oblock_t oblock,
+			    dm_cblock_t cblock);
+
+	/*
+	 * Forget the mapping of @oblock, e.g. because the migration the
+	 * policy asked for failed.  Its cblock becomes free.
+	 */
+	void (*remove_mapping)(struct dm_cache_policy *p, dm_oblock_t oblock);
+
+	/* The number of cache blocks in use. */
+	dm_cblock_t (*residency)(struct dm_cache_policy *p);
+
+	/* Policy specific constructor arguments, as key value pairs. */
+	int (*set_config_value)(struct dm_cache_policy *p,
+				const char *key, const char *value);
+
+	void (*destroy)(struct dm_cache_policy *p);
+
+	struct dm_cache_policy_type *type;
+};
+
+struct dm_cache_policy_type {
+	char *name;
+	struct module *owner;
+
+	struct dm_cache_policy *(*create)(dm_cblock_t cache_size,
+					  sector_t origin_size,
+					  sector_t block_size);
+};
+
+/* Register a policy type */
+int dm_cache_policy_register(struct dm_cache_policy_type *type);
+
+/* Unregister a policy type */
+void dm_cache_policy_unregister(struct dm_cache_policy_type *type);
+
+/*
+ * Creates a policy of the named type, loading the dm-cache-<name> module
+ * if needed.  Returns an ERR_PTR on failure.
+ */
+struct dm_cache_policy *dm_cache_policy_create(const char *name,
+					       dm_cblock_t cache_size,
+					       sector_t origin_size,
+					       sector_t block_size);
+
+void dm_cache_policy_destroy(struct dm_cache_policy *p);
+
+const char *dm_cache_policy_get_name(struct dm_cache_policy *p);
+
+#endif
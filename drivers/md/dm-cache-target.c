@@ -0,0 +1,1714 @@
+/*
+ * This file is released under the GPL.
+ *
+ * A target that keeps the hot blocks of a slow origin device on a fast
+ * cache device.
+ */
+
+#include "dm-bio-record.h"
+#include "dm-cache-policy.h"
+
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * The origin and the cache device are split into blocks of the same size.
+ * A policy decides which origin blocks (oblocks) live in which cache
+ * blocks (cblocks), see dm-cache-policy.h.  Every bio lies within one
+ * block, and goes either to the origin or to the cache.
+ *
+ * Moving blocks between the devices is called migration:
+ *
+ *  - promotion copies an oblock to its new cblock,
+ *  - demotion drops an oblock from the cache, usually to make room for a
+ *    promotion, after writing it back to the origin if it is dirty,
+ *  - writeback copies a dirty cblock to the origin and keeps it cached.
+ *
+ * Bios for the oblocks involved in a migration are held in a cell until
+ * it is over, and a migration only starts once the bios already in
+ * flight to the cblock, and the writes to the promoted oblock, are done.
+ * The copies are made with kcopyd.
+ *
+ * In writeback mode writes that hit the cache only go to the cache, and
+ * the dirty blocks are written back when the cache is idle or when they
+ * are demoted.  In writethrough mode such writes go to the origin first
+ * and then to the cache, so the cache never holds the only copy of the
+ * data.
+ *
+ * The metadata device holds a header and the oblock of every cblock.  A
+ * mapping is committed after the promotion copy, and its removal before
+ * the cblock is reused, so the metadata never points at the wrong data.
+ * Which blocks are dirty is only written out on a clean shutdown; after a
+ * crash all the cached blocks are taken to be dirty.
+ */
+
+#define CACHE_MAGIC		0x63616368	/* "cach" */
+#define CACHE_METADATA_VERSION	1
+#define MAPPINGS_START		8		/* sectors */
+#define MIN_BLOCK_SECTORS	8
+
+#define MAX_MIGRATIONS		16
+#define MIN_IOS			64
+#define CELL_HASH_BITS		10
+#define ORIGIN_HASH_BITS	8
+
+#define CACHE_IO_PAGES		64
+#define CACHE_KCOPYD_PAGES	(((1UL << 20) >> PAGE_SHIFT) ? : 1)
+
+/*-----------------------------------------------------------------
+ * On disk metadata
+ *---------------------------------------------------------------*/
+#define HEADER_CLEAN_SHUTDOWN	1
+
+struct disk_header {
+	__le32 magic;
+	__le32 version;
+	__le32 flags;
+	__le32 nr_cblocks;
+	__le64 block_sectors;
+} __packed;
+
+#define MAPPING_VALID		1
+#define MAPPING_DIRTY		2
+
+struct disk_mapping {
+	__le64 oblock;
+	__le64 flags;
+} __packed;
+
+#define MAPPINGS_PER_PAGE	(PAGE_SIZE / sizeof(struct disk_mapping))
+
+/*-----------------------------------------------------------------
+ * Bios held while their oblock migrates
+ *---------------------------------------------------------------*/
+struct cell {
+	struct hlist_node hlist;
+	dm_oblock_t oblock;
+	unsigned count;		/* migrations holding the cell */
+	struct bio_list bios;
+};
+
+/*
+ * A migration goes through these steps, each one ending in the worker;
+ * the ones it doesn't need are skipped.
+ */
+enum migration_step {
+	MG_QUIESCE,		/* wait for the bios in flight */
+	MG_WRITEBACK,		/* copy the cblock to the origin */
+	MG_DEMOTE,		/* commit the removal of the old mapping */
+	MG_PROMOTE,		/* copy the new oblock to the cblock */
+	MG_COMMIT,		/* commit the new mapping */
+};
+
+struct migration {
+	struct list_head list;
+	struct cache *cache;
+
+	enum migration_step step;
+	bool writeback;		/* write the cblock back before demoting */
+	bool demote;
+	bool promote;
+	bool invalidate;	/* demote without writing back */
+	bool cleared;		/* the old mapping was removed */
+	bool err;
+
+	dm_cblock_t cblock;
+	dm_oblock_t old_oblock;
+	dm_oblock_t new_oblock;
+	struct cell *old_cell;
+	struct cell *new_cell;
+};
+
+/*
+ * A write that hits the cache in writethrough mode, on its way from the
+ * origin to the cache.
+ */
+struct writethrough {
+	struct list_head list;
+	bool to_cache;
+	dm_cblock_t cblock;
+	dm_oblock_t oblock;
+	struct dm_bio_details details;
+};
+
+/* What a bio in flight holds, in map_context->ll */
+enum {
+	IO_NONE,		/* origin read */
+	IO_CACHE,		/* cache I/O, ll >> 2 is the cblock */
+	IO_ORIGIN_WRITE,	/* origin write, ll >> 2 is the oblock's bucket */
+	IO_WRITETHROUGH,	/* ll & ~3 is a struct writethrough */
+};
+#define IO_TYPE_MASK		3
+#define IO_INDEX_SHIFT		2
+
+struct cache {
+	struct dm_target *ti;
+
+	struct dm_dev *metadata_dev;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	sector_t sectors_per_block;
+	unsigned block_shift;
+	dm_cblock_t cache_size;
+	bool writethrough;
+
+	struct dm_cache_policy *policy;
+	unsigned nr_policy_args;
+	char **policy_args;
+
+	/*
+	 * Protects the policy, the cells, the counts of bios in flight,
+	 * the dirty bitmap and the lists below.
+	 */
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
+	struct bio_list writethrough_bios;
+	struct list_head failed_writethroughs;
+	struct list_head blocked_migrations;
+	struct list_head quiescing_migrations;
+	struct list_head copied_migrations;
+
+	struct hlist_head cells[1 << CELL_HASH_BITS];
+	unsigned origin_inflight[1 << ORIGIN_HASH_BITS];
+	unsigned *cache_inflight;
+	unsigned long *migrating;
+	unsigned long *dirty;
+	dm_cblock_t nr_dirty;
+	dm_cblock_t writeback_cursor;
+	unsigned nr_io;
+
+	/* The migrations past MG_QUIESCE wait here for the next commit */
+	struct list_head commit_migrations;
+	atomic_t nr_migrations;
+	wait_queue_head_t migration_wait;
+
+	/* Only touched by the worker, or while it is stopped */
+	struct disk_mapping *mappings;
+	unsigned long *dirty_pages;
+	unsigned nr_pages;
+	struct dm_io_client *io_client;
+	unsigned last_nr_io;
+	bool idle;
+	bool loaded;
+
+	mempool_t *migration_pool;
+	mempool_t *cell_pool;
+	mempool_t *writethrough_pool;
+	struct dm_kcopyd_client *copier;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t promotion;
+	atomic_t demotion;
+	atomic_t writeback;
+};
+
+static struct kmem_cache *_migration_cache;
+static struct kmem_cache *_cell_cache;
+static struct kmem_cache *_writethrough_cache;
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return dm_target_offset(cache->ti, bio->bi_sector) >> cache->block_shift;
+}
+
+static unsigned origin_hash(dm_oblock_t oblock)
+{
+	return hash_64(oblock, ORIGIN_HASH_BITS);
+}
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+static int metadata_io(struct cache *cache, int rw, void *data,
+		       sector_t sector, sector_t count)
+{
+	struct dm_io_region where = {
+		.bdev = cache->metadata_dev->bdev,
+		.sector = sector,
+		.count = count,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = data,
+		.client = cache->io_client,
+		.notify.fn = NULL,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static int write_header(struct cache *cache, unsigned flags)
+{
+	struct disk_header *dh;
+	int r;
+
+	dh = vzalloc(1 << SECTOR_SHIFT);
+	if (!dh)
+		return -ENOMEM;
+
+	dh->magic = cpu_to_le32(CACHE_MAGIC);
+	dh->version = cpu_to_le32(CACHE_METADATA_VERSION);
+	dh->flags = cpu_to_le32(flags);
+	dh->nr_cblocks = cpu_to_le32(cache->cache_size);
+	dh->block_sectors = cpu_to_le64(cache->sectors_per_block);
+
+	r = metadata_io(cache, WRITE_FLUSH_FUA, dh, 0, 1);
+	vfree(dh);
+
+	return r;
+}
+
+static void set_mapping(struct cache *cache, dm_cblock_t cblock,
+			dm_oblock_t oblock, unsigned flags)
+{
+	cache->mappings[cblock].oblock = cpu_to_le64(oblock);
+	cache->mappings[cblock].flags = cpu_to_le64(flags);
+	__set_bit(cblock / MAPPINGS_PER_PAGE, cache->dirty_pages);
+}
+
+static bool mapped_to(struct cache *cache, dm_cblock_t cblock,
+		      dm_oblock_t oblock)
+{
+	return (le64_to_cpu(cache->mappings[cblock].flags) & MAPPING_VALID) &&
+	       le64_to_cpu(cache->mappings[cblock].oblock) == oblock;
+}
+
+/*
+ * Makes the mapping changes since the last commit permanent.  The data
+ * the new mappings point at, and the blocks written back before a
+ * mapping was removed, are flushed out first.
+ */
+static int commit(struct cache *cache)
+{
+	struct dm_io_region null_location = {
+		.bdev = cache->metadata_dev->bdev,
+		.sector = 0,
+		.count = 0,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE_FLUSH,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = NULL,
+		.client = cache->io_client,
+	};
+	unsigned page;
+	int r;
+
+	r = blkdev_issue_flush(cache->cache_dev->bdev, GFP_NOIO, NULL);
+	if (!r)
+		r = blkdev_issue_flush(cache->origin_dev->bdev, GFP_NOIO, NULL);
+	if (r)
+		return r;
+
+	for_each_set_bit(page, cache->dirty_pages, cache->nr_pages) {
+		r = metadata_io(cache, WRITE,
+				(char *)cache->mappings + page * PAGE_SIZE,
+				MAPPINGS_START + (page << (PAGE_SHIFT - SECTOR_SHIFT)),
+				PAGE_SIZE >> SECTOR_SHIFT);
+		if (r)
+			return r;
+		__clear_bit(page, cache->dirty_pages);
+	}
+
+	return dm_io(&io_req, 1, &null_location, NULL);
+}
+
+/*
+ * Writes out which blocks are dirty and marks the metadata clean, so that
+ * the next table load can trust the dirty flags.
+ */
+static int write_clean_shutdown(struct cache *cache)
+{
+	dm_cblock_t cblock;
+	u64 flags;
+	int r;
+
+	for (cblock = 0; cblock < cache->cache_size; cblock++) {
+		flags = le64_to_cpu(cache->mappings[cblock].flags);
+		if (!(flags & MAPPING_VALID))
+			continue;
+
+		if (test_bit(cblock, cache->dirty))
+			flags |= MAPPING_DIRTY;
+		else
+			flags &= ~MAPPING_DIRTY;
+		set_mapping(cache, cblock,
+			    le64_to_cpu(cache->mappings[cblock].oblock), flags);
+	}
+
+	r = commit(cache);
+	if (!r)
+		r = write_header(cache, HEADER_CLEAN_SHUTDOWN);
+
+	return r;
+}
+
+/*
+ * Reads the metadata, or formats the metadata device if it starts with a
+ * zeroed sector, and tells the policy about the mappings.
+ */
+static int load_metadata(struct cache *cache)
+{
+	struct disk_header *dh;
+	bool clean = false;
+	dm_cblock_t cblock;
+	u64 flags;
+	int r;
+
+	dh = vmalloc(1 << SECTOR_SHIFT);
+	if (!dh)
+		return -ENOMEM;
+
+	r = metadata_io(cache, READ, dh, 0, 1);
+	if (r) {
+		DMERR("Cannot read metadata header");
+		goto out;
+	}
+
+	r = -EINVAL;
+	if (!dh->magic) {
+		bitmap_fill(cache->dirty_pages, cache->nr_pages);
+		r = commit(cache);
+		if (r) {
+			DMERR("Cannot format metadata");
+			goto out;
+		}
+	} else if (le32_to_cpu(dh->magic) != CACHE_MAGIC ||
+		   le32_to_cpu(dh->version) != CACHE_METADATA_VERSION) {
+		DMERR("Metadata device holds no cache metadata");
+		goto out;
+	} else if (le32_to_cpu(dh->nr_cblocks) != cache->cache_size ||
+		   le64_to_cpu(dh->block_sectors) != cache->sectors_per_block) {
+		DMERR("Metadata has a different block size or cache size");
+		goto out;
+	} else {
+		clean = le32_to_cpu(dh->flags) & HEADER_CLEAN_SHUTDOWN;
+		r = metadata_io(cache, READ, cache->mappings, MAPPINGS_START,
+				(sector_t)cache->nr_pages <<
+				(PAGE_SHIFT - SECTOR_SHIFT));
+		if (r) {
+			DMERR("Cannot read metadata");
+			goto out;
+		}
+	}
+
+	for (cblock = 0; cblock < cache->cache_size; cblock++) {
+		flags = le64_to_cpu(cache->mappings[cblock].flags);
+		if (!(flags & MAPPING_VALID))
+			continue;
+
+		r = cache->policy->load_mapping(cache->policy,
+				le64_to_cpu(cache->mappings[cblock].oblock),
+				cblock);
+		if (r) {
+			DMERR("Policy rejected the mapping of cache block %u",
+			      cblock);
+			goto out;
+		}
+
+		if (!clean || (flags & MAPPING_DIRTY)) {
+			__set_bit(cblock, cache->dirty);
+			cache->nr_dirty++;
+		}
+	}
+	r = 0;
+out:
+	vfree(dh);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * Cells
+ *---------------------------------------------------------------*/
+static struct hlist_head *cell_bucket(struct cache *cache, dm_oblock_t oblock)
+{
+	return cache->cells + hash_64(oblock, CELL_HASH_BITS);
+}
+
+static struct cell *__find_cell(struct cache *cache, dm_oblock_t oblock)
+{
+	struct hlist_node *tmp;
+	struct cell *cell;
+
+	hlist_for_each_entry(cell, tmp, cell_bucket(cache, oblock), hlist)
+		if (cell->oblock == oblock)
+			return cell;
+
+	return NULL;
+}
+
+/*
+ * Takes a reference on the cell for @oblock, using the preallocated
+ * @*prealloc if there is none yet.
+ */
+static struct cell *__get_cell(struct cache *cache, dm_oblock_t oblock,
+			       struct cell **prealloc)
+{
+	struct cell *cell = __find_cell(cache, oblock);
+
+	if (!cell) {
+		cell = *prealloc;
+		*prealloc = NULL;
+
+		cell->oblock = oblock;
+		cell->count = 0;
+		bio_list_init(&cell->bios);
+		hlist_add_head(&cell->hlist, cell_bucket(cache, oblock));
+	}
+	cell->count++;
+
+	return cell;
+}
+
+/* The held bios go back to the worker once nobody holds the cell */
+static void __put_cell(struct cache *cache, struct cell *cell)
+{
+	if (--cell->count)
+		return;
+
+	hlist_del(&cell->hlist);
+	bio_list_merge(&cache->deferred_bios, &cell->bios);
+	mempool_free(cell, cache->cell_pool);
+}
+
+/*-----------------------------------------------------------------
+ * Remapping
+ *---------------------------------------------------------------*/
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector = dm_target_offset(cache->ti, bio->bi_sector);
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t offset = dm_target_offset(cache->ti, bio->bi_sector);
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t)cblock << cache->block_shift) +
+			 (offset & (cache->sectors_per_block - 1));
+}
+
+/*
+ * Sends a bio where the policy said, and accounts for it until it is
+ * done.  @wt is a preallocated writethrough record, used and cleared if
+ * the bio is a write that hits the cache in writethrough mode.
+ */
+static void __remap(struct cache *cache, struct bio *bio, dm_oblock_t oblock,
+		    struct policy_result *result, union map_info *map_context,
+		    struct writethrough **wt)
+{
+	bool write = bio_data_dir(bio) == WRITE;
+	dm_cblock_t cblock = result->cblock;
+
+	cache->nr_io++;
+
+	if (result->op == POLICY_MISS) {
+		atomic_inc(write ? &cache->write_miss : &cache->read_miss);
+		remap_to_origin(cache, bio);
+		map_context->ll = IO_NONE;
+		if (write) {
+			unsigned bucket = origin_hash(oblock);
+
+			cache->origin_inflight[bucket]++;
+			map_context->ll = IO_ORIGIN_WRITE |
+					  (bucket << IO_INDEX_SHIFT);
+		}
+		return;
+	}
+
+	atomic_inc(write ? &cache->write_hit : &cache->read_hit);
+	cache->cache_inflight[cblock]++;
+
+	if (write && cache->writethrough) {
+		struct writethrough *w = *wt;
+
+		*wt = NULL;
+		w->to_cache = false;
+		w->cblock = cblock;
+		w->oblock = oblock;
+		dm_bio_record(&w->details, bio);
+		remap_to_origin(cache, bio);
+		map_context->ll = (unsigned long)w | IO_WRITETHROUGH;
+		return;
+	}
+
+	if (write && !test_and_set_bit(cblock, cache->dirty))
+		cache->nr_dirty++;
+
+	remap_to_cache(cache, bio, cblock);
+	map_context->ll = IO_CACHE | ((u64)cblock << IO_INDEX_SHIFT);
+}
+
+static struct writethrough *alloc_writethrough(struct cache *cache,
+					       struct bio *bio)
+{
+	if (!cache->writethrough || bio_data_dir(bio) != WRITE)
+		return NULL;
+
+	return mempool_alloc(cache->writethrough_pool, GFP_NOIO);
+}
+
+static void free_writethrough(struct cache *cache, struct writethrough *wt)
+{
+	if (wt)
+		mempool_free(wt, cache->writethrough_pool);
+}
+
+/*-----------------------------------------------------------------
+ * Migrations
+ *---------------------------------------------------------------*/
+struct prealloc {
+	struct migration *mg;
+	struct cell *cell1;
+	struct cell *cell2;
+};
+
+static void prealloc_fill(struct cache *cache, struct prealloc *p)
+{
+	if (!p->mg)
+		p->mg = mempool_alloc(cache->migration_pool, GFP_NOIO);
+	if (!p->cell1)
+		p->cell1 = mempool_alloc(cache->cell_pool, GFP_NOIO);
+	if (!p->cell2)
+		p->cell2 = mempool_alloc(cache->cell_pool, GFP_NOIO);
+}
+
+static void prealloc_free(struct cache *cache, struct prealloc *p)
+{
+	if (p->mg)
+		mempool_free(p->mg, cache->migration_pool);
+	if (p->cell1)
+		mempool_free(p->cell1, cache->cell_pool);
+	if (p->cell2)
+		mempool_free(p->cell2, cache->cell_pool);
+}
+
+/*
+ * Sets up a migration of @cblock.  Only one migration of a cblock runs at
+ * a time, the others wait for it in order.
+ */
+static struct migration *__new_migration(struct cache *cache,
+					 struct prealloc *p,
+					 dm_cblock_t cblock)
+{
+	struct migration *mg = p->mg;
+
+	p->mg = NULL;
+	memset(mg, 0, sizeof(*mg));
+	mg->cache = cache;
+	mg->step = MG_QUIESCE;
+	mg->cblock = cblock;
+
+	if (test_and_set_bit(cblock, cache->migrating))
+		list_add_tail(&mg->list, &cache->blocked_migrations);
+	else
+		list_add_tail(&mg->list, &cache->quiescing_migrations);
+	atomic_inc(&cache->nr_migrations);
+
+	return mg;
+}
+
+static void __hold_old(struct cache *cache, struct migration *mg,
+		       dm_oblock_t oblock, struct prealloc *p)
+{
+	mg->old_oblock = oblock;
+	mg->old_cell = __get_cell(cache, oblock,
+				  p->cell1 ? &p->cell1 : &p->cell2);
+}
+
+static void __hold_new(struct cache *cache, struct migration *mg,
+		       dm_oblock_t oblock, struct prealloc *p)
+{
+	mg->new_oblock = oblock;
+	mg->new_cell = __get_cell(cache, oblock,
+				  p->cell1 ? &p->cell1 : &p->cell2);
+}
+
+static void __promote(struct cache *cache, struct prealloc *p,
+		      struct bio *bio, dm_oblock_t oblock,
+		      struct policy_result *result)
+{
+	struct migration *mg = __new_migration(cache, p, result->cblock);
+
+	if (result->op == POLICY_REPLACE) {
+		mg->demote = true;
+		__hold_old(cache, mg, result->old_oblock, p);
+	}
+	mg->promote = true;
+	__hold_new(cache, mg, oblock, p);
+
+	bio_list_add(&mg->new_cell->bios, bio);
+}
+
+static bool __quiesced(struct cache *cache, struct migration *mg)
+{
+	if (cache->cache_inflight[mg->cblock])
+		return false;
+
+	return !mg->promote ||
+	       !cache->origin_inflight[origin_hash(mg->new_oblock)];
+}
+
+/*
+ * Ends a migration, letting the bios it held go, and the next migration
+ * of its cblock start.
+ */
+static void migration_done(struct migration *mg)
+{
+	struct cache *cache = mg->cache;
+	struct migration *next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (mg->old_cell)
+		__put_cell(cache, mg->old_cell);
+	if (mg->new_cell)
+		__put_cell(cache, mg->new_cell);
+
+	__clear_bit(mg->cblock, cache->migrating);
+	list_for_each_entry(next, &cache->blocked_migrations, list) {
+		if (next->cblock == mg->cblock) {
+			__set_bit(mg->cblock, cache->migrating);
+			list_move_tail(&next->list,
+				       &cache->quiescing_migrations);
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	mempool_free(mg, cache->migration_pool);
+
+	if (atomic_dec_and_test(&cache->nr_migrations))
+		wake_up(&cache->migration_wait);
+	wake_worker(cache);
+}
+
+/*
+ * Tells the policy that a migration didn't happen after all: the new
+ * oblock is not cached, and a demoted one is again.
+ */
+static void migration_failed(struct migration *mg)
+{
+	struct cache *cache = mg->cache;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (mg->promote)
+		cache->policy->remove_mapping(cache->policy, mg->new_oblock);
+	if (mg->demote && !mg->invalidate &&
+	    mapped_to(cache, mg->cblock, mg->old_oblock) &&
+	    cache->policy->load_mapping(cache->policy, mg->old_oblock,
+					mg->cblock))
+		DMERR_LIMIT("Cannot put block %llu back into the policy",
+			    (unsigned long long)mg->old_oblock);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	migration_done(mg);
+}
+
+static void copy_complete(int read_err, unsigned long write_err,
+			  void *context)
+{
+	struct migration *mg = context;
+	struct cache *cache = mg->cache;
+	unsigned long flags;
+
+	if (read_err || write_err)
+		mg->err = true;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, &cache->copied_migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void copy(struct migration *mg, bool to_cache, dm_oblock_t oblock)
+{
+	struct cache *cache = mg->cache;
+	struct dm_io_region o_region, c_region;
+	int r;
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.sector = oblock << cache->block_shift;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t)mg->cblock << cache->block_shift;
+	c_region.count = cache->sectors_per_block;
+
+	if (to_cache)
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region,
+				   0, copy_complete, mg);
+	else
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region,
+				   0, copy_complete, mg);
+	if (r < 0) {
+		DMERR_LIMIT("kcopyd failed %d", r);
+		copy_complete(1, 0, mg);
+	}
+}
+
+/* Moves a migration on to its next step, in the worker */
+static void advance_migration(struct migration *mg)
+{
+	struct cache *cache = mg->cache;
+	unsigned long flags;
+
+	if (mg->err) {
+		migration_failed(mg);
+		return;
+	}
+
+	switch (mg->step) {
+	case MG_QUIESCE:
+		spin_lock_irqsave(&cache->lock, flags);
+		mg->writeback = !mg->invalidate &&
+				(mg->demote || !mg->promote) &&
+				test_bit(mg->cblock, cache->dirty);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		if (mg->writeback) {
+			mg->step = MG_WRITEBACK;
+			copy(mg, false, mg->old_oblock);
+			return;
+		}
+		/* fall through */
+
+	case MG_WRITEBACK:
+		if (mg->writeback) {
+			atomic_inc(&cache->writeback);
+			spin_lock_irqsave(&cache->lock, flags);
+			if (test_and_clear_bit(mg->cblock, cache->dirty))
+				cache->nr_dirty--;
+			spin_unlock_irqrestore(&cache->lock, flags);
+		}
+
+		if (mg->demote) {
+			/*
+			 * An invalidation may find its block demoted, and
+			 * the cblock reused, by a migration that came first.
+			 */
+			if (mapped_to(cache, mg->cblock, mg->old_oblock)) {
+				set_mapping(cache, mg->cblock, 0, 0);
+				mg->cleared = true;
+				spin_lock_irqsave(&cache->lock, flags);
+				if (test_and_clear_bit(mg->cblock, cache->dirty))
+					cache->nr_dirty--;
+				spin_unlock_irqrestore(&cache->lock, flags);
+			}
+			mg->step = MG_DEMOTE;
+			list_add_tail(&mg->list, &cache->commit_migrations);
+			return;
+		}
+		/* fall through */
+
+	case MG_DEMOTE:
+		if (mg->demote)
+			atomic_inc(&cache->demotion);
+
+		if (mg->promote) {
+			mg->step = MG_PROMOTE;
+			copy(mg, true, mg->new_oblock);
+			return;
+		}
+		break;
+
+	case MG_PROMOTE:
+		set_mapping(cache, mg->cblock, mg->new_oblock, MAPPING_VALID);
+		mg->step = MG_COMMIT;
+		list_add_tail(&mg->list, &cache->commit_migrations);
+		return;
+
+	case MG_COMMIT:
+		atomic_inc(&cache->promotion);
+		break;
+	}
+
+	migration_done(mg);
+}
+
+static void process_migrations(struct cache *cache)
+{
+	struct migration *mg, *tmp;
+	unsigned long flags;
+	LIST_HEAD(ready);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_for_each_entry_safe(mg, tmp, &cache->quiescing_migrations, list)
+		if (__quiesced(cache, mg))
+			list_move_tail(&mg->list, &ready);
+	list_splice_tail_init(&cache->copied_migrations, &ready);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &ready, list) {
+		list_del(&mg->list);
+		advance_migration(mg);
+	}
+}
+
+/*
+ * Commits the mapping changes of the migrations waiting for it, and moves
+ * them on.  Whatever else they changed goes out in the same commit.
+ */
+static void commit_migrations(struct cache *cache)
+{
+	struct migration *mg, *tmp;
+	LIST_HEAD(list);
+	int r;
+
+	if (list_empty(&cache->commit_migrations))
+		return;
+
+	list_splice_init(&cache->commit_migrations, &list);
+	r = commit(cache);
+	if (r)
+		DMERR_LIMIT("metadata commit failed %d", r);
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		list_del(&mg->list);
+		if (r) {
+			mg->err = true;
+			if (mg->step == MG_COMMIT)
+				set_mapping(cache, mg->cblock, 0, 0);
+			else if (mg->cleared && !mg->invalidate)
+				set_mapping(cache, mg->cblock, mg->old_oblock,
+					    MAPPING_VALID);
+		}
+		advance_migration(mg);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * The worker
+ *---------------------------------------------------------------*/
+/*
+ * Maps a bio that map() deferred, starting the migration the policy asks
+ * for if there is room for one.  Returns false if the bio has to wait for
+ * a migration to finish first.
+ */
+static bool process_bio(struct cache *cache, struct prealloc *p,
+			struct bio *bio)
+{
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	struct writethrough *wt = alloc_writethrough(cache, bio);
+	struct policy_result result;
+	struct cell *cell;
+	unsigned long flags;
+	bool can_migrate;
+	int r;
+
+	prealloc_fill(cache, p);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cell = __find_cell(cache, oblock);
+	if (cell) {
+		bio_list_add(&cell->bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		free_writethrough(cache, wt);
+		return true;
+	}
+
+	can_migrate = atomic_read(&cache->nr_migrations) < MAX_MIGRATIONS;
+	r = cache->policy->map(cache->policy, oblock, can_migrate,
+			       bio_data_dir(bio) == WRITE, &result);
+	if (r == -EWOULDBLOCK) {
+		spin_unlock_irqrestore(&cache->lock, flags);
+		free_writethrough(cache, wt);
+		return false;
+	}
+
+	switch (result.op) {
+	case POLICY_HIT:
+	case POLICY_MISS:
+		__remap(cache, bio, oblock, &result, dm_get_mapinfo(bio), &wt);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		generic_make_request(bio);
+		break;
+
+	case POLICY_NEW:
+	case POLICY_REPLACE:
+		__promote(cache, p, bio, oblock, &result);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		break;
+	}
+
+	free_writethrough(cache, wt);
+
+	return true;
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	struct prealloc p = { NULL, NULL, NULL };
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bios = cache->deferred_bios;
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (!process_bio(cache, &p, bio)) {
+			/* retried once a migration is done */
+			bio_list_add_head(&bios, bio);
+			spin_lock_irqsave(&cache->lock, flags);
+			bio_list_merge(&bios, &cache->deferred_bios);
+			cache->deferred_bios = bios;
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+	}
+
+	prealloc_free(cache, &p);
+}
+
+/*
+ * Flushes the cache device, so that the origin's flush covers everything
+ * written to the cache before it.
+ */
+static void process_deferred_flush_bios(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+	int r;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bios = cache->deferred_flush_bios;
+	bio_list_init(&cache->deferred_flush_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	r = blkdev_issue_flush(cache->cache_dev->bdev, GFP_NOIO, NULL);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (r)
+			bio_endio(bio, r);
+		else {
+			remap_to_origin(cache, bio);
+			generic_make_request(bio);
+		}
+	}
+}
+
+static void process_writethrough_bios(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bios = cache->writethrough_bios;
+	bio_list_init(&cache->writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+/*
+ * A writethrough write reached the origin but not the cache, so the
+ * cached copy of its block is stale: drop it from the cache.
+ */
+static void process_failed_writethroughs(struct cache *cache)
+{
+	struct prealloc p = { NULL, NULL, NULL };
+	struct writethrough *wt;
+	struct migration *mg;
+	unsigned long flags;
+
+	for (;;) {
+		prealloc_fill(cache, &p);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		if (list_empty(&cache->failed_writethroughs)) {
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+		wt = list_first_entry(&cache->failed_writethroughs,
+				      struct writethrough, list);
+		list_del(&wt->list);
+
+		/*
+		 * The bio still counted as in flight to the cblock, so no
+		 * migration can have moved its block out of it.
+		 */
+		cache->policy->remove_mapping(cache->policy, wt->oblock);
+		mg = __new_migration(cache, &p, wt->cblock);
+		mg->demote = true;
+		mg->invalidate = true;
+		__hold_old(cache, mg, wt->oblock, &p);
+		cache->cache_inflight[wt->cblock]--;
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		free_writethrough(cache, wt);
+	}
+
+	prealloc_free(cache, &p);
+}
+
+/*
+ * Writes dirty blocks back while the cache is idle, so that there are
+ * clean blocks to demote when the load comes back.
+ */
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	struct prealloc p = { NULL, NULL, NULL };
+	struct migration *mg;
+	unsigned long flags;
+	dm_cblock_t cblock;
+
+	while (atomic_read(&cache->nr_migrations) < MAX_MIGRATIONS) {
+		prealloc_fill(cache, &p);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		if (!cache->nr_dirty || cache->nr_io != cache->last_nr_io) {
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+
+		cblock = find_next_bit(cache->dirty, cache->cache_size,
+				       cache->writeback_cursor);
+		if (cblock >= cache->cache_size)
+			cblock = find_first_bit(cache->dirty, cache->cache_size);
+		cache->writeback_cursor = cblock + 1;
+
+		/* blocks on the move are written back by their migration */
+		if (test_bit(cblock, cache->migrating)) {
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+
+		mg = __new_migration(cache, &p, cblock);
+		__hold_old(cache, mg,
+			   le64_to_cpu(cache->mappings[cblock].oblock), &p);
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+
+	prealloc_free(cache, &p);
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_deferred_flush_bios(cache);
+	process_writethrough_bios(cache);
+	process_failed_writethroughs(cache);
+	process_deferred_bios(cache);
+
+	if (cache->idle) {
+		cache->idle = false;
+		writeback_some_dirty_blocks(cache);
+	}
+
+	process_migrations(cache);
+	commit_migrations(cache);
+}
+
+/* Looks for an idle cache once a second */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache,
+					   waker);
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (cache->nr_io == cache->last_nr_io && cache->nr_dirty)
+		cache->idle = true;
+	cache->last_nr_io = cache->nr_io;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, HZ);
+}
+
+/*-----------------------------------------------------------------
+ * Target functions
+ *---------------------------------------------------------------*/
+static void destroy(struct cache *cache)
+{
+	unsigned i;
+
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+	if (cache->io_client && !IS_ERR(cache->io_client))
+		dm_io_client_destroy(cache->io_client);
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+	if (cache->cell_pool)
+		mempool_destroy(cache->cell_pool);
+	if (cache->writethrough_pool)
+		mempool_destroy(cache->writethrough_pool);
+
+	vfree(cache->mappings);
+	vfree(cache->dirty_pages);
+	vfree(cache->cache_inflight);
+	vfree(cache->migrating);
+	vfree(cache->dirty);
+
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+	for (i = 0; i < cache->nr_policy_args; i++)
+		kfree(cache->policy_args[i]);
+	kfree(cache->policy_args);
+
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+
+	kfree(cache);
+}
+
+static int parse_policy_args(struct cache *cache, unsigned argc, char **argv,
+			     char **error)
+{
+	unsigned i;
+	int r;
+
+	if (argc % 2) {
+		*error = "Policy arguments must be key value pairs";
+		return -EINVAL;
+	}
+
+	cache->policy_args = kcalloc(argc, sizeof(char *), GFP_KERNEL);
+	if (argc && !cache->policy_args) {
+		*error = "Cannot allocate policy arguments";
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < argc; i++) {
+		cache->policy_args[i] = kstrdup(argv[i], GFP_KERNEL);
+		if (!cache->policy_args[i]) {
+			*error = "Cannot allocate policy arguments";
+			return -ENOMEM;
+		}
+		cache->nr_policy_args++;
+	}
+
+	for (i = 0; i < argc; i += 2) {
+		r = cache->policy->set_config_value(cache->policy, argv[i],
+						    argv[i + 1]);
+		if (r) {
+			*error = "Invalid policy argument";
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int alloc_cache_state(struct cache *cache, char **error)
+{
+	dm_cblock_t nr_cblocks = cache->cache_size;
+	size_t bitmap_size = BITS_TO_LONGS(nr_cblocks) * sizeof(long);
+
+	cache->nr_pages = dm_div_up(nr_cblocks, MAPPINGS_PER_PAGE);
+	cache->mappings = vzalloc(cache->nr_pages * PAGE_SIZE);
+	cache->dirty_pages = vzalloc(BITS_TO_LONGS(cache->nr_pages) *
+				     sizeof(long));
+	cache->cache_inflight = vzalloc(nr_cblocks * sizeof(unsigned));
+	cache->migrating = vzalloc(bitmap_size);
+	cache->dirty = vzalloc(bitmap_size);
+	if (!cache->mappings || !cache->dirty_pages ||
+	    !cache->cache_inflight || !cache->migrating || !cache->dirty) {
+		*error = "Cannot allocate cache state";
+		return -ENOMEM;
+	}
+
+	cache->migration_pool = mempool_create_slab_pool(MAX_MIGRATIONS,
+							 _migration_cache);
+	cache->cell_pool = mempool_create_slab_pool(MIN_IOS, _cell_cache);
+	cache->writethrough_pool = mempool_create_slab_pool(MIN_IOS,
+							    _writethrough_cache);
+	if (!cache->migration_pool || !cache->cell_pool ||
+	    !cache->writethrough_pool) {
+		*error = "Cannot allocate mempools";
+		return -ENOMEM;
+	}
+
+	cache->io_client = dm_io_client_create(CACHE_IO_PAGES);
+	if (IS_ERR(cache->io_client)) {
+		*error = "Cannot create dm-io client";
+		return PTR_ERR(cache->io_client);
+	}
+
+	if (dm_kcopyd_client_create(CACHE_KCOPYD_PAGES, &cache->copier)) {
+		cache->copier = NULL;
+		*error = "Cannot create kcopyd client";
+		return -ENOMEM;
+	}
+
+	cache->wq = alloc_workqueue("dm-cache", WQ_MEM_RECLAIM, 0);
+	if (!cache->wq) {
+		*error = "Cannot create workqueue";
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a cache mapping:
+ *
+ * cache <metadata dev> <cache dev> <origin dev> <block size>
+ *       <writeback|writethrough> <policy> [<#policy args> [<key> <value>]*]
+ *
+ * The block size is in sectors, a power of two of at least 8.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	fmode_t mode = dm_table_get_mode(ti->table);
+	unsigned long long block_size;
+	unsigned nr_policy_args = 0;
+	struct cache *cache;
+	sector_t cache_sectors;
+	char dummy;
+	int r = -EINVAL;
+
+	if (argc < 6) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[3], "%llu%c", &block_size, &dummy) != 1 ||
+	    block_size < MIN_BLOCK_SECTORS || !is_power_of_2(block_size) ||
+	    block_size > UINT_MAX) {
+		ti->error = "Invalid block size";
+		return -EINVAL;
+	}
+
+	if (ti->len & (block_size - 1)) {
+		ti->error = "Target length is not a multiple of the block size";
+		return -EINVAL;
+	}
+
+	if (strcmp(argv[4], "writeback") && strcmp(argv[4], "writethrough")) {
+		ti->error = "Invalid cache mode";
+		return -EINVAL;
+	}
+
+	if (argc > 6 &&
+	    (sscanf(argv[6], "%u%c", &nr_policy_args, &dummy) != 1 ||
+	     nr_policy_args != argc - 7)) {
+		ti->error = "Invalid number of policy arguments";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	cache->sectors_per_block = block_size;
+	cache->block_shift = ilog2(block_size);
+	cache->writethrough = !strcmp(argv[4], "writethrough");
+
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	bio_list_init(&cache->writethrough_bios);
+	INIT_LIST_HEAD(&cache->failed_writethroughs);
+	INIT_LIST_HEAD(&cache->blocked_migrations);
+	INIT_LIST_HEAD(&cache->quiescing_migrations);
+	INIT_LIST_HEAD(&cache->copied_migrations);
+	INIT_LIST_HEAD(&cache->commit_migrations);
+	atomic_set(&cache->nr_migrations, 0);
+	init_waitqueue_head(&cache->migration_wait);
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+
+	if (dm_get_device(ti, argv[0], mode, &cache->metadata_dev)) {
+		ti->error = "Metadata device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[1], mode, &cache->cache_dev)) {
+		ti->error = "Cache device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[2], mode, &cache->origin_dev)) {
+		ti->error = "Origin device lookup failed";
+		goto bad;
+	}
+
+	cache_sectors = i_size_read(cache->cache_dev->bdev->bd_inode) >>
+			SECTOR_SHIFT;
+	if (cache_sectors >> cache->block_shift > UINT_MAX ||
+	    !(cache_sectors >> cache->block_shift)) {
+		ti->error = "Invalid cache device size";
+		goto bad;
+	}
+	cache->cache_size = cache_sectors >> cache->block_shift;
+
+	cache->policy = dm_cache_policy_create(argv[5], cache->cache_size,
+					       ti->len, block_size);
+	if (IS_ERR(cache->policy)) {
+		r = PTR_ERR(cache->policy);
+		cache->policy = NULL;
+		ti->error = "Error creating cache's policy";
+		goto bad;
+	}
+
+	r = parse_policy_args(cache, nr_policy_args, argv + 7, &ti->error);
+	if (r)
+		goto bad;
+
+	r = alloc_cache_state(cache, &ti->error);
+	if (r)
+		goto bad;
+
+	if (i_size_read(cache->metadata_dev->bdev->bd_inode) >> SECTOR_SHIFT <
+	    MAPPINGS_START +
+	    ((sector_t)cache->nr_pages << (PAGE_SHIFT - SECTOR_SHIFT))) {
+		ti->error = "Metadata device too small";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	ti->split_io = block_size;
+	ti->num_flush_requests = 1;
+	ti->private = cache;
+
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	destroy(ti->private);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	struct writethrough *wt;
+	struct policy_result result;
+	unsigned long flags;
+	int r;
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		spin_lock_irqsave(&cache->lock, flags);
+		bio_list_add(&cache->deferred_flush_bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		wake_worker(cache);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	wt = alloc_writethrough(cache, bio);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (__find_cell(cache, oblock))
+		r = -EBUSY;
+	else
+		r = cache->policy->map(cache->policy, oblock, false,
+				       bio_data_dir(bio) == WRITE, &result);
+	if (r) {
+		/* in a cell or about to be, the worker will sort it out */
+		bio_list_add(&cache->deferred_bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		free_writethrough(cache, wt);
+		wake_worker(cache);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	__remap(cache, bio, oblock, &result, map_context, &wt);
+	spin_unlock_irqrestore(&cache->lock, flags);
+	free_writethrough(cache, wt);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	u64 ll = map_context->ll;
+	unsigned index = ll >> IO_INDEX_SHIFT;
+	struct writethrough *wt;
+	unsigned long flags;
+	bool wake = false;
+
+	if (bio->bi_rw & REQ_FLUSH)
+		return error;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	switch (ll & IO_TYPE_MASK) {
+	case IO_NONE:
+		break;
+
+	case IO_CACHE:
+		wake = !--cache->cache_inflight[index];
+		break;
+
+	case IO_ORIGIN_WRITE:
+		wake = !--cache->origin_inflight[index];
+		break;
+
+	case IO_WRITETHROUGH:
+		wt = (struct writethrough *)(unsigned long)(ll & ~IO_TYPE_MASK);
+		if (!wt->to_cache && !error) {
+			/* on to the cache */
+			dm_bio_restore(&wt->details, bio);
+			remap_to_cache(cache, bio, wt->cblock);
+			wt->to_cache = true;
+			bio_list_add(&cache->writethrough_bios, bio);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			wake_worker(cache);
+			return DM_ENDIO_INCOMPLETE;
+		}
+
+		if (wt->to_cache && error) {
+			/* the worker drops the in flight count */
+			list_add_tail(&wt->list, &cache->failed_writethroughs);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			wake_worker(cache);
+			return error;
+		}
+
+		wake = !--cache->cache_inflight[wt->cblock];
+		mempool_free(wt, cache->writethrough_pool);
+		break;
+	}
+
+	if (wake && list_empty(&cache->quiescing_migrations))
+		wake = false;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (wake)
+		wake_worker(cache);
+
+	return error;
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cancel_delayed_work_sync(&cache->waker);
+	wait_event(cache->migration_wait, !atomic_read(&cache->nr_migrations));
+	flush_workqueue(cache->wq);
+
+	if (write_clean_shutdown(cache))
+		DMERR("Cannot write clean shutdown metadata");
+}
+
+/*
+ * The metadata is only read when the table is first resumed, after the
+ * table it replaces, if any, has written it out at suspend.
+ */
+static int cache_preresume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	if (!cache->loaded) {
+		r = load_metadata(cache);
+		if (r)
+			return r;
+		cache->loaded = true;
+	}
+
+	/* From now on a crash leaves the dirty flags stale */
+	r = write_header(cache, 0);
+	if (r)
+		DMERR("Cannot write metadata header");
+
+	return r;
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cache->idle = false;
+	queue_delayed_work(cache->wq, &cache->waker, HZ);
+	wake_worker(cache);
+}
+
+/*
+ * Status:
+ *
+ * <#used blocks>/<#cache blocks> <read hits> <read misses> <write hits>
+ * <write misses> <promotions> <demotions> <writebacks> <#dirty blocks>
+ * <policy>
+ */
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct cache *cache = ti->private;
+	dm_cblock_t residency, nr_dirty;
+	unsigned long flags;
+	unsigned i;
+	int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irqsave(&cache->lock, flags);
+		residency = cache->policy->residency(cache->policy);
+		nr_dirty = cache->nr_dirty;
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		DMEMIT("%u/%u %u %u %u %u %u %u %u %u %s",
+		       residency, cache->cache_size,
+		       atomic_read(&cache->read_hit),
+		       atomic_read(&cache->read_miss),
+		       atomic_read(&cache->write_hit),
+		       atomic_read(&cache->write_miss),
+		       atomic_read(&cache->promotion),
+		       atomic_read(&cache->demotion),
+		       atomic_read(&cache->writeback),
+		       nr_dirty, dm_cache_policy_get_name(cache->policy));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s %llu %s %s", cache->metadata_dev->name,
+		       cache->cache_dev->name, cache->origin_dev->name,
+		       (unsigned long long)cache->sectors_per_block,
+		       cache->writethrough ? "writethrough" : "writeback",
+		       dm_cache_policy_get_name(cache->policy));
+		if (cache->nr_policy_args)
+			DMEMIT(" %u", cache->nr_policy_args);
+		for (i = 0; i < cache->nr_policy_args; i++)
+			DMEMIT(" %s", cache->policy_args[i]);
+		break;
+	}
+
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	r = fn(ti, cache->cache_dev, 0,
+	       (sector_t)cache->cache_size << cache->block_shift, data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, cache->sectors_per_block << SECTOR_SHIFT);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.iterate_devices = cache_iterate_devices,
+	.io_hints = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r = -ENOMEM;
+
+	_migration_cache = kmem_cache_create("dm_cache_migration",
+					sizeof(struct migration),
+					__alignof__(struct migration), 0, NULL);
+	if (!_migration_cache)
+		goto bad_migration_cache;
+
+	_cell_cache = kmem_cache_create("dm_cache_cell",
+					sizeof(struct cell),
+					__alignof__(struct cell), 0, NULL);
+	if (!_cell_cache)
+		goto bad_cell_cache;
+
+	_writethrough_cache = kmem_cache_create("dm_cache_writethrough",
+					sizeof(struct writethrough),
+					__alignof__(struct writethrough), 0, NULL);
+	if (!_writethrough_cache)
+		goto bad_writethrough_cache;
+
+	r = dm_register_target(&cache_target);
+	if (r < 0) {
+		DMERR("register failed %d", r);
+		goto bad_register;
+	}
+
+	return 0;
+
+bad_register:
+	kmem_cache_destroy(_writethrough_cache);
+bad_writethrough_cache:
+	kmem_cache_destroy(_cell_cache);
+bad_cell_cache:
+	kmem_cache_destroy(_migration_cache);
+bad_migration_cache:
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_writethrough_cache);
+	kmem_cache_destroy(_cell_cache);
+	kmem_cache_destroy(_migration_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
@@ -94,8 +94,13 @@
  * not hashed must be on the inactive_list, and will normally be at
  * the front.  All stripes start life this way.
  *
- * The inactive_list, handle_list and hash bucket lists are all protected by the
- * device_lock.
+ * The stripe cache is split into NR_STRIPE_HASH_LOCKS partitions by
+ * sector.  Each partition has its own inactive_list and hash_lock, and
+ * a stripe always stays in the partition given by its hash_lock_index.
+ * The inactive_list and the hash buckets of a partition are protected
+ * by its hash_lock; the handle_list (and the per-group handle_lists
+ * used by the worker threads) are protected by the device_lock.  When
+ * both are needed, the hash_lock is taken first.
  *  - stripes on the inactive_list never have their stripe_lock held.
  *  - stripes have a reference counter. If count==0, they are on a list.
  *  - If a stripe might need handling, STRIPE_HANDLE is set.
@@ -110,9 +115,9 @@
  *
  * The possible transitions are:
  *  activate an unhashed/inactive stripe (get_active_stripe())
- *     lockdev check-hash unlink-stripe cnt++ clean-stripe hash-stripe unlockdev
+ *     lockhash check-hash unlink-stripe cnt++ clean-stripe hash-stripe unlockhash
  *  activate a hashed, possibly active stripe (get_active_stripe())
- *     lockdev check-hash if(!cnt++)unlink-stripe unlockdev
+ *     lockhash check-hash if(!cnt++)(lockdev unlink-stripe unlockdev) unlockhash
  *  attach a request to an active stripe (add_stripe_bh())
  *     lockdev attach-buffer unlockdev
  *  handle a stripe (handle_stripe())
@@ -121,7 +126,8 @@
  *		change-state ..
  *		record io/ops needed unlockstripe schedule io/ops
  *  release an active stripe (release_stripe())
- *     lockdev if (!--cnt) { if  STRIPE_HANDLE, add to handle_list else add to inactive-list } unlockdev
+ *     lockdev if (!--cnt) { if  STRIPE_HANDLE, add to handle_list else add to temp-inactive-list } unlockdev
+ *     lockhash splice temp-inactive-list onto inactive_list unlockhash
  *
  * The refcount counts each thread that have activated the stripe,
  * plus raid5d if it is handling it, plus one for each active request
@@ -203,6 +209,9 @@ struct stripe_head {
 	struct raid5_private_data *raid_conf;
 	short			generation;	/* increments with every
 						 * reshape */
+	short			hash_lock_index; /* stripe cache partition */
+	int			cpu;		/* cpu that activated it */
+	struct r5worker_group	*group;		/* on this group's handle_list */
 	sector_t		sector;		/* sector of this row */
 	short			pd_idx;		/* parity disk index */
 	short			qd_idx;		/* 'Q' disk index for raid6 */
@@ -344,8 +353,33 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/* The stripe cache is partitioned by sector into this many pieces, each
+ * with its own inactive_list and lock.  Must be a power of 2.
+ */
+#define NR_STRIPE_HASH_LOCKS	8
+#define STRIPE_HASH_LOCKS_MASK	(NR_STRIPE_HASH_LOCKS - 1)
+
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	bool			working;
+};
+
+/* One group of worker threads per NUMA node.  A stripe that needs
+ * handling is queued to the group of the cpu that activated it.
+ */
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct raid5_private_data *conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
+	/* only protect corresponding hash list and inactive_list */
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
 	mddev_t			*mddev;
 	struct disk_info	*spare;
 	int			chunk_sectors;
@@ -368,6 +402,7 @@ struct raid5_private_data {
 	int			prev_chunk_sectors;
 	int			prev_algo;
 	short			generation; /* increments with every reshape */
+	seqcount_t		gen_lock;   /* lock against generation changes */
 	unsigned long		reshape_checkpoint; /* Time we last updated
 						     * metadata */
 
@@ -420,7 +455,8 @@ struct raid5_private_data {
 	 * Free stripes pool
 	 */
 	atomic_t		active_stripes;
-	struct list_head	inactive_list;
+	struct list_head	inactive_list[NR_STRIPE_HASH_LOCKS];
+	atomic_t		empty_inactive_list_nr;
 	wait_queue_head_t	wait_for_stripe;
 	wait_queue_head_t	wait_for_overlap;
 	int			inactive_blocked;	/* release of inactive stripes blocked,
@@ -434,6 +470,11 @@ struct raid5_private_data {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct mdk_thread_s	*thread;
+	/* stripes released by raid5d, to be returned to the inactive_lists */
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+	int			worker_cnt_per_group;
 };
 
 typedef struct raid5_private_data raid5_conf_t;
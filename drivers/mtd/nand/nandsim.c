@@ -104,6 +104,7 @@ static char *badblocks = NULL;
 static char *weakblocks = NULL;
 static char *weakpages = NULL;
 static unsigned int bitflips = 0;
+static unsigned int bitflip_freq = 1024;
 static char *gravepages = NULL;
 static unsigned int rptwear = 0;
 static unsigned int overridesize = 0;
@@ -129,6 +130,7 @@ module_param(badblocks,      charp, 0400);
 module_param(weakblocks,     charp, 0400);
 module_param(weakpages,      charp, 0400);
 module_param(bitflips,       uint, 0400);
+module_param(bitflip_freq,   uint, 0400);
 module_param(gravepages,     charp, 0400);
 module_param(rptwear,        uint, 0400);
 module_param(overridesize,   uint, 0400);
@@ -159,6 +161,8 @@ MODULE_PARM_DESC(weakpages,      "Weak pages [: maximum writes (defaults to 3)]"
 				 " separated by commas e.g. 1401:2 means page 1401"
 				 " can be written only twice before failing");
 MODULE_PARM_DESC(bitflips,       "Maximum number of random bit flips per page (zero by default)");
+MODULE_PARM_DESC(bitflip_freq,   "Flip bits in one out of this many page reads (1024 by default),"
+				 " e.g. 1 with bch to make every read go through ECC correction");
 MODULE_PARM_DESC(gravepages,     "Pages that lose data [: maximum reads (defaults to 3)]"
 				 " separated by commas e.g. 1401:2 means page 1401"
 				 " can be read only twice before failing");
@@ -1420,17 +1424,21 @@ int do_read_error(struct nandsim *ns, int num)
 
 void do_bit_flips(struct nandsim *ns, int num)
 {
-	if (bitflips && random32() < (1 << 22)) {
+	if (bitflips && (bitflip_freq <= 1 || random32() % bitflip_freq == 0)) {
 		int flips = 1;
 		if (bitflips > 1)
 			flips = (random32() % (int) bitflips) + 1;
 		while (flips--) {
 			int pos = random32() % (num * 8);
 			ns->buf.byte[pos / 8] ^= (1 << (pos % 8));
-			NS_WARN("read_page: flipping bit %d in page %d "
-				"reading from %d ecc: corrected=%u failed=%u\n",
-				pos, ns->regs.row, ns->regs.column + ns->regs.off,
-				nsmtd->ecc_stats.corrected, nsmtd->ecc_stats.failed);
+			/* do not flood the log when flipping on every read */
+			if (printk_ratelimit())
+				NS_WARN("read_page: flipping bit %d in page %d "
+					"reading from %d ecc: corrected=%u "
+					"failed=%u\n", pos, ns->regs.row,
+					ns->regs.column + ns->regs.off,
+					nsmtd->ecc_stats.corrected,
+					nsmtd->ecc_stats.failed);
 		}
 	}
 }
@@ -2530,7 +2530,8 @@ static void asc_prt_scsi_host(struct Scsi_Host *s)
 
 	printk("Scsi_Host at addr 0x%p, device %s\n", s, dev_name(boardp->dev));
 	printk(" host_busy %u, host_no %d, last_reset %d,\n",
-	       s->host_busy, s->host_no, (unsigned)s->last_reset);
+	       atomic_read(&s->host_busy), s->host_no,
+	       (unsigned)s->last_reset);
 
 	printk(" base 0x%lx, io_port 0x%lx, irq %d,\n",
 	       (ulong)s->base, (ulong)s->io_port, boardp->irq);
@@ -3560,7 +3561,8 @@ static int asc_prt_driver_conf(struct Scsi_Host *shost, char *cp, int cplen)
 
 	len = asc_prt_line(cp, leftlen,
 			   " host_busy %u, last_reset %u, max_id %u, max_lun %u, max_channel %u\n",
-			   shost->host_busy, shost->last_reset, shost->max_id,
+			   atomic_read(&shost->host_busy), shost->last_reset,
+			   shost->max_id,
 			   shost->max_lun, shost->max_channel);
 	ASC_PRT_NEXT();
 
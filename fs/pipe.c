@@ -101,6 +101,7 @@ void pipe_wait(struct pipe_inode_info *pipe)
 	finish_wait(&pipe->wait, &wait);
 	pipe_lock(pipe);
 }
+EXPORT_SYMBOL_GPL(pipe_wait);
 
 static int
 pipe_iov_copy_from_user(void *to, struct iovec *iov, unsigned long len,
@@ -174,6 +174,8 @@ struct gf128mul_4k *gf128mul_init_4k_lle(const be128 *g);
 struct gf128mul_4k *gf128mul_init_4k_bbe(const be128 *g);
 void gf128mul_4k_lle(be128 *a, struct gf128mul_4k *t);
 void gf128mul_4k_bbe(be128 *a, struct gf128mul_4k *t);
+void gf128mul_4k_lle_sum(be128 *r, const be128 *a, struct gf128mul_4k **t,
+			 int n);
 
 static inline void gf128mul_free_4k(struct gf128mul_4k *t)
 {
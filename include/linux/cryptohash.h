@@ -10,4 +10,10 @@ void sha_transform(__u32 *digest, const char *data, __u32 *W);
 
 __u32 half_md4_transform(__u32 buf[4], __u32 const in[8]);
 
+#define CHACHA20_KEY_SIZE	32
+#define CHACHA20_BLOCK_SIZE	64
+
+void chacha20_init_state(__u32 *state, const __u32 *key);
+void chacha20_block(__u32 *state, void *stream);
+
 #endif
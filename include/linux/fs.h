@@ -388,6 +388,8 @@ struct inodes_stat_t {
 #include <linux/semaphore.h>
 #include <linux/fiemap.h>
 #include <linux/rculist_bl.h>
+#include <linux/list_lru.h>
+#include <linux/shrinker.h>
 
 #include <asm/atomic.h>
 #include <asm/byteorder.h>
@@ -1084,14 +1086,20 @@ int locks_in_grace(void);
 /* that will die - we need it for nfs_lock_info */
 #include <linux/nfs_fs_i.h>
 
+/*
+ * The i_flock list of an inode, and the locks on it, are protected by
+ * that inode's i_lock.
+ */
 struct file_lock {
 	struct file_lock *fl_next;	/* singly linked list for this inode  */
-	struct list_head fl_link;	/* doubly linked list of all locks */
+	struct list_head fl_link;	/* per-CPU list of all locks, or
+					 * blocked_hash link when waiting */
 	struct list_head fl_block;	/* circular list of blocked processes */
 	fl_owner_t fl_owner;
 	unsigned char fl_flags;
 	unsigned char fl_type;
 	unsigned int fl_pid;
+	int fl_link_cpu;		/* CPU whose file_lock_list we're on */
 	struct pid *fl_nspid;
 	wait_queue_head_t fl_wait;
 	struct file *fl_file;
@@ -1162,8 +1170,6 @@ extern int vfs_setlease(struct file *, long, struct file_lock **);
 extern int lease_modify(struct file_lock **, int);
 extern int lock_may_read(struct inode *, loff_t start, unsigned long count);
 extern int lock_may_write(struct inode *, loff_t start, unsigned long count);
-extern void lock_flocks(void);
-extern void unlock_flocks(void);
 #else /* !CONFIG_FILE_LOCKING */
 static inline int fcntl_getlk(struct file *file, struct flock __user *user)
 {
@@ -1306,14 +1312,6 @@ static inline int lock_may_write(struct inode *inode, loff_t start,
 	return 1;
 }
 
-static inline void lock_flocks(void)
-{
-}
-
-static inline void unlock_flocks(void)
-{
-}
-
 #endif /* !CONFIG_FILE_LOCKING */
 
 
@@ -1388,9 +1386,15 @@ struct super_block {
 #else
 	struct list_head	s_files;
 #endif
-	/* s_dentry_lru, s_nr_dentry_unused protected by dcache.c lru locks */
-	struct list_head	s_dentry_lru;	/* unused dentry lru */
-	int			s_nr_dentry_unused;	/* # of dentry on lru */
+	/*
+	 * Unused dentries and inodes.  Both LRUs have per-node locks of their
+	 * own; s_dentry_shrink_lock protects dentries that have been taken off
+	 * s_dentry_lru onto a private shrink list (DCACHE_SHRINK_LIST).
+	 */
+	struct list_lru		s_dentry_lru;
+	struct list_lru		s_inode_lru;
+	spinlock_t		s_dentry_shrink_lock;
+	struct shrinker		s_shrink;	/* per-sb dentry/inode shrinker */
 
 	struct block_device	*s_bdev;
 	struct backing_dev_info *s_bdi;
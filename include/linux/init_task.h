@@ -29,6 +29,9 @@ extern struct fs_struct init_fs;
 		.list = LIST_HEAD_INIT(sig.shared_pending.list),	\
 		.signal =  {{0}}},					\
 	.posix_timers	 = LIST_HEAD_INIT(sig.posix_timers),		\
+	.posix_timers_id = IDR_INIT(sig.posix_timers_id),		\
+	.posix_timers_lock =						\
+		 __SPIN_LOCK_UNLOCKED(sig.posix_timers_lock),		\
 	.cpu_timers	= INIT_CPU_TIMERS(sig.cpu_timers),		\
 	.rlim		= INIT_RLIMITS,					\
 	.cputimer	= { 						\
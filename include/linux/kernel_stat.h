@@ -64,10 +64,18 @@ static inline unsigned int kstat_irqs_cpu(unsigned int irq, int cpu)
 #include <linux/irq.h>
 extern unsigned int kstat_irqs_cpu(unsigned int irq, int cpu);
 
+/*
+ * For callers that do not hold desc->lock.  The flow handlers in
+ * kernel/irq that do also keep desc->tot_count up to date.
+ */
 #define kstat_incr_irqs_this_cpu(irqno, DESC)		\
 do {							\
-	__this_cpu_inc(*(DESC)->kstat_irqs);		\
+	struct irq_desc *__desc = (DESC);		\
+							\
+	__this_cpu_inc(*__desc->kstat_irqs);		\
 	__this_cpu_inc(kstat.irqs_sum);			\
+	if (unlikely(!__desc->kstat_unlocked))		\
+		__desc->kstat_unlocked = 1;		\
 } while (0)
 
 #endif
@@ -1163,32 +1163,7 @@ static inline void sync_mm_rss(struct task_struct *task, struct mm_struct *mm)
 }
 #endif
 
-/*
- * A callback you can register to apply pressure to ageable caches.
- *
- * 'shrink' is passed a count 'nr_to_scan' and a 'gfpmask'.  It should
- * look through the least-recently-used 'nr_to_scan' entries and
- * attempt to free them up.  It should return the number of objects
- * which remain in the cache.  If it returns -1, it means it cannot do
- * any scanning at this time (eg. there is a risk of deadlock).
- *
- * The 'gfpmask' refers to the allocation we are currently trying to
- * fulfil.
- *
- * Note that 'shrink' will be passed nr_to_scan == 0 when the VM is
- * querying the cache size, so a fastpath for that case is appropriate.
- */
-struct shrinker {
-	int (*shrink)(struct shrinker *, int nr_to_scan, gfp_t gfp_mask);
-	int seeks;	/* seeks to recreate an obj */
-
-	/* These are for internal use */
-	struct list_head list;
-	long nr;	/* objs pending delete */
-};
-#define DEFAULT_SEEKS 2 /* A good number if you don't know better. */
-extern void register_shrinker(struct shrinker *);
-extern void unregister_shrinker(struct shrinker *);
+#include <linux/shrinker.h>
 
 int vma_wants_writenotify(struct vm_area_struct *vma);
 
@@ -1257,6 +1232,7 @@ static inline pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, unsigned long a
 } while (0)
 #define pte_lock_deinit(page)	((page)->mapping = NULL)
 #define pte_lockptr(mm, pmd)	({(void)(mm); __pte_lockptr(pmd_page(*(pmd)));})
+#define pgtable_lockptr(mm, pgtable) ({(void)(mm); __pte_lockptr(pgtable);})
 #else	/* !USE_SPLIT_PTLOCKS */
 /*
  * We use mm->page_table_lock to guard all pagetable pages of the mm.
@@ -1264,6 +1240,7 @@ static inline pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, unsigned long a
 #define pte_lock_init(page)	do {} while (0)
 #define pte_lock_deinit(page)	do {} while (0)
 #define pte_lockptr(mm, pmd)	({(void)(pmd); &(mm)->page_table_lock;})
+#define pgtable_lockptr(mm, pgtable) ({(void)(pgtable); &(mm)->page_table_lock;})
 #endif /* USE_SPLIT_PTLOCKS */
 
 static inline void pgtable_page_ctor(struct page *page)
@@ -1278,6 +1255,7 @@ static inline void pgtable_page_dtor(struct page *page)
 	dec_zone_page_state(page, NR_PAGETABLE);
 }
 
+#ifndef CONFIG_SHARE_PTE_ON_FORK
 #define pte_offset_map_lock(mm, pmd, address, ptlp)	\
 ({							\
 	spinlock_t *__ptl = pte_lockptr(mm, pmd);	\
@@ -1286,6 +1264,21 @@ static inline void pgtable_page_dtor(struct page *page)
 	spin_lock(__ptl);				\
 	__pte;						\
 })
+#else
+/*
+ * The pmd may be switched over to a private copy of a shared pte table
+ * under us: read it once, so that the lock always matches the table.
+ */
+#define pte_offset_map_lock(mm, pmd, address, ptlp)	\
+({							\
+	pmd_t __pmdval = *(pmd);			\
+	spinlock_t *__ptl = pte_lockptr(mm, &__pmdval);	\
+	pte_t *__pte = pte_offset_map(&__pmdval, address); \
+	*(ptlp) = __ptl;				\
+	spin_lock(__ptl);				\
+	__pte;						\
+})
+#endif
 
 #define pte_unmap_unlock(pte, ptl)	do {		\
 	spin_unlock(ptl);				\
@@ -1306,6 +1299,66 @@ static inline void pgtable_page_dtor(struct page *page)
 	((unlikely(pmd_none(*(pmd))) && __pte_alloc_kernel(pmd, address))? \
 		NULL: pte_offset_kernel(pmd, address))
 
+#ifdef CONFIG_SHARE_PTE_ON_FORK
+/*
+ * fork() may let parent and child share the pte tables of private
+ * anonymous memory instead of copying them.  A page table page is never
+ * mapped into userspace, so its _mapcount counts the additional mms using
+ * the table: it is -1 while the table is private.  A shared table is
+ * never modified; whoever wants to change it first switches to a private
+ * copy with unshare_pte_table().
+ */
+extern int sysctl_fork_share_ptes;
+
+static inline int pte_table_shared(pmd_t pmd)
+{
+	return !pmd_none(pmd) && !pmd_trans_huge(pmd) &&
+		atomic_read(&pmd_page(pmd)->_mapcount) >= 0;
+}
+
+extern int __unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			       pmd_t pmdval, unsigned long address);
+
+/*
+ * Make sure the pte table at @pmd is private to the mm of @vma.
+ * Must be called with mmap_sem held.  Returns -ENOMEM on failure.
+ */
+static inline int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long address)
+{
+	pmd_t pmdval = *pmd;
+
+	if (likely(!pte_table_shared(pmdval)))
+		return 0;
+	return __unshare_pte_table(vma, pmd, pmdval, address);
+}
+
+extern int unshare_pte_range(struct vm_area_struct *vma, unsigned long start,
+			     unsigned long end, int detach);
+extern void release_retired_ptes(struct mm_struct *mm);
+#else
+static inline int pte_table_shared(pmd_t pmd)
+{
+	return 0;
+}
+
+static inline int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long address)
+{
+	return 0;
+}
+
+static inline int unshare_pte_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end, int detach)
+{
+	return 0;
+}
+
+static inline void release_retired_ptes(struct mm_struct *mm)
+{
+}
+#endif
+
 extern void free_area_init(unsigned long * zones_size);
 extern void free_area_init_node(int nid, unsigned long * zones_size,
 		unsigned long zone_start_pfn, unsigned long *zholes_size);
@@ -317,6 +317,17 @@ struct mm_struct {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_SHARE_PTE_ON_FORK
+	/* shared pte tables we stopped using, protected by page_table_lock */
+	struct list_head retired_ptes;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Set when reclaim has cleared a pte of this mm and not yet flushed
+	 * the TLBs: see flush_tlb_batched_pending().
+	 */
+	bool tlb_flush_batched;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
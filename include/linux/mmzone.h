@@ -176,8 +176,27 @@ struct per_cpu_pages {
 
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+
+	/*
+	 * Blocks of order 1..PAGE_ALLOC_COSTLY_ORDER, indexed by order - 1.
+	 * ho_high and ho_batch are in pages and get scaled down by the
+	 * order of each list.
+	 */
+	int ho_high;
+	int ho_batch;
+	int ho_count[PAGE_ALLOC_COSTLY_ORDER];
+	struct list_head ho_lists[PAGE_ALLOC_COSTLY_ORDER][MIGRATE_PCPTYPES];
 };
 
+static inline int pcp_highorder_count(struct per_cpu_pages *pcp)
+{
+	int i, count = 0;
+
+	for (i = 0; i < PAGE_ALLOC_COSTLY_ORDER; i++)
+		count += pcp->ho_count[i];
+	return count;
+}
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
 #ifdef CONFIG_NUMA
@@ -339,6 +358,10 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+
+	/* Where kcompactd's scanners stopped last time, 0 to restart */
+	unsigned long		compact_cached_migrate_pfn;
+	unsigned long		compact_cached_free_pfn;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -641,6 +664,12 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -771,6 +800,8 @@ int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
 int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
+int percpu_highorder_sysctl_handler(struct ctl_table *, int,
+					void __user *, size_t *, loff_t *);
 int sysctl_min_unmapped_ratio_sysctl_handler(struct ctl_table *, int,
 			void __user *, size_t *, loff_t *);
 int sysctl_min_slab_ratio_sysctl_handler(struct ctl_table *, int,
@@ -260,16 +260,21 @@ struct perf_event_mmap_page {
 	/*
 	 * Bits needed to read the hw events in user-space.
 	 *
-	 *   u32 seq;
-	 *   s64 count;
+	 *   u32 seq, idx, width;
+	 *   s64 count, pmc;
 	 *
 	 *   do {
 	 *     seq = pc->lock;
 	 *
 	 *     barrier()
-	 *     if (pc->index) {
-	 *       count = pmc_read(pc->index - 1);
-	 *       count += pc->offset;
+	 *     idx = pc->index;
+	 *     count = pc->offset;
+	 *     if (pc->cap_usr_rdpmc && idx) {
+	 *       width = pc->pmc_width;
+	 *       pmc = pmc_read(idx - 1);
+	 *       pmc <<= 64 - width;
+	 *       pmc >>= 64 - width; // signed shift right
+	 *       count += pmc;
 	 *     } else
 	 *       goto regular_read;
 	 *
@@ -284,12 +289,19 @@ struct perf_event_mmap_page {
 	__s64	offset;			/* add to hardware event value */
 	__u64	time_enabled;		/* time event active */
 	__u64	time_running;		/* time event on cpu */
+	union {
+		__u64	capabilities;
+		__u64	cap_usr_rdpmc : 1, /* user space may read the counter */
+			cap_____res   : 63;
+	};
+	__u16	pmc_width;		/* bits in the value pmc_read() returns */
+	__u16	__reserved_16[3];
 
 		/*
 		 * Hole for extension of the self monitor capabilities
 		 */
 
-	__u64	__reserved[123];	/* align to 1k */
+	__u64	__reserved[121];	/* align to 1k */
 
 	/*
 	 * Control data for the mmap() data buffer.
@@ -644,6 +656,13 @@ struct pmu {
 	 */
 	void (*read)			(struct perf_event *event);
 
+	/*
+	 * Will return the value for perf_event_mmap_page::index for this
+	 * event, 0 if its counter can't be read from user space.  If no
+	 * implementation is provided it defaults to event->hw.idx + 1.
+	 */
+	int (*event_idx)		(struct perf_event *event); /* optional */
+
 	/*
 	 * Group events scheduling is treated as a transaction, add
 	 * group events as a whole and perform one schedulability test.
@@ -971,6 +990,8 @@ extern void perf_pmu_enable(struct pmu *pmu);
 extern int perf_event_task_disable(void);
 extern int perf_event_task_enable(void);
 extern void perf_event_update_userpage(struct perf_event *event);
+extern void arch_perf_update_userpage(struct perf_event *event,
+				      struct perf_event_mmap_page *userpg);
 extern int perf_event_release_kernel(struct perf_event *event);
 extern struct perf_event *
 perf_event_create_kernel_counter(struct perf_event_attr *attr,
@@ -68,6 +68,7 @@ struct k_itimer {
 		struct task_struct *it_process;	/* for clock_nanosleep */
 	};
 	struct sigqueue *sigq;		/* signal queue entry. */
+	struct rcu_head it_rcu;		/* lookups may still see it */
 	union {
 		struct {
 			struct hrtimer timer;
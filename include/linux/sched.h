@@ -79,6 +79,7 @@ struct sched_param {
 #include <linux/proportions.h>
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
+#include <linux/idr.h>
 #include <linux/rculist.h>
 #include <linux/rtmutex.h>
 
@@ -552,6 +553,8 @@ struct signal_struct {
 
 	/* POSIX.1b Interval Timers */
 	struct list_head posix_timers;
+	struct idr posix_timers_id;	/* timer ids, looked up under RCU */
+	spinlock_t posix_timers_lock;	/* serializes id allocation */
 
 	/* ITIMER_REAL timer for the process */
 	struct hrtimer real_timer;
@@ -1190,6 +1193,17 @@ enum perf_event_task_context {
 	perf_nr_task_contexts,
 };
 
+/*
+ * Ptes cleared by reclaim whose TLB entries have not been flushed yet:
+ * the cpus that may still cache them, and whether any of them was dirty,
+ * i.e. may still be written through.  See try_to_unmap_flush().
+ */
+struct tlbflush_unmap_batch {
+	struct cpumask cpumask;
+	bool flush_required;
+	bool writable;
+};
+
 struct task_struct {
 	volatile long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
 	void *stack;
@@ -1439,6 +1453,9 @@ struct task_struct {
 
 /* VM state */
 	struct reclaim_state *reclaim_state;
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	struct tlbflush_unmap_batch tlb_ubc;
+#endif
 
 	struct backing_dev_info *backing_dev_info;
 
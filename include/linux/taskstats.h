@@ -33,7 +33,7 @@
  */
 
 
-#define TASKSTATS_VERSION	8
+#define TASKSTATS_VERSION	9
 #define TS_COMM_LEN		32	/* should be >= TASK_COMM_LEN
 					 * in linux/sched.h */
 
@@ -163,6 +163,14 @@ struct taskstats {
 	/* Delay waiting for memory reclaim */
 	__u64	freepages_count;
 	__u64	freepages_delay_total;
+	/* version 8 ends here */
+
+	/* Snapshot of the task at the time the stats were taken */
+	__u64	rss;			/* Current RSS usage, in KB */
+	__u64	sum_exec_runtime;	/* Time spent on a cpu [nsec] */
+	__u32	ac_cpu;			/* cpu the task last ran on */
+	__u8	ac_state;		/* State letter, as in /proc/<pid>/stat */
+	__u8	ac_pad2[3];
 };
 
 
@@ -10,9 +10,11 @@ extern void unix_inflight(struct file *fp);
 extern void unix_notinflight(struct file *fp);
 extern void unix_gc(void);
 extern void wait_for_unix_gc(void);
+extern void unix_gc_flush(void);
 extern struct sock *unix_get_socket(struct file *filp);
 
-#define UNIX_HASH_SIZE	256
+#define UNIX_HASH_BITS	8
+#define UNIX_HASH_SIZE	(1 << UNIX_HASH_BITS)
 
 extern unsigned int unix_tot_inflight;
 
@@ -27,6 +29,7 @@ struct unix_skb_parms {
 	struct pid		*pid;		/* Skb credentials	*/
 	const struct cred	*cred;
 	struct scm_fp_list	*fp;		/* Passed files		*/
+	u32			consumed;	/* Stream bytes read	*/
 #ifdef CONFIG_SECURITY_NETWORK
 	u32			secid;		/* Security ID		*/
 #endif
@@ -55,8 +58,10 @@ struct unix_sock {
 	struct list_head	link;
 	atomic_long_t		inflight;
 	spinlock_t		lock;
-	unsigned int		gc_candidate : 1;
-	unsigned int		gc_maybe_cycle : 1;
+	unsigned long		gc_flags;
+#define UNIX_GC_CANDIDATE	0
+#define UNIX_GC_MAYBE_CYCLE	1
+#define UNIX_GC_MAYBE_FDS	2	/* fds sent to it since gc */
 	unsigned char		recursion_level;
 	struct socket_wq	peer_wq;
 };
@@ -76,4 +76,16 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 
 extern spinlock_t nf_conntrack_lock ;
 
+/*
+ * Hash buckets are protected by nf_conntrack_locks[bucket % CONNTRACK_LOCKS],
+ * taken with nf_conntrack_lock_bucket() and BHs disabled; the hash table
+ * can only be replaced while nf_conntrack_all_lock() is held.
+ */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock_bucket(spinlock_t *lock);
+extern void nf_conntrack_all_lock(void);
+extern void nf_conntrack_all_unlock(void);
+
 #endif /* _NF_CONNTRACK_CORE_H */
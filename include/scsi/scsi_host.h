@@ -573,12 +573,13 @@ struct Scsi_Host {
 	 */
 	struct blk_queue_tag	*bqt;
 
+	atomic_t host_busy;		   /* commands actually active on low-level */
+
 	/*
 	 * The following two fields are protected with host_lock;
 	 * however, eh routines can safely access during eh processing
 	 * without acquiring the lock.
 	 */
-	unsigned int host_busy;		   /* commands actually active on low-level */
 	unsigned int host_failed;	   /* commands that failed. */
 	unsigned int host_eh_scheduled;    /* EH scheduled without command */
     
@@ -665,7 +666,7 @@ struct Scsi_Host {
 	/*
 	 * Host has rejected a command because it was busy.
 	 */
-	unsigned int host_blocked;
+	atomic_t host_blocked;
 
 	/*
 	 * Value host_blocked counts down from
@@ -250,7 +250,7 @@ void handle_nested_irq(unsigned int irq)
 
 	raw_spin_lock_irq(&desc->lock);
 
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	action = desc->action;
 	if (unlikely(!action || irqd_irq_disabled(&desc->irq_data)))
@@ -300,7 +300,7 @@ handle_simple_irq(unsigned int irq, struct irq_desc *desc)
 			goto out_unlock;
 
 	desc->istate &= ~(IRQS_REPLAY | IRQS_WAITING);
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	if (unlikely(!desc->action || irqd_irq_disabled(&desc->irq_data)))
 		goto out_unlock;
@@ -332,7 +332,7 @@ handle_level_irq(unsigned int irq, struct irq_desc *desc)
 			goto out_unlock;
 
 	desc->istate &= ~(IRQS_REPLAY | IRQS_WAITING);
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	/*
 	 * If its disabled or no action available
@@ -380,7 +380,7 @@ handle_fasteoi_irq(unsigned int irq, struct irq_desc *desc)
 			goto out;
 
 	desc->istate &= ~(IRQS_REPLAY | IRQS_WAITING);
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	/*
 	 * If its disabled or no action available
@@ -444,7 +444,7 @@ handle_edge_irq(unsigned int irq, struct irq_desc *desc)
 			goto out_unlock;
 		}
 	}
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	/* Start handling the irq */
 	desc->irq_data.chip->irq_ack(&desc->irq_data);
@@ -503,7 +503,7 @@ void handle_edge_eoi_irq(unsigned int irq, struct irq_desc *desc)
 			goto out_eoi;
 		}
 	}
-	kstat_incr_irqs_this_cpu(irq, desc);
+	kstat_incr_irqs_locked(irq, desc);
 
 	do {
 		if (unlikely(!desc->action))
@@ -2464,12 +2464,26 @@ out:
 	local_irq_restore(flags);
 }
 
+struct perf_read_data {
+	struct perf_event *event;
+	bool group;
+};
+
+static void __perf_event_read_one(struct perf_event *event)
+{
+	update_event_times(event);
+	if (event->state == PERF_EVENT_STATE_ACTIVE)
+		event->pmu->read(event);
+}
+
 /*
- * Cross CPU call to read the hardware event
+ * Cross CPU call to read the hardware event, or all the events of its
+ * group at once.
  */
 static void __perf_event_read(void *info)
 {
-	struct perf_event *event = info;
+	struct perf_read_data *data = info;
+	struct perf_event *event = data->event, *sub;
 	struct perf_event_context *ctx = event->ctx;
 	struct perf_cpu_context *cpuctx = __get_cpu_context(ctx);
 
@@ -2488,9 +2502,11 @@ static void __perf_event_read(void *info)
 		update_context_time(ctx);
 		update_cgrp_time_from_event(event);
 	}
-	update_event_times(event);
-	if (event->state == PERF_EVENT_STATE_ACTIVE)
-		event->pmu->read(event);
+	__perf_event_read_one(event);
+	if (data->group) {
+		list_for_each_entry(sub, &event->sibling_list, group_entry)
+			__perf_event_read_one(sub);
+	}
 	raw_spin_unlock(&ctx->lock);
 }
 
@@ -2499,15 +2515,26 @@ static inline u64 perf_event_count(struct perf_event *event)
 	return local64_read(&event->count) + atomic64_read(&event->child_count);
 }
 
-static u64 perf_event_read(struct perf_event *event)
+/*
+ * Bring the count of the event up to date, and with @group set the counts
+ * of all its siblings as well, in a single cross CPU call: @event must be
+ * a group leader then.
+ */
+static void __perf_event_read_update(struct perf_event *event, bool group)
 {
+	struct perf_read_data data = {
+		.event	= event,
+		.group	= group,
+	};
+	struct perf_event *sub;
+
 	/*
 	 * If event is enabled and currently active on a CPU, update the
 	 * value in the event structure:
 	 */
 	if (event->state == PERF_EVENT_STATE_ACTIVE) {
 		smp_call_function_single(event->oncpu,
-					 __perf_event_read, event, 1);
+					 __perf_event_read, &data, 1);
 	} else if (event->state == PERF_EVENT_STATE_INACTIVE) {
 		struct perf_event_context *ctx = event->ctx;
 		unsigned long flags;
@@ -2523,8 +2550,18 @@ static u64 perf_event_read(struct perf_event *event)
 			update_cgrp_time_from_event(event);
 		}
 		update_event_times(event);
+		if (group) {
+			list_for_each_entry(sub, &event->sibling_list,
+					    group_entry)
+				update_event_times(sub);
+		}
 		raw_spin_unlock_irqrestore(&ctx->lock, flags);
 	}
+}
+
+static u64 perf_event_read(struct perf_event *event)
+{
+	__perf_event_read_update(event, false);
 
 	return perf_event_count(event);
 }
@@ -3046,50 +3083,81 @@ u64 perf_event_read_value(struct perf_event *event, u64 *enabled, u64 *running)
 }
 EXPORT_SYMBOL_GPL(perf_event_read_value);
 
-static int perf_event_read_group(struct perf_event *event,
-				   u64 read_format, char __user *buf)
+/*
+ * Add the counts of the group led by @leader to @values, laid out as
+ * PERF_FORMAT_GROUP describes, after reading them all in one go.
+ */
+static void perf_event_read_group_add(struct perf_event *leader,
+				      u64 read_format, u64 *values)
 {
-	struct perf_event *leader = event->group_leader, *sub;
-	int n = 0, size = 0, ret = -EFAULT;
-	struct perf_event_context *ctx = leader->ctx;
-	u64 values[5];
-	u64 count, enabled, running;
+	struct perf_event *sub;
+	int n = 1; /* skip @nr */
 
-	mutex_lock(&ctx->mutex);
-	count = perf_event_read_value(leader, &enabled, &running);
+	__perf_event_read_update(leader, true);
 
-	values[n++] = 1 + leader->nr_siblings;
 	if (read_format & PERF_FORMAT_TOTAL_TIME_ENABLED)
-		values[n++] = enabled;
+		values[n++] += leader->total_time_enabled +
+			atomic64_read(&leader->child_total_time_enabled);
 	if (read_format & PERF_FORMAT_TOTAL_TIME_RUNNING)
-		values[n++] = running;
-	values[n++] = count;
+		values[n++] += leader->total_time_running +
+			atomic64_read(&leader->child_total_time_running);
+
+	values[n++] += perf_event_count(leader);
 	if (read_format & PERF_FORMAT_ID)
 		values[n++] = primary_event_id(leader);
 
+	list_for_each_entry(sub, &leader->sibling_list, group_entry) {
+		values[n++] += perf_event_count(sub);
+		if (read_format & PERF_FORMAT_ID)
+			values[n++] = primary_event_id(sub);
+	}
+}
+
+/*
+ * Every copy of the group, the inherited ones included, is read with a
+ * single cross CPU call, and the result is copied out at once.
+ */
+static int perf_event_read_group(struct perf_event *event,
+				   u64 read_format, char __user *buf,
+				   size_t count)
+{
+	struct perf_event *leader = event->group_leader, *child;
+	struct perf_event_context *ctx = leader->ctx;
+	int n, size, ret;
+	u64 *values;
+
+	mutex_lock(&ctx->mutex);
+
+	n = 1 + (1 + leader->nr_siblings) *
+		(read_format & PERF_FORMAT_ID ? 2 : 1);
+	if (read_format & PERF_FORMAT_TOTAL_TIME_ENABLED)
+		n++;
+	if (read_format & PERF_FORMAT_TOTAL_TIME_RUNNING)
+		n++;
 	size = n * sizeof(u64);
 
-	if (copy_to_user(buf, values, size))
+	ret = -ENOSPC;
+	if (size > count)
 		goto unlock;
 
-	ret = size;
-
-	list_for_each_entry(sub, &leader->sibling_list, group_entry) {
-		n = 0;
+	ret = -ENOMEM;
+	values = kzalloc(size, GFP_KERNEL);
+	if (!values)
+		goto unlock;
 
-		values[n++] = perf_event_read_value(sub, &enabled, &running);
-		if (read_format & PERF_FORMAT_ID)
-			values[n++] = primary_event_id(sub);
+	values[0] = 1 + leader->nr_siblings;
 
-		size = n * sizeof(u64);
+	mutex_lock(&leader->child_mutex);
+	perf_event_read_group_add(leader, read_format, values);
+	list_for_each_entry(child, &leader->child_list, child_list)
+		perf_event_read_group_add(child, read_format, values);
+	mutex_unlock(&leader->child_mutex);
 
-		if (copy_to_user(buf + ret, values, size)) {
-			ret = -EFAULT;
-			goto unlock;
-		}
+	ret = size;
+	if (copy_to_user(buf, values, size))
+		ret = -EFAULT;
 
-		ret += size;
-	}
+	kfree(values);
 unlock:
 	mutex_unlock(&ctx->mutex);
 
@@ -3139,7 +3207,7 @@ perf_read_hw(struct perf_event *event, char __user *buf, size_t count)
 
 	WARN_ON_ONCE(event->ctx->parent_ctx);
 	if (read_format & PERF_FORMAT_GROUP)
-		ret = perf_event_read_group(event, read_format, buf);
+		ret = perf_event_read_group(event, read_format, buf, count);
 	else
 		ret = perf_event_read_one(event, read_format, buf);
 
@@ -3363,9 +3431,21 @@ static int perf_event_index(struct perf_event *event)
 	if (event->state != PERF_EVENT_STATE_ACTIVE)
 		return 0;
 
+	if (event->pmu->event_idx)
+		return event->pmu->event_idx(event);
+
 	return event->hw.idx + 1 - PERF_EVENT_INDEX_OFFSET;
 }
 
+/*
+ * Tells user space whether, and how, the counter of @event may be read
+ * directly: see the comment above perf_event_mmap_page::lock.
+ */
+void __weak arch_perf_update_userpage(struct perf_event *event,
+				      struct perf_event_mmap_page *userpg)
+{
+}
+
 /*
  * Callers need to ensure there can be no nesting of this function, otherwise
  * the seqlock logic goes bad. We can not serialize this because the arch
@@ -3401,6 +3481,8 @@ void perf_event_update_userpage(struct perf_event *event)
 	userpg->time_running = event->total_time_running +
 			atomic64_read(&event->child_total_time_running);
 
+	arch_perf_update_userpage(event, userpg);
+
 	barrier();
 	++userpg->lock;
 	preempt_enable();
@@ -5474,6 +5556,12 @@ static int perf_swevent_init(struct perf_event *event)
 	return 0;
 }
 
+/* software events have no counter to read from user space */
+static int perf_swevent_event_idx(struct perf_event *event)
+{
+	return 0;
+}
+
 static struct pmu perf_swevent = {
 	.task_ctx_nr	= perf_sw_context,
 
@@ -5483,6 +5571,8 @@ static struct pmu perf_swevent = {
 	.start		= perf_swevent_start,
 	.stop		= perf_swevent_stop,
 	.read		= perf_swevent_read,
+
+	.event_idx	= perf_swevent_event_idx,
 };
 
 #ifdef CONFIG_EVENT_TRACING
@@ -5569,6 +5659,8 @@ static struct pmu perf_tracepoint = {
 	.start		= perf_swevent_start,
 	.stop		= perf_swevent_stop,
 	.read		= perf_swevent_read,
+
+	.event_idx	= perf_swevent_event_idx,
 };
 
 static inline void perf_tp_register(void)
@@ -5788,6 +5880,8 @@ static struct pmu perf_cpu_clock = {
 	.start		= cpu_clock_event_start,
 	.stop		= cpu_clock_event_stop,
 	.read		= cpu_clock_event_read,
+
+	.event_idx	= perf_swevent_event_idx,
 };
 
 /*
@@ -5860,6 +5954,8 @@ static struct pmu perf_task_clock = {
 	.start		= task_clock_event_start,
 	.stop		= task_clock_event_stop,
 	.read		= task_clock_event_read,
+
+	.event_idx	= perf_swevent_event_idx,
 };
 
 static void perf_pmu_nop_void(struct pmu *pmu)
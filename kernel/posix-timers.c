@@ -51,7 +51,9 @@
 /*
  * Management arrays for POSIX timers.	 Timers are kept in slab memory
  * Timer ids are allocated by an external routine that keeps track of the
- * id and the timer.  The external interface is:
+ * id and the timer.  Every process has an idr of its own in its
+ * signal_struct, so the ids of one process do not contend with those of
+ * others.  The external interface is:
  *
  * void *idr_find(struct idr *idp, int id);           to find timer_id <id>
  * int idr_get_new(struct idr *idp, void *ptr);       to get a new id and
@@ -63,15 +65,16 @@
  * called under a spin lock.  Likewise idr_remore may release memory
  * (but it may be ok to do this under a lock...).
  * idr_find is just a memory look up and is quite fast.  A -1 return
- * indicates that the requested id does not exist.
+ * indicates that the requested id does not exist.  It is safe under
+ * rcu_read_lock(), so the look up takes no lock but the timer's own,
+ * and timers are freed only after a grace period.  The per process
+ * posix_timers_lock just serializes the allocation and removal of ids.
  */
 
 /*
  * Lets keep our timers in a slab cache :-)
  */
 static struct kmem_cache *posix_timers_cache;
-static struct idr posix_timers_id;
-static DEFINE_SPINLOCK(idr_lock);
 
 /*
  * we assume that the new SIGEV_THREAD_ID shares no bits with the other
@@ -95,9 +98,10 @@ static DEFINE_SPINLOCK(idr_lock);
  * The timer ID is turned into a timer address by idr_find().
  * Verifying a valid ID consists of:
  *
- * a) checking that idr_find() returns other than -1.
- * b) checking that the timer id matches the one in the timer itself.
- * c) that the timer owner is in the callers thread group.
+ * a) checking that idr_find() on the idr of the callers thread group
+ *    returns other than -1.
+ * b) that the timer owner is still the callers thread group, that is
+ *    the timer was not deleted after it was found.
  */
 
 /*
@@ -282,7 +286,6 @@ static __init int init_posix_timers(void)
 	posix_timers_cache = kmem_cache_create("posix_timers_cache",
 					sizeof (struct k_itimer), 0, SLAB_PANIC,
 					NULL);
-	idr_init(&posix_timers_id);
 	return 0;
 }
 
@@ -491,19 +494,32 @@ static struct k_itimer * alloc_posix_timer(void)
 	return tmr;
 }
 
+static void k_itimer_rcu_free(struct rcu_head *head)
+{
+	struct k_itimer *tmr = container_of(head, struct k_itimer, it_rcu);
+
+	kmem_cache_free(posix_timers_cache, tmr);
+}
+
 #define IT_ID_SET	1
 #define IT_ID_NOT_SET	0
+/*
+ * Timers are only created and deleted by the threads of the process
+ * owning them, so the id is always in the idr of current->signal.
+ */
 static void release_posix_timer(struct k_itimer *tmr, int it_id_set)
 {
 	if (it_id_set) {
-		unsigned long flags;
-		spin_lock_irqsave(&idr_lock, flags);
-		idr_remove(&posix_timers_id, tmr->it_id);
-		spin_unlock_irqrestore(&idr_lock, flags);
+		struct signal_struct *sig = current->signal;
+
+		spin_lock(&sig->posix_timers_lock);
+		idr_remove(&sig->posix_timers_id, tmr->it_id);
+		spin_unlock(&sig->posix_timers_lock);
 	}
 	put_pid(tmr->it_pid);
 	sigqueue_free(tmr->sigq);
-	kmem_cache_free(posix_timers_cache, tmr);
+	/* __lock_timer() may have found it and be about to take it_lock */
+	call_rcu(&tmr->it_rcu, k_itimer_rcu_free);
 }
 
 static struct k_clock *clockid_to_kclock(const clockid_t id)
@@ -531,6 +547,7 @@ SYSCALL_DEFINE3(timer_create, const clockid_t, which_clock,
 {
 	struct k_clock *kc = clockid_to_kclock(which_clock);
 	struct k_itimer *new_timer;
+	struct signal_struct *sig = current->signal;
 	int error, new_timer_id;
 	sigevent_t event;
 	int it_id_set = IT_ID_NOT_SET;
@@ -546,13 +563,13 @@ SYSCALL_DEFINE3(timer_create, const clockid_t, which_clock,
 
 	spin_lock_init(&new_timer->it_lock);
  retry:
-	if (unlikely(!idr_pre_get(&posix_timers_id, GFP_KERNEL))) {
+	if (unlikely(!idr_pre_get(&sig->posix_timers_id, GFP_KERNEL))) {
 		error = -EAGAIN;
 		goto out;
 	}
-	spin_lock_irq(&idr_lock);
-	error = idr_get_new(&posix_timers_id, new_timer, &new_timer_id);
-	spin_unlock_irq(&idr_lock);
+	spin_lock(&sig->posix_timers_lock);
+	error = idr_get_new(&sig->posix_timers_id, new_timer, &new_timer_id);
+	spin_unlock(&sig->posix_timers_lock);
 	if (error) {
 		if (error == -EAGAIN)
 			goto retry;
@@ -623,30 +640,27 @@ out:
 
 /*
  * Locking issues: We need to protect the result of the id look up until
- * we get the timer locked down so it is not deleted under us.  The
- * removal is done under the idr spinlock so we use that here to bridge
- * the find to the timer lock.  To avoid a dead lock, the timer id MUST
- * be release with out holding the timer lock.
+ * we get the timer locked down so it is not deleted under us.  Timers
+ * are freed after an RCU grace period, so rcu_read_lock() bridges the
+ * find to the timer lock.  A timer deleted meanwhile has its it_signal
+ * cleared under the timer lock, which is checked once we hold it.
  */
 static struct k_itimer *__lock_timer(timer_t timer_id, unsigned long *flags)
 {
+	struct signal_struct *sig = current->signal;
 	struct k_itimer *timr;
-	/*
-	 * Watch out here.  We do a irqsave on the idr_lock and pass the
-	 * flags part over to the timer lock.  Must not let interrupts in
-	 * while we are moving the lock.
-	 */
-	spin_lock_irqsave(&idr_lock, *flags);
-	timr = idr_find(&posix_timers_id, (int)timer_id);
+
+	rcu_read_lock();
+	timr = idr_find(&sig->posix_timers_id, (int)timer_id);
 	if (timr) {
-		spin_lock(&timr->it_lock);
-		if (timr->it_signal == current->signal) {
-			spin_unlock(&idr_lock);
+		spin_lock_irqsave(&timr->it_lock, *flags);
+		if (timr->it_signal == sig) {
+			rcu_read_unlock();
 			return timr;
 		}
-		spin_unlock(&timr->it_lock);
+		spin_unlock_irqrestore(&timr->it_lock, *flags);
 	}
-	spin_unlock_irqrestore(&idr_lock, *flags);
+	rcu_read_unlock();
 
 	return NULL;
 }
@@ -99,6 +99,8 @@ extern int min_free_order_shift;
 extern int pid_max_min, pid_max_max;
 extern int sysctl_drop_caches;
 extern int percpu_pagelist_fraction;
+extern int percpu_highorder_high;
+extern int percpu_highorder_batch;
 extern int compat_log;
 extern int latencytop_enabled;
 extern int sysctl_nr_open_min, sysctl_nr_open_max;
@@ -269,6 +271,7 @@ static int max_sched_tunable_scaling = SCHED_TUNABLESCALING_END-1;
 #ifdef CONFIG_COMPACTION
 static int min_extfrag_threshold;
 static int max_extfrag_threshold = 1000;
+static int max_compaction_order = MAX_ORDER - 1;
 #endif
 
 static struct ctl_table kern_table[] = {
@@ -1163,6 +1166,23 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "compaction_proactive_blocks",
+		.data		= &sysctl_compaction_proactive_blocks,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= sysctl_compaction_proactive_handler,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "compaction_proactive_order",
+		.data		= &sysctl_compaction_proactive_order,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= sysctl_compaction_proactive_handler,
+		.extra1		= &one,
+		.extra2		= &max_compaction_order,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1188,6 +1208,22 @@ static struct ctl_table vm_table[] = {
 		.proc_handler	= percpu_pagelist_fraction_sysctl_handler,
 		.extra1		= &min_percpu_pagelist_fract,
 	},
+	{
+		.procname	= "percpu_highorder_high",
+		.data		= &percpu_highorder_high,
+		.maxlen		= sizeof(percpu_highorder_high),
+		.mode		= 0644,
+		.proc_handler	= percpu_highorder_sysctl_handler,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "percpu_highorder_batch",
+		.data		= &percpu_highorder_batch,
+		.maxlen		= sizeof(percpu_highorder_batch),
+		.mode		= 0644,
+		.proc_handler	= percpu_highorder_sysctl_handler,
+		.extra1		= &zero,
+	},
 #ifdef CONFIG_MMU
 	{
 		.procname	= "max_map_count",
@@ -1197,6 +1233,17 @@ static struct ctl_table vm_table[] = {
 		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= &zero,
 	},
+#ifdef CONFIG_SHARE_PTE_ON_FORK
+	{
+		.procname	= "fork_share_ptes",
+		.data		= &sysctl_fork_share_ptes,
+		.maxlen		= sizeof(sysctl_fork_share_ptes),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #else
 	{
 		.procname	= "nr_trim_pages",
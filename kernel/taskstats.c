@@ -27,6 +27,7 @@
 #include <linux/cgroup.h>
 #include <linux/fs.h>
 #include <linux/file.h>
+#include <linux/pid_namespace.h>
 #include <net/genetlink.h>
 #include <asm/atomic.h>
 
@@ -570,6 +571,66 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * Dump the per-pid stats of every task, or of every thread of the
+ * process given by TASKSTATS_CMD_ATTR_TGID, one message per task.
+ * cb->args[0] holds the pid to resume from.
+ */
+static int taskstats_user_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct pid_namespace *ns = task_active_pid_ns(current);
+	struct nlattr *attrs[TASKSTATS_CMD_ATTR_MAX + 1];
+	struct task_struct *tsk;
+	struct taskstats *stats;
+	struct pid *pid;
+	void *reply;
+	pid_t tgid = 0;
+	int nr = cb->args[0];
+	int rc;
+
+	rc = nlmsg_parse(cb->nlh, GENL_HDRLEN + family.hdrsize, attrs,
+			 TASKSTATS_CMD_ATTR_MAX, taskstats_cmd_get_policy);
+	if (rc < 0)
+		return rc;
+	if (attrs[TASKSTATS_CMD_ATTR_TGID])
+		tgid = nla_get_u32(attrs[TASKSTATS_CMD_ATTR_TGID]);
+
+	for (;; nr++) {
+		rcu_read_lock();
+		pid = find_ge_pid(nr, ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr_ns(pid, ns);
+		tsk = pid_task(pid, PIDTYPE_PID);
+		if (!tsk || (tgid && task_tgid_nr_ns(tsk, ns) != tgid)) {
+			rcu_read_unlock();
+			continue;
+		}
+		get_task_struct(tsk);
+		rcu_read_unlock();
+
+		reply = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				    cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				    TASKSTATS_CMD_NEW);
+		stats = reply ? mk_reply(skb, TASKSTATS_TYPE_PID, nr) : NULL;
+		if (!stats) {
+			/* out of room, continue with this task next time */
+			if (reply)
+				genlmsg_cancel(skb, reply);
+			put_task_struct(tsk);
+			break;
+		}
+		fill_stats(tsk, stats);
+		put_task_struct(tsk);
+		genlmsg_end(skb, reply);
+	}
+
+	cb->args[0] = nr;
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -656,6 +717,7 @@ err:
 static struct genl_ops taskstats_ops = {
 	.cmd		= TASKSTATS_CMD_GET,
 	.doit		= taskstats_user_cmd,
+	.dumpit		= taskstats_user_dump,
 	.policy		= taskstats_cmd_get_policy,
 };
 
@@ -3675,11 +3675,50 @@ static int tracing_buffers_open(struct inode *inode, struct file *filp)
 	return nonseekable_open(inode, filp);
 }
 
+/*
+ * Sleep until the number of entries in the buffer of @info's cpu is no
+ * longer @entries, or a signal comes in.  The wakeups come from
+ * trace_wake_up(), which not all tracers call, so like poll_wait_pipe()
+ * look again every 100 msecs anyway.
+ */
+static void tracing_buffers_wait(struct ftrace_buffer_info *info,
+				 unsigned long entries)
+{
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait(&trace_wait, &wait, TASK_INTERRUPTIBLE);
+
+	if (ring_buffer_entries_cpu(info->tr->buffer, info->cpu) == entries)
+		schedule_timeout(HZ / 10);
+
+	finish_wait(&trace_wait, &wait);
+}
+
+static unsigned int
+tracing_buffers_poll(struct file *filp, poll_table *poll_table)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+
+	poll_wait(filp, &trace_wait, poll_table);
+
+	if (!ring_buffer_empty_cpu(info->tr->buffer, info->cpu))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+/*
+ * Reads block until there is data, unless the file is O_NONBLOCK.  A
+ * read may return a page the writer is still on, copied out of the
+ * buffer; splice only ever moves whole pages.  A read too short for
+ * the page header and the next event fails with -EINVAL.
+ */
 static ssize_t
 tracing_buffers_read(struct file *filp, char __user *ubuf,
 		     size_t count, loff_t *ppos)
 {
 	struct ftrace_buffer_info *info = filp->private_data;
+	unsigned long entries;
 	ssize_t ret;
 	size_t size;
 
@@ -3695,16 +3734,34 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	if (info->read < PAGE_SIZE)
 		goto read;
 
-	info->read = 0;
-
+ again:
 	trace_access_lock(info->cpu);
+	entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 	ret = ring_buffer_read_page(info->tr->buffer,
 				    &info->spare,
 				    count,
 				    info->cpu, 0);
 	trace_access_unlock(info->cpu);
-	if (ret < 0)
-		return 0;
+	if (ret < 0) {
+		/*
+		 * A whole page always fits, so with data there a shorter
+		 * read could not hold the page header or the next event:
+		 * waiting would not help.
+		 */
+		if (count < PAGE_SIZE &&
+		    !ring_buffer_empty_cpu(info->tr->buffer, info->cpu))
+			return -EINVAL;
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		tracing_buffers_wait(info, entries);
+		if (signal_pending(current))
+			return -EINTR;
+		goto again;
+	}
+
+	info->read = 0;
 
 read:
 	size = PAGE_SIZE - info->read;
@@ -3831,6 +3888,7 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		len &= PAGE_MASK;
 	}
 
+ again:
 	trace_access_lock(info->cpu);
 	entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 
@@ -3884,12 +3942,18 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 
 	/* did we read anything? */
 	if (!spd.nr_pages) {
-		if (flags & SPLICE_F_NONBLOCK)
+		if ((file->f_flags & O_NONBLOCK) || (flags & SPLICE_F_NONBLOCK)) {
 			ret = -EAGAIN;
-		else
-			ret = 0;
-		/* TODO: block */
-		goto out;
+			goto out;
+		}
+
+		/* wait for the writer to fill up and leave its page */
+		tracing_buffers_wait(info, entries);
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			goto out;
+		}
+		goto again;
 	}
 
 	ret = splice_to_pipe(pipe, &spd);
@@ -3901,6 +3965,7 @@ out:
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
+	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
 	.llseek		= no_llseek,
@@ -3930,6 +3995,9 @@ tracing_stats_read(struct file *filp, char __user *ubuf,
 	cnt = ring_buffer_commit_overrun_cpu(tr->buffer, cpu);
 	trace_seq_printf(s, "commit overrun: %ld\n", cnt);
 
+	cnt = ring_buffer_read_events_cpu(tr->buffer, cpu);
+	trace_seq_printf(s, "read events: %ld\n", cnt);
+
 	count = simple_read_from_buffer(ubuf, count, ppos, s->buffer, s->len);
 
 	kfree(s);
@@ -665,7 +665,7 @@ struct event_filter {
 	int			n_preds;	/* Number assigned */
 	int			a_preds;	/* allocated */
 	struct filter_pred	*preds;
-	struct filter_pred	*root;
+	struct prog_entry	*prog;		/* compiled preds */
 	char			*filter_string;
 };
 
@@ -679,18 +679,18 @@ struct event_subsystem {
 
 #define FILTER_PRED_INVALID	((unsigned short)-1)
 #define FILTER_PRED_IS_RIGHT	(1 << 15)
-#define FILTER_PRED_FOLD	(1 << 15)
 
 /*
  * The max preds is the size of unsigned short with
- * two flags at the MSBs. One bit is used for both the IS_RIGHT
- * and FOLD flags. The other is reserved.
+ * two flags at the MSBs. One bit is used for the IS_RIGHT
+ * flag. The other is reserved.
  *
  * 2^14 preds is way more than enough.
  */
 #define MAX_FILTER_PRED		16384
 
 struct filter_pred;
+struct prog_entry;
 struct regex;
 
 typedef int (*filter_pred_fn_t) (struct filter_pred *pred, void *event);
@@ -715,16 +715,7 @@ struct filter_pred {
 	filter_pred_fn_t 	fn;
 	u64 			val;
 	struct regex		regex;
-	/*
-	 * Leaf nodes use field_name, ops is used by AND and OR
-	 * nodes. The field_name is always freed when freeing a pred.
-	 * We can overload field_name for ops and have it freed
-	 * as well.
-	 */
-	union {
-		char		*field_name;
-		unsigned short	*ops;
-	};
+	char			*field_name;
 	int 			offset;
 	int 			not;
 	int 			op;
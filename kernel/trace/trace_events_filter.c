@@ -128,32 +128,54 @@ struct pred_stack {
 	int			index;
 };
 
+/*
+ * A filter is compiled into a program made of its leaf predicates, in
+ * the order they appear in the filter string.  They are tested in turn:
+ * if one returns when_to_branch, the program goes on at target, else at
+ * the next entry.  Two entries without a predicate end the program;
+ * their target is the result, 1 for a match and 0 otherwise.
+ *
+ * The ANDs and ORs only show up in the targets, so matching an event is
+ * a short walk along an array, instead of the tree.
+ */
+struct prog_entry {
+	filter_pred_fn_t	fn;
+	struct filter_pred	*pred;
+	int			when_to_branch;
+	int			target;
+};
+
+/*
+ * One function per comparison and field type, so that the op doesn't
+ * have to be looked at for every event.
+ */
 #define DEFINE_COMPARISON_PRED(type)					\
-static int filter_pred_##type(struct filter_pred *pred, void *event)	\
+static int filter_pred_LT_##type(struct filter_pred *pred, void *event)	\
 {									\
 	type *addr = (type *)(event + pred->offset);			\
-	type val = (type)pred->val;					\
-	int match = 0;							\
-									\
-	switch (pred->op) {						\
-	case OP_LT:							\
-		match = (*addr < val);					\
-		break;							\
-	case OP_LE:							\
-		match = (*addr <= val);					\
-		break;							\
-	case OP_GT:							\
-		match = (*addr > val);					\
-		break;							\
-	case OP_GE:							\
-		match = (*addr >= val);					\
-		break;							\
-	default:							\
-		break;							\
-	}								\
-									\
-	return match;							\
-}
+	return *addr < (type)pred->val;					\
+}									\
+static int filter_pred_LE_##type(struct filter_pred *pred, void *event)	\
+{									\
+	type *addr = (type *)(event + pred->offset);			\
+	return *addr <= (type)pred->val;				\
+}									\
+static int filter_pred_GT_##type(struct filter_pred *pred, void *event)	\
+{									\
+	type *addr = (type *)(event + pred->offset);			\
+	return *addr > (type)pred->val;					\
+}									\
+static int filter_pred_GE_##type(struct filter_pred *pred, void *event)	\
+{									\
+	type *addr = (type *)(event + pred->offset);			\
+	return *addr >= (type)pred->val;				\
+}									\
+static const filter_pred_fn_t pred_funcs_##type[] = {			\
+	filter_pred_LT_##type,						\
+	filter_pred_LE_##type,						\
+	filter_pred_GT_##type,						\
+	filter_pred_GE_##type,						\
+};
 
 #define DEFINE_EQUALITY_PRED(size)					\
 static int filter_pred_##size(struct filter_pred *pred, void *event)	\
@@ -381,128 +403,29 @@ get_pred_parent(struct filter_pred *pred, struct filter_pred *preds,
 	return pred;
 }
 
-/*
- * A series of AND or ORs where found together. Instead of
- * climbing up and down the tree branches, an array of the
- * ops were made in order of checks. We can just move across
- * the array and short circuit if needed.
- */
-static int process_ops(struct filter_pred *preds,
-		       struct filter_pred *op, void *rec)
-{
-	struct filter_pred *pred;
-	int match = 0;
-	int type;
-	int i;
-
-	/*
-	 * Micro-optimization: We set type to true if op
-	 * is an OR and false otherwise (AND). Then we
-	 * just need to test if the match is equal to
-	 * the type, and if it is, we can short circuit the
-	 * rest of the checks:
-	 *
-	 * if ((match && op->op == OP_OR) ||
-	 *     (!match && op->op == OP_AND))
-	 *	  return match;
-	 */
-	type = op->op == OP_OR;
-
-	for (i = 0; i < op->val; i++) {
-		pred = &preds[op->ops[i]];
-		match = pred->fn(pred, rec);
-		if (!!match == type)
-			return match;
-	}
-	return match;
-}
-
 /* return 1 if event matches, 0 otherwise (discard) */
 int filter_match_preds(struct event_filter *filter, void *rec)
 {
-	int match = -1;
-	enum move_type move = MOVE_DOWN;
-	struct filter_pred *preds;
-	struct filter_pred *pred;
-	struct filter_pred *root;
-	int n_preds;
-	int done = 0;
+	struct prog_entry *prog;
+	int i = 0;
 
 	/* no filter is considered a match */
 	if (!filter)
 		return 1;
 
-	n_preds = filter->n_preds;
-
-	if (!n_preds)
+	/* the program is protected with preemption disabled */
+	prog = rcu_dereference_sched(filter->prog);
+	if (!prog)
 		return 1;
 
-	/*
-	 * n_preds, root and filter->preds are protect with preemption disabled.
-	 */
-	preds = rcu_dereference_sched(filter->preds);
-	root = rcu_dereference_sched(filter->root);
-	if (!root)
-		return 1;
-
-	pred = root;
-
-	/* match is currently meaningless */
-	match = -1;
-
-	do {
-		switch (move) {
-		case MOVE_DOWN:
-			/* only AND and OR have children */
-			if (pred->left != FILTER_PRED_INVALID) {
-				/* If ops is set, then it was folded. */
-				if (!pred->ops) {
-					/* keep going to down the left side */
-					pred = &preds[pred->left];
-					continue;
-				}
-				/* We can treat folded ops as a leaf node */
-				match = process_ops(preds, pred, rec);
-			} else
-				match = pred->fn(pred, rec);
-			/* If this pred is the only pred */
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		case MOVE_UP_FROM_LEFT:
-			/*
-			 * Check for short circuits.
-			 *
-			 * Optimization: !!match == (pred->op == OP_OR)
-			 *   is the same as:
-			 * if ((match && pred->op == OP_OR) ||
-			 *     (!match && pred->op == OP_AND))
-			 */
-			if (!!match == (pred->op == OP_OR)) {
-				if (pred == root)
-					break;
-				pred = get_pred_parent(pred, preds,
-						       pred->parent, &move);
-				continue;
-			}
-			/* now go down the right side of the tree. */
-			pred = &preds[pred->right];
-			move = MOVE_DOWN;
-			continue;
-		case MOVE_UP_FROM_RIGHT:
-			/* We finished this equation. */
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		}
-		done = 1;
-	} while (!done);
+	while (prog[i].pred) {
+		if (!!prog[i].fn(prog[i].pred, rec) == prog[i].when_to_branch)
+			i = prog[i].target;
+		else
+			i++;
+	}
 
-	return match;
+	return prog[i].target;
 }
 EXPORT_SYMBOL_GPL(filter_match_preds);
 
@@ -710,22 +633,10 @@ static int filter_set_pred(struct event_filter *filter,
 		left = __pop_pred_stack(stack);
 		if (!left || !right)
 			return -EINVAL;
-		/*
-		 * If both children can be folded
-		 * and they are the same op as this op or a leaf,
-		 * then this op can be folded.
-		 */
-		if (left->index & FILTER_PRED_FOLD &&
-		    (left->op == dest->op ||
-		     left->left == FILTER_PRED_INVALID) &&
-		    right->index & FILTER_PRED_FOLD &&
-		    (right->op == dest->op ||
-		     right->left == FILTER_PRED_INVALID))
-			dest->index |= FILTER_PRED_FOLD;
-
-		dest->left = left->index & ~FILTER_PRED_FOLD;
-		dest->right = right->index & ~FILTER_PRED_FOLD;
-		left->parent = dest->index & ~FILTER_PRED_FOLD;
+
+		dest->left = left->index;
+		dest->right = right->index;
+		left->parent = dest->index;
 		right->parent = dest->index | FILTER_PRED_IS_RIGHT;
 	} else {
 		/*
@@ -733,9 +644,6 @@ static int filter_set_pred(struct event_filter *filter,
 		 * way to know this is a leaf node.
 		 */
 		dest->left = FILTER_PRED_INVALID;
-
-		/* All leafs allow folding the parent ops. */
-		dest->index |= FILTER_PRED_FOLD;
 	}
 
 	return __push_pred_stack(stack, dest);
@@ -745,6 +653,9 @@ static void __free_preds(struct event_filter *filter)
 {
 	int i;
 
+	kfree(filter->prog);
+	filter->prog = NULL;
+
 	if (filter->preds) {
 		for (i = 0; i < filter->a_preds; i++)
 			kfree(filter->preds[i].field_name);
@@ -898,39 +809,51 @@ static filter_pred_fn_t select_comparison_fn(int op, int field_size,
 					     int field_is_signed)
 {
 	filter_pred_fn_t fn = NULL;
+	int pred_func_index = -1;
+
+	switch (op) {
+	case OP_EQ:
+	case OP_NE:
+		break;
+	default:
+		if (WARN_ON_ONCE(op < OP_LT || op > OP_GE))
+			return NULL;
+		pred_func_index = op - OP_LT;
+		break;
+	}
 
 	switch (field_size) {
 	case 8:
-		if (op == OP_EQ || op == OP_NE)
+		if (pred_func_index < 0)
 			fn = filter_pred_64;
 		else if (field_is_signed)
-			fn = filter_pred_s64;
+			fn = pred_funcs_s64[pred_func_index];
 		else
-			fn = filter_pred_u64;
+			fn = pred_funcs_u64[pred_func_index];
 		break;
 	case 4:
-		if (op == OP_EQ || op == OP_NE)
+		if (pred_func_index < 0)
 			fn = filter_pred_32;
 		else if (field_is_signed)
-			fn = filter_pred_s32;
+			fn = pred_funcs_s32[pred_func_index];
 		else
-			fn = filter_pred_u32;
+			fn = pred_funcs_u32[pred_func_index];
 		break;
 	case 2:
-		if (op == OP_EQ || op == OP_NE)
+		if (pred_func_index < 0)
 			fn = filter_pred_16;
 		else if (field_is_signed)
-			fn = filter_pred_s16;
+			fn = pred_funcs_s16[pred_func_index];
 		else
-			fn = filter_pred_u16;
+			fn = pred_funcs_u16[pred_func_index];
 		break;
 	case 1:
-		if (op == OP_EQ || op == OP_NE)
+		if (pred_func_index < 0)
 			fn = filter_pred_8;
 		else if (field_is_signed)
-			fn = filter_pred_s8;
+			fn = pred_funcs_s8[pred_func_index];
 		else
-			fn = filter_pred_u8;
+			fn = pred_funcs_u8[pred_func_index];
 		break;
 	}
 
@@ -1437,156 +1360,103 @@ static int check_pred_tree(struct event_filter *filter,
 	return 0;
 }
 
-static int count_leafs(struct filter_pred *preds, struct filter_pred *root)
+/* Where the program goes on after @pred returned @match */
+static int leaf_target(struct filter_pred *preds, struct filter_pred *root,
+		       struct filter_pred *pred, int match, int *prog_idx,
+		       int n_leaves)
 {
-	struct filter_pred *pred;
-	enum move_type move = MOVE_DOWN;
-	int count = 0;
-	int done = 0;
+	struct filter_pred *parent;
+	enum move_type move;
 
-	pred = root;
-
-	do {
-		switch (move) {
-		case MOVE_DOWN:
-			if (pred->left != FILTER_PRED_INVALID) {
+	while (pred != root) {
+		parent = get_pred_parent(pred, preds, pred->parent, &move);
+		/*
+		 * The right side of an AND is only tested if the left side
+		 * matched, and that of an OR only if it didn't.  Otherwise
+		 * the match is the result of the parent too.
+		 */
+		if (move == MOVE_UP_FROM_LEFT &&
+		    match == (parent->op == OP_AND)) {
+			pred = &preds[parent->right];
+			while (pred->left != FILTER_PRED_INVALID)
 				pred = &preds[pred->left];
-				continue;
-			}
-			/* A leaf at the root is just a leaf in the tree */
-			if (pred == root)
-				return 1;
-			count++;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		case MOVE_UP_FROM_LEFT:
-			pred = &preds[pred->right];
-			move = MOVE_DOWN;
-			continue;
-		case MOVE_UP_FROM_RIGHT:
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
+			return prog_idx[pred - preds];
 		}
-		done = 1;
-	} while (!done);
+		pred = parent;
+	}
 
-	return count;
+	/* the whole filter is decided */
+	return match ? n_leaves : n_leaves + 1;
 }
 
-static int fold_pred(struct filter_pred *preds, struct filter_pred *root)
-{
-	struct filter_pred *pred;
-	enum move_type move = MOVE_DOWN;
-	int count = 0;
-	int children;
-	int done = 0;
-
-	/* No need to keep the fold flag */
-	root->index &= ~FILTER_PRED_FOLD;
-
-	/* If the root is a leaf then do nothing */
-	if (root->left == FILTER_PRED_INVALID)
-		return 0;
+/*
+ * Turns the predicate tree into a program, see struct prog_entry.  The
+ * leafs are laid out left to right, so one of the two ways on from a
+ * leaf is always the next entry, and the other one the branch.
+ */
+static int compile_pred_tree(struct event_filter *filter,
+			     struct filter_pred *root)
+{
+	struct filter_pred *preds = filter->preds;
+	struct prog_entry *prog;
+	int *prog_idx;
+	int n_leaves = 0;
+	int i, next, on_match, on_miss;
+	int err = -EINVAL;
+
+	prog_idx = kcalloc(filter->n_preds, sizeof(*prog_idx), GFP_KERNEL);
+	if (!prog_idx)
+		return -ENOMEM;
 
-	/* count the children */
-	children = count_leafs(preds, &preds[root->left]);
-	children += count_leafs(preds, &preds[root->right]);
+	/*
+	 * Leafs are pushed on the predicate stack in the order of the
+	 * filter string, so the array has them left to right already.
+	 */
+	for (i = 0; i < filter->n_preds; i++)
+		if (preds[i].left == FILTER_PRED_INVALID)
+			prog_idx[i] = n_leaves++;
 
-	root->ops = kzalloc(sizeof(*root->ops) * children, GFP_KERNEL);
-	if (!root->ops)
+	prog = kcalloc(n_leaves + 2, sizeof(*prog), GFP_KERNEL);
+	if (!prog) {
+		kfree(prog_idx);
 		return -ENOMEM;
+	}
 
-	root->val = children;
-
-	pred = root;
-	do {
-		switch (move) {
-		case MOVE_DOWN:
-			if (pred->left != FILTER_PRED_INVALID) {
-				pred = &preds[pred->left];
-				continue;
-			}
-			if (WARN_ON(count == children))
-				return -EINVAL;
-			pred->index &= ~FILTER_PRED_FOLD;
-			root->ops[count++] = pred->index;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
+	for (i = 0; i < filter->n_preds; i++) {
+		if (preds[i].left != FILTER_PRED_INVALID)
 			continue;
-		case MOVE_UP_FROM_LEFT:
-			pred = &preds[pred->right];
-			move = MOVE_DOWN;
-			continue;
-		case MOVE_UP_FROM_RIGHT:
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		}
-		done = 1;
-	} while (!done);
-
-	return 0;
-}
 
-/*
- * To optimize the processing of the ops, if we have several "ors" or
- * "ands" together, we can put them in an array and process them all
- * together speeding up the filter logic.
- */
-static int fold_pred_tree(struct event_filter *filter,
-			   struct filter_pred *root)
-{
-	struct filter_pred *preds;
-	struct filter_pred *pred;
-	enum move_type move = MOVE_DOWN;
-	int done = 0;
-	int err;
-
-	preds = filter->preds;
-	if  (!preds)
-		return -EINVAL;
-	pred = root;
+		next = prog_idx[i] + 1;
+		on_match = leaf_target(preds, root, &preds[i], 1, prog_idx,
+				       n_leaves);
+		on_miss = leaf_target(preds, root, &preds[i], 0, prog_idx,
+				      n_leaves);
+
+		prog[prog_idx[i]].fn = preds[i].fn;
+		prog[prog_idx[i]].pred = &preds[i];
+		if (on_match == next) {
+			prog[prog_idx[i]].when_to_branch = 0;
+			prog[prog_idx[i]].target = on_miss;
+		} else if (!WARN_ON(on_miss != next)) {
+			prog[prog_idx[i]].when_to_branch = 1;
+			prog[prog_idx[i]].target = on_match;
+		} else
+			goto out;
+	}
 
-	do {
-		switch (move) {
-		case MOVE_DOWN:
-			if (pred->index & FILTER_PRED_FOLD) {
-				err = fold_pred(preds, pred);
-				if (err)
-					return err;
-				/* Folded nodes are like leafs */
-			} else if (pred->left != FILTER_PRED_INVALID) {
-				pred = &preds[pred->left];
-				continue;
-			}
+	prog[n_leaves].target = 1;
+	prog[n_leaves + 1].target = 0;
 
-			/* A leaf at the root is just a leaf in the tree */
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		case MOVE_UP_FROM_LEFT:
-			pred = &preds[pred->right];
-			move = MOVE_DOWN;
-			continue;
-		case MOVE_UP_FROM_RIGHT:
-			if (pred == root)
-				break;
-			pred = get_pred_parent(pred, preds,
-					       pred->parent, &move);
-			continue;
-		}
-		done = 1;
-	} while (!done);
+	/* We don't set the program until we know it works */
+	barrier();
+	filter->prog = prog;
+	prog = NULL;
+	err = 0;
+out:
+	kfree(prog);
+	kfree(prog_idx);
 
-	return 0;
+	return err;
 }
 
 static int replace_preds(struct ftrace_event_call *call,
@@ -1679,21 +1549,15 @@ add_pred:
 		pred = __pop_pred_stack(&stack);
 		if (WARN_ON(pred)) {
 			err = -EINVAL;
-			filter->root = NULL;
 			goto fail;
 		}
 		err = check_pred_tree(filter, root);
 		if (err)
 			goto fail;
 
-		/* Optimize the tree */
-		err = fold_pred_tree(filter, root);
+		err = compile_pred_tree(filter, root);
 		if (err)
 			goto fail;
-
-		/* We don't set root until we know it works */
-		barrier();
-		filter->root = root;
 	}
 
 	err = 0;
@@ -23,6 +23,20 @@
 #include <linux/jiffies.h>
 #include <linux/mm.h>
 
+static const char task_state_chars[] = TASK_STATE_TO_CHAR_STR;
+
+static char task_state_char(struct task_struct *tsk)
+{
+	unsigned int state = (tsk->state & TASK_REPORT) | tsk->exit_state;
+	const char *p = task_state_chars;
+
+	while (state) {
+		p++;
+		state >>= 1;
+	}
+	return *p;
+}
+
 /*
  * fill in basic accounting fields
  */
@@ -30,6 +44,7 @@ void bacct_add_tsk(struct taskstats *stats, struct task_struct *tsk)
 {
 	const struct cred *tcred;
 	struct timespec uptime, ts;
+	struct mm_struct *mm;
 	u64 ac_etime;
 
 	BUILD_BUG_ON(TS_COMM_LEN < TASK_COMM_LEN);
@@ -71,6 +86,15 @@ void bacct_add_tsk(struct taskstats *stats, struct task_struct *tsk)
 	stats->ac_majflt = tsk->maj_flt;
 
 	strncpy(stats->ac_comm, tsk->comm, sizeof(stats->ac_comm));
+
+	stats->sum_exec_runtime = tsk->se.sum_exec_runtime;
+	stats->ac_cpu	 = task_cpu(tsk);
+	stats->ac_state	 = task_state_char(tsk);
+	mm = get_task_mm(tsk);
+	if (mm) {
+		stats->rss = get_mm_rss(mm) * (PAGE_SIZE / 1024);
+		mmput(mm);
+	}
 }
 
 
@@ -50,6 +50,10 @@
  * b. Error locator polynomial computation using Berlekamp-Massey algorithm
  * c. Error locator root finding (by far the most expensive step)
  *
+ * Syndromes are computed from the ecc remainder 8 bits at a time, using one
+ * 256-entry log lookup table per odd syndrome, and step b works on the log
+ * representation of syndromes, so that each term costs a single lookup.
+ *
  * In this implementation, step c is not performed using the usual Chien search.
  * Instead, an alternative approach described in [1] is used. It consists in
  * factoring the error locator polynomial using the Berlekamp Trace algorithm
@@ -337,10 +341,13 @@ static inline int a_ilog(struct bch_control *bch, unsigned int x)
 static void compute_syndromes(struct bch_control *bch, uint32_t *ecc,
 			      unsigned int *syn)
 {
-	int i, j, s;
-	unsigned int m;
-	uint32_t poly;
+	int i, j, s, l;
+	unsigned int m, e, step, v;
 	const int t = GF_T(bch);
+	const unsigned int n = GF_N(bch);
+	const int nbytes = 4*BCH_ECC_WORDS(bch);
+	const int16_t *tab;
+	uint8_t b[nbytes];
 
 	s = bch->ecc_bits;
 
@@ -348,20 +355,31 @@ static void compute_syndromes(struct bch_control *bch, uint32_t *ecc,
 	m = ((unsigned int)s) & 31;
 	if (m)
 		ecc[s/32] &= ~((1u << (32-m))-1);
-	memset(syn, 0, 2*t*sizeof(*syn));
-
-	/* compute v(a^j) for j=1 .. 2t-1 */
-	do {
-		poly = *ecc++;
-		s -= 32;
-		while (poly) {
-			i = deg(poly);
-			for (j = 0; j < 2*t; j += 2)
-				syn[j] ^= a_pow(bch, (j+1)*(i+s));
-
-			poly ^= (1 << i);
+
+	/* split ecc into bytes, lowest degree terms first */
+	for (i = 0; i < nbytes; i++)
+		b[i] = ecc[(nbytes-1-i)/4] >> (8*(i & 3));
+
+	/*
+	 * compute v(a^j) for j=1 .. 2t-1, 8 bits at a time: a byte p(X) of
+	 * degree 8k+s..8k+s+7 contributes a^(j(8k+s)).p(a^j), and syn_tab
+	 * gives the log of p(a^j) for all 256 values of p
+	 */
+	s -= 8*nbytes;
+	for (j = 0; j < t; j++) {
+		tab = bch->syn_tab+256*j;
+		/* s may be negative, lowest terms of last ecc word are zero */
+		e = modulo(bch, (2*j+1)*(s+n));
+		step = modulo(bch, 8*(2*j+1));
+		v = 0;
+		for (i = 0; i < nbytes; i++) {
+			l = tab[b[i]];
+			if (l >= 0)
+				v ^= bch->a_pow_tab[mod_s(bch, e+l)];
+			e = mod_s(bch, e+step);
 		}
-	} while (s > 0);
+		syn[2*j] = v;
+	}
 
 	/* v(a^(2j)) = v(a^j)^2 */
 	for (j = 0; j < t; j++)
@@ -378,47 +396,63 @@ static int compute_error_locator_polynomial(struct bch_control *bch,
 {
 	const unsigned int t = GF_T(bch);
 	const unsigned int n = GF_N(bch);
-	unsigned int i, j, tmp, l, pd = 1, d = syn[0];
+	unsigned int i, j, tmp, pdeg = 0, d = syn[0];
 	struct gf_poly *elp = bch->elp;
-	struct gf_poly *pelp = bch->poly_2t[0];
-	struct gf_poly *elp_copy = bch->poly_2t[1];
-	int k, pp = -1;
+	int k, l, pp = -1, pd = 0;
+	int *slog = bch->cache;
+	int *plog = slog+2*t, *plog_next = plog+t+1, *swap;
 
-	memset(pelp, 0, GF_POLY_SZ(2*t));
 	memset(elp, 0, GF_POLY_SZ(2*t));
 
-	pelp->deg = 0;
-	pelp->c[0] = 1;
 	elp->deg = 0;
 	elp->c[0] = 1;
 
+	/*
+	 * keep syndromes and e[p](X) in log representation, so that each term
+	 * below costs a single table lookup; 0 values are represented with -1
+	 */
+	for (j = 0; j < 2*t; j++)
+		slog[j] = syn[j] ? a_log(bch, syn[j]) : -1;
+	plog[0] = 0;
+
 	/* use simplified binary Berlekamp-Massey algorithm */
 	for (i = 0; (i < t) && (elp->deg <= t); i++) {
 		if (d) {
 			k = 2*i-pp;
-			gf_poly_copy(elp_copy, elp);
+			/* compute l[i+1] = max(l[i]->c[l[p]+2*(i-p]) */
+			tmp = pdeg+k;
+			/* if l grows, e[i] becomes the next e[p] */
+			if (tmp > elp->deg) {
+				for (j = 0; j <= elp->deg; j++)
+					plog_next[j] = elp->c[j] ?
+						a_log(bch, elp->c[j]) : -1;
+			}
 			/* e[i+1](X) = e[i](X)+di*dp^-1*X^2(i-p)*e[p](X) */
-			tmp = a_log(bch, d)+n-a_log(bch, pd);
-			for (j = 0; j <= pelp->deg; j++) {
-				if (pelp->c[j]) {
-					l = a_log(bch, pelp->c[j]);
-					elp->c[j+k] ^= a_pow(bch, tmp+l);
-				}
+			l = mod_s(bch, a_log(bch, d)+n-pd);
+			for (j = 0; j <= pdeg; j++) {
+				if (plog[j] >= 0)
+					elp->c[j+k] ^= bch->a_pow_tab[mod_s(bch,
+								l+plog[j])];
 			}
-			/* compute l[i+1] = max(l[i]->c[l[p]+2*(i-p]) */
-			tmp = pelp->deg+k;
 			if (tmp > elp->deg) {
+				pdeg = elp->deg;
 				elp->deg = tmp;
-				gf_poly_copy(pelp, elp_copy);
-				pd = d;
+				swap = plog;
+				plog = plog_next;
+				plog_next = swap;
+				pd = a_log(bch, d);
 				pp = 2*i;
 			}
 		}
 		/* di+1 = S(2i+3)+elp[i+1].1*S(2i+2)+...+elp[i+1].lS(2i+3-l) */
 		if (i < t-1) {
 			d = syn[2*i+2];
-			for (j = 1; j <= elp->deg; j++)
-				d ^= gf_mul(bch, elp->c[j], syn[2*i+2-j]);
+			for (j = 1; j <= elp->deg; j++) {
+				l = slog[2*i+2-j];
+				if (elp->c[j] && (l >= 0))
+					d ^= bch->a_pow_tab[mod_s(bch,
+						a_log(bch, elp->c[j])+l)];
+			}
 		}
 	}
 	dbg("elp=%s\n", gf_poly_str(elp));
@@ -1107,6 +1141,27 @@ static void build_mod8_tables(struct bch_control *bch, const uint32_t *g)
 	}
 }
 
+/*
+ * compute log tables of p(a^j) for all bytes p(X) and odd j, for syndromes
+ */
+static void build_syn_tables(struct bch_control *bch)
+{
+	int i, j, k;
+	unsigned int v;
+	int16_t *tab = bch->syn_tab;
+
+	for (j = 0; j < GF_T(bch); j++, tab += 256) {
+		for (i = 0; i < 256; i++) {
+			for (k = 0, v = 0; k < 8; k++) {
+				if (i & (1 << k))
+					v ^= a_pow(bch, (2*j+1)*k);
+			}
+			/* represent 0 values with -1 */
+			tab[i] = v ? a_log(bch, v) : -1;
+		}
+	}
+}
+
 /*
  * build a base for factoring degree 2 polynomials
  */
@@ -1299,11 +1354,12 @@ struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	bch->a_pow_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_pow_tab), &err);
 	bch->a_log_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_log_tab), &err);
 	bch->mod8_tab  = bch_alloc(words*1024*sizeof(*bch->mod8_tab), &err);
+	bch->syn_tab   = bch_alloc(t*256*sizeof(*bch->syn_tab), &err);
 	bch->ecc_buf   = bch_alloc(words*sizeof(*bch->ecc_buf), &err);
 	bch->ecc_buf2  = bch_alloc(words*sizeof(*bch->ecc_buf2), &err);
 	bch->xi_tab    = bch_alloc(m*sizeof(*bch->xi_tab), &err);
 	bch->syn       = bch_alloc(2*t*sizeof(*bch->syn), &err);
-	bch->cache     = bch_alloc(2*t*sizeof(*bch->cache), &err);
+	bch->cache     = bch_alloc((4*t+2)*sizeof(*bch->cache), &err);
 	bch->elp       = bch_alloc((t+1)*sizeof(struct gf_poly_deg1), &err);
 
 	for (i = 0; i < ARRAY_SIZE(bch->poly_2t); i++)
@@ -1324,6 +1380,8 @@ struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	build_mod8_tables(bch, genpoly);
 	kfree(genpoly);
 
+	build_syn_tables(bch);
+
 	err = build_deg2_base(bch);
 	if (err)
 		goto fail;
@@ -1348,6 +1406,7 @@ void free_bch(struct bch_control *bch)
 		kfree(bch->a_pow_tab);
 		kfree(bch->a_log_tab);
 		kfree(bch->mod8_tab);
+		kfree(bch->syn_tab);
 		kfree(bch->ecc_buf);
 		kfree(bch->ecc_buf2);
 		kfree(bch->xi_tab);
@@ -0,0 +1,82 @@
+/*
+ * ChaCha20 256-bit cipher algorithm, RFC7539
+ *
+ * Only the block function is provided here; it is used by the random
+ * number generator to expand a key into a keystream.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/cryptohash.h>
+#include <asm/unaligned.h>
+
+#define QUARTERROUND(a, b, c, d)				\
+	do {							\
+		x[a] += x[b]; x[d] = rol32(x[d] ^ x[a], 16);	\
+		x[c] += x[d]; x[b] = rol32(x[b] ^ x[c], 12);	\
+		x[a] += x[b]; x[d] = rol32(x[d] ^ x[a], 8);	\
+		x[c] += x[d]; x[b] = rol32(x[b] ^ x[c], 7);	\
+	} while (0)
+
+/**
+ * chacha20_block - generate one block of ChaCha20 keystream
+ * @state: 16 word cipher state: constants, key, block counter and nonce
+ * @stream: output buffer for CHACHA20_BLOCK_SIZE bytes, need not be aligned
+ *
+ * The block counter in @state[12] is advanced by one.
+ */
+void chacha20_block(__u32 *state, void *stream)
+{
+	__u32 x[16];
+	__u8 *out = stream;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		x[i] = state[i];
+
+	for (i = 0; i < 20; i += 2) {
+		QUARTERROUND(0, 4,  8, 12);
+		QUARTERROUND(1, 5,  9, 13);
+		QUARTERROUND(2, 6, 10, 14);
+		QUARTERROUND(3, 7, 11, 15);
+
+		QUARTERROUND(0, 5, 10, 15);
+		QUARTERROUND(1, 6, 11, 12);
+		QUARTERROUND(2, 7,  8, 13);
+		QUARTERROUND(3, 4,  9, 14);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		put_unaligned_le32(x[i] + state[i], out + i * sizeof(__u32));
+
+	state[12]++;
+}
+EXPORT_SYMBOL(chacha20_block);
+
+/**
+ * chacha20_init_state - set up a ChaCha20 state from a key
+ * @state: 16 word cipher state to initialise
+ * @key: CHACHA20_KEY_SIZE bytes of key, as host-order words
+ *
+ * The block counter and nonce are cleared.
+ */
+void chacha20_init_state(__u32 *state, const __u32 *key)
+{
+	int i;
+
+	state[0] = 0x61707865;		/* "expand 32-byte k" */
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (i = 0; i < CHACHA20_KEY_SIZE / sizeof(__u32); i++)
+		state[4 + i] = key[i];
+	for (i = 12; i < 16; i++)
+		state[i] = 0;
+}
+EXPORT_SYMBOL(chacha20_init_state);
@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ktime.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -42,6 +45,9 @@ struct compact_control {
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
+
+	/* kcompactd: free blocks of @order wanted, 0 for other compactors */
+	unsigned long nr_blocks;
 };
 
 static unsigned long release_freepages(struct list_head *freelist)
@@ -429,6 +435,20 @@ static void update_nr_listpages(struct compact_control *cc)
 	cc->nr_freepages = nr_freepages;
 }
 
+/*
+ * Number of free blocks of at least @order in @zone, counted in blocks of
+ * @order.  Unlocked, so only good enough for heuristics.
+ */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr += zone->free_area[o].nr_free << (o - order);
+	return nr;
+}
+
 static int compact_finished(struct zone *zone,
 			    struct compact_control *cc)
 {
@@ -438,6 +458,9 @@ static int compact_finished(struct zone *zone,
 	if (fatal_signal_pending(current))
 		return COMPACT_PARTIAL;
 
+	if (cc->nr_blocks && kthread_should_stop())
+		return COMPACT_PARTIAL;
+
 	/* Compaction run completes if the migrate and free scanner meet */
 	if (cc->free_pfn <= cc->migrate_pfn)
 		return COMPACT_COMPLETE;
@@ -456,6 +479,20 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/*
+	 * kcompactd: stop as soon as there are enough free blocks.  Pages
+	 * freed by migration sit on this cpu's lists until drained, and
+	 * cannot merge into bigger blocks before that.
+	 */
+	if (cc->nr_blocks) {
+		preempt_disable();
+		drain_local_pages(NULL);
+		preempt_enable();
+		if (zone_free_blocks(zone, cc->order) >= cc->nr_blocks)
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -520,9 +557,13 @@ unsigned long compaction_suitable(struct zone *zone, int order)
 
 static int compact_zone(struct zone *zone, struct compact_control *cc)
 {
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = start_pfn + zone->spanned_pages;
 	int ret;
 
-	ret = compaction_suitable(zone, cc->order);
+	/* kcompactd has already checked whether the zone is worth it */
+	ret = cc->nr_blocks ? COMPACT_CONTINUE :
+			      compaction_suitable(zone, cc->order);
 	switch (ret) {
 	case COMPACT_PARTIAL:
 	case COMPACT_SKIPPED:
@@ -534,9 +575,16 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	}
 
 	/* Setup to move all movable pages to the end of the zone */
-	cc->migrate_pfn = zone->zone_start_pfn;
-	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
-	cc->free_pfn &= ~(pageblock_nr_pages-1);
+	cc->migrate_pfn = start_pfn;
+	cc->free_pfn = end_pfn & ~(pageblock_nr_pages-1);
+
+	/* kcompactd picks up where it left off, if the zone did not change */
+	if (cc->nr_blocks && zone->compact_cached_migrate_pfn >= start_pfn &&
+	    zone->compact_cached_migrate_pfn < zone->compact_cached_free_pfn &&
+	    zone->compact_cached_free_pfn <= cc->free_pfn) {
+		cc->migrate_pfn = zone->compact_cached_migrate_pfn;
+		cc->free_pfn = zone->compact_cached_free_pfn;
+	}
 
 	migrate_prep_local();
 
@@ -581,6 +629,16 @@ out:
 	cc->nr_freepages -= release_freepages(&cc->freepages);
 	VM_BUG_ON(cc->nr_freepages != 0);
 
+	if (cc->nr_blocks) {
+		if (ret == COMPACT_COMPLETE) {
+			zone->compact_cached_migrate_pfn = 0;
+			zone->compact_cached_free_pfn = 0;
+		} else {
+			zone->compact_cached_migrate_pfn = cc->migrate_pfn;
+			zone->compact_cached_free_pfn = cc->free_pfn;
+		}
+	}
+
 	return ret;
 }
 
@@ -604,6 +662,23 @@ unsigned long compact_zone_order(struct zone *zone,
 
 int sysctl_extfrag_threshold = 500;
 
+/* Account a direct compaction stall in the latency histogram */
+static void count_compact_stall(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	if (us < 100)
+		count_vm_event(COMPACTSTALL_100US);
+	else if (us < 1000)
+		count_vm_event(COMPACTSTALL_1MS);
+	else if (us < 10000)
+		count_vm_event(COMPACTSTALL_10MS);
+	else if (us < 100000)
+		count_vm_event(COMPACTSTALL_100MS);
+	else
+		count_vm_event(COMPACTSTALL_SLOW);
+}
+
 /**
  * try_to_compact_pages - Direct compact to satisfy a high-order allocation
  * @zonelist: The zonelist used for the current allocation
@@ -624,6 +699,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	int rc = COMPACT_SKIPPED;
+	ktime_t start;
 
 	/*
 	 * Check whether it is worth even starting compaction. The order check is
@@ -634,6 +710,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	start = ktime_get();
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -648,6 +725,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	count_compact_stall(start);
 	return rc;
 }
 
@@ -722,6 +800,194 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd compacts the zones of its node in the background, so that
+ * high-order allocations find free blocks without stalling in direct
+ * compaction.  It is woken by kswapd when reclaim could not produce the
+ * order an allocation asked for, and, if compaction_proactive_blocks is
+ * set, checks every KCOMPACTD_INTERVAL that each zone has that many free
+ * blocks of compaction_proactive_order.  Compaction is asynchronous and
+ * stops as soon as the target is met; the next run resumes the scanners
+ * where the last one stopped.
+ */
+int sysctl_compaction_proactive_blocks;
+int sysctl_compaction_proactive_order = PAGE_ALLOC_COSTLY_ORDER;
+
+#define KCOMPACTD_INTERVAL	(HZ / 2)
+
+/*
+ * Returns true if @zone has fewer than @nr_blocks free blocks of @order
+ * and compaction, rather than reclaim, is the way to get more.
+ */
+static bool kcompactd_zone_needs(struct zone *zone, int order,
+				 unsigned long nr_blocks)
+{
+	if (!populated_zone(zone))
+		return false;
+	if (zone_free_blocks(zone, order) >= nr_blocks)
+		return false;
+	/* COMPACT_PARTIAL: there is a block, but we want more than one */
+	return compaction_suitable(zone, order) != COMPACT_SKIPPED;
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int order = pgdat->kcompactd_max_order;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+	unsigned long nr_blocks = 1;
+	bool proactive = false;
+	int zoneid;
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	if (order) {
+		count_vm_event(KCOMPACTD_WAKE);
+	} else {
+		if (!sysctl_compaction_proactive_blocks)
+			return;
+		order = sysctl_compaction_proactive_order;
+		nr_blocks = sysctl_compaction_proactive_blocks;
+		classzone_idx = pgdat->nr_zones - 1;
+		proactive = true;
+	}
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.zone = zone,
+			.sync = false,
+			.nr_blocks = nr_blocks,
+		};
+
+		if (!kcompactd_zone_needs(zone, order, nr_blocks))
+			continue;
+		if (proactive)
+			count_vm_event(KCOMPACTD_PROACTIVE);
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (kthread_should_stop())
+			return;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		long timeout = sysctl_compaction_proactive_blocks ?
+				KCOMPACTD_INTERVAL : MAX_SCHEDULE_TIMEOUT;
+
+		/* the sysctl handler wakes us when proactive mode is enabled */
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				pgdat->kcompactd_max_order ||
+				(timeout == MAX_SCHEDULE_TIMEOUT &&
+				 sysctl_compaction_proactive_blocks) ||
+				kthread_should_stop(), timeout);
+		if (kthread_should_stop())
+			break;
+
+		kcompactd_do_work(pgdat);
+	}
+	return 0;
+}
+
+/*
+ * Called by kswapd when it could not reclaim its way to an order-@order
+ * block in the zones up to @classzone_idx.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order,
+		      enum zone_type classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Started at boot and when a node gets memory hot-added.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+int sysctl_compaction_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int nid, ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!write || ret < 0)
+		return ret;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		if (pgdat->kcompactd)
+			wake_up_interruptible(&pgdat->kcompactd_wait);
+	}
+	return 0;
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
@@ -1847,7 +1847,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	pmd = pmd_offset(pud, address);
 	/* pmd can't go away or become huge under us */
-	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd) ||
+	    pte_table_shared(*pmd))
 		goto out;
 
 	anon_vma_lock(vma->anon_vma);
@@ -1954,7 +1955,8 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 
 	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd) ||
+	    pte_table_shared(*pmd))
 		goto out;
 
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
@@ -67,6 +67,10 @@ static long madvise_behavior(struct vm_area_struct * vma,
 		break;
 	case MADV_MERGEABLE:
 	case MADV_UNMERGEABLE:
+		/* ksmd replaces ptes in place */
+		error = unshare_pte_range(vma, start, end, 0);
+		if (error)
+			goto out;
 		error = ksm_madvise(vma, start, end, behavior, &new_flags);
 		if (error)
 			goto out;
@@ -172,6 +176,9 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 	if (vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP))
 		return -EINVAL;
 
+	if (unshare_pte_range(vma, start, end, 1))
+		return -ENOMEM;
+
 	if (unlikely(vma->vm_flags & VM_NONLINEAR)) {
 		struct zap_details details = {
 			.nonlinear_vma = vma,
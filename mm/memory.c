@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/slab.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -789,6 +790,431 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_SHARE_PTE_ON_FORK
+int sysctl_fork_share_ptes __read_mostly;
+
+/*
+ * A shared pte table that an mm switched away from while holding mmap_sem
+ * only for read.  Other threads may still be looking at the old table, so
+ * the mm keeps its share of it until release_retired_ptes() is called
+ * with mmap_sem held for write.
+ */
+struct retired_pte {
+	struct list_head list;
+	pmd_t pmdval;
+};
+
+static inline int vma_shares_ptes(struct vm_area_struct *vma)
+{
+	return sysctl_fork_share_ptes && !vma->vm_file &&
+		is_cow_mapping(vma->vm_flags) &&
+		!(vma->vm_flags & (VM_LOCKED | VM_HUGETLB | VM_NONLINEAR |
+				   VM_PFNMAP | VM_MIXEDMAP | VM_INSERTPAGE |
+				   VM_MERGEABLE));
+}
+
+/*
+ * Drop one share of a pte table.  Returns 1 if other mms still use the
+ * table, 0 if the caller is its only user.
+ */
+static int pte_table_put(struct page *table)
+{
+	int count = atomic_read(&table->_mapcount);
+
+	for (;;) {
+		int old;
+
+		if (count < 0)
+			return 0;
+		old = atomic_cmpxchg(&table->_mapcount, count, count - 1);
+		if (likely(old == count))
+			return 1;
+		count = old;
+	}
+}
+
+/*
+ * Let the child use the parent's pte table for the PMD_SIZE range at
+ * @addr instead of copying it.  All the pages are write protected first,
+ * so that the first write from either side faults and unshares the table.
+ * Tables holding anything but pages and swap entries are copied as usual.
+ */
+static int share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr)
+{
+	pmd_t pmdval = *src_pmd;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+	int rss[NR_MM_COUNTERS];
+	int i;
+
+	init_rss_vec(rss);
+	orig_pte = pte = pte_offset_map_lock(src_mm, &pmdval, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		pte_t entry = *pte;
+		struct page *page;
+
+		if (pte_none(entry))
+			continue;
+		if (!pte_present(entry)) {
+			if (pte_file(entry) ||
+			    non_swap_entry(pte_to_swp_entry(entry)))
+				break;
+			rss[MM_SWAPENTS]++;
+			continue;
+		}
+		if (pte_write(entry))
+			ptep_set_wrprotect(src_mm, addr, pte);
+		page = vm_normal_page(vma, addr, entry);
+		if (page)
+			rss[PageAnon(page) ? MM_ANONPAGES : MM_FILEPAGES]++;
+	}
+	if (i == PTRS_PER_PTE)
+		atomic_inc(&pmd_page(pmdval)->_mapcount);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(orig_pte, ptl);
+	if (i < PTRS_PER_PTE)
+		return -EAGAIN;
+
+	/* make sure dst_mm is on swapoff's mmlist. */
+	if (rss[MM_SWAPENTS] && unlikely(list_empty(&dst_mm->mmlist))) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	add_mm_rss_vec(dst_mm, rss);
+
+	spin_lock(&dst_mm->page_table_lock);
+	dst_mm->nr_ptes++;
+	pmd_populate(dst_mm, dst_pmd, pmd_pgtable(pmdval));
+	spin_unlock(&dst_mm->page_table_lock);
+	return 0;
+}
+
+/*
+ * Free a pte table nobody maps any more, together with the references it
+ * holds on pages and swap entries.  Only anonymous memory is ever mapped
+ * through shared tables, so there is no dirty state to transfer.
+ */
+static void free_pte_table(struct mm_struct *mm, pmd_t pmdval)
+{
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+	int i;
+
+	orig_pte = pte = pte_offset_map_lock(mm, &pmdval, 0, &ptl);
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++) {
+		pte_t entry = *pte;
+		struct page *page;
+
+		if (pte_none(entry))
+			continue;
+		if (!pte_present(entry)) {
+			free_swap_and_cache(pte_to_swp_entry(entry));
+			continue;
+		}
+		if (is_zero_pfn(pte_pfn(entry)))
+			continue;
+		page = pte_page(entry);
+		page_remove_rmap(page);
+		free_page_and_swap_cache(page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	pte_free(mm, pmd_pgtable(pmdval));
+}
+
+/*
+ * Stop using the shared pte table at @pmd, covering the PMD_SIZE range at
+ * @addr.  With mmap_sem held for write the table is dropped right away;
+ * otherwise @rp is used to retire it.  Returns -EAGAIN if the pmd changed
+ * under us.
+ */
+static int detach_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			    unsigned long addr, struct retired_pte *rp)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = addr;
+	pmd_t pmdval = *pmd;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+	int rss[NR_MM_COUNTERS];
+	int i;
+
+	if (!pte_table_shared(pmdval))
+		return -EAGAIN;
+
+	init_rss_vec(rss);
+	orig_pte = pte = pte_offset_map_lock(mm, &pmdval, addr, &ptl);
+	if (unlikely(pmd_val(*pmd) != pmd_val(pmdval))) {
+		pte_unmap_unlock(orig_pte, ptl);
+		return -EAGAIN;
+	}
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		pte_t entry = *pte;
+		struct page *page;
+
+		if (pte_none(entry))
+			continue;
+		if (!pte_present(entry)) {
+			rss[MM_SWAPENTS]--;
+			continue;
+		}
+		page = vm_normal_page(vma, addr, entry);
+		if (page)
+			rss[PageAnon(page) ? MM_ANONPAGES : MM_FILEPAGES]--;
+	}
+
+	if (ptl != &mm->page_table_lock)
+		spin_lock(&mm->page_table_lock);
+	pmd_clear(pmd);
+	mm->nr_ptes--;
+	if (rp) {
+		rp->pmdval = pmdval;
+		list_add(&rp->list, &mm->retired_ptes);
+	}
+	if (ptl != &mm->page_table_lock)
+		spin_unlock(&mm->page_table_lock);
+	pte_unmap_unlock(orig_pte, ptl);
+	add_mm_rss_vec(mm, rss);
+
+	/* our TLB must not reach the pages once another mm may free them */
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	if (!rp && !pte_table_put(pmd_page(pmdval)))
+		free_pte_table(mm, pmdval);
+	return 0;
+}
+
+/*
+ * Give the mm of @vma a private copy of the shared pte table @pmdval that
+ * @pmd pointed to, for the PMD_SIZE range around @address.  The old table
+ * is retired, as other threads may still be walking it.
+ */
+int __unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			pmd_t pmdval, unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = address & PMD_MASK;
+	unsigned long addr;
+	struct retired_pte *rp;
+	pgtable_t new;
+	pte_t *src_pte, *dst_pte;
+	spinlock_t *src_ptl, *dst_ptl;
+	swp_entry_t entry;
+	int i, j, ret = 0;
+
+	rp = kmalloc(sizeof(*rp), GFP_KERNEL);
+	if (!rp)
+		return -ENOMEM;
+	new = pte_alloc_one(mm, start);
+	if (!new) {
+		kfree(rp);
+		return -ENOMEM;
+	}
+	smp_wmb(); /* See comment in __pte_alloc */
+
+again:
+	src_pte = pte_offset_map_lock(mm, &pmdval, start, &src_ptl);
+	/* Has somebody else unshared or dropped it already? */
+	if (pmd_val(*pmd) != pmd_val(pmdval))
+		goto out_unlock;
+
+	/*
+	 * Take the swap references first, as that may have to sleep:
+	 * the shared table cannot change while we hold our share.
+	 */
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		pte_t pte = src_pte[i];
+
+		if (pte_none(pte) || pte_present(pte))
+			continue;
+		entry = pte_to_swp_entry(pte);
+		if (swap_duplicate(entry) < 0)
+			break;
+	}
+	if (unlikely(i < PTRS_PER_PTE)) {
+		for (j = 0; j < i; j++) {
+			pte_t pte = src_pte[j];
+
+			if (!pte_none(pte) && !pte_present(pte))
+				swap_free(pte_to_swp_entry(pte));
+		}
+		pte_unmap_unlock(src_pte, src_ptl);
+		if (add_swap_count_continuation(entry, GFP_KERNEL) < 0) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		goto again;
+	}
+
+	dst_ptl = pgtable_lockptr(mm, new);
+	if (dst_ptl != src_ptl)
+		spin_lock_nested(dst_ptl, SINGLE_DEPTH_NESTING);
+	if (src_ptl != &mm->page_table_lock)
+		spin_lock(&mm->page_table_lock);
+	pmd_populate(mm, pmd, new);
+	rp->pmdval = pmdval;
+	list_add(&rp->list, &mm->retired_ptes);
+	if (src_ptl != &mm->page_table_lock)
+		spin_unlock(&mm->page_table_lock);
+	new = NULL;
+	rp = NULL;
+
+	/*
+	 * Faults on the new table wait for dst_ptl, and recheck the pte
+	 * once they get it, so filling it in after it went live is fine.
+	 */
+	dst_pte = pte_offset_map(pmd, start);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0, addr = start; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE) {
+		pte_t pte = src_pte[i];
+
+		if (pte_none(pte))
+			continue;
+		if (pte_present(pte)) {
+			struct page *page = vm_normal_page(vma, addr, pte);
+
+			if (page) {
+				get_page(page);
+				page_dup_rmap(page);
+			}
+		}
+		set_pte_at(mm, addr, dst_pte + i, pte);
+	}
+	arch_leave_lazy_mmu_mode();
+	if (dst_ptl != src_ptl)
+		spin_unlock(dst_ptl);
+	pte_unmap(dst_pte);
+	pte_unmap_unlock(src_pte, src_ptl);
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	return 0;
+
+out_unlock:
+	pte_unmap_unlock(src_pte, src_ptl);
+out:
+	if (new)
+		pte_free(mm, new);
+	kfree(rp);
+	return ret;
+}
+
+/*
+ * Make sure none of the pte tables covering [start, end) of @vma is
+ * shared any more.  When @detach is set, tables lying completely inside
+ * the range are dropped rather than copied: the caller is about to zap
+ * them anyway.
+ */
+int unshare_pte_range(struct vm_area_struct *vma, unsigned long start,
+		      unsigned long end, int detach)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr, next;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int err;
+
+	/* tables are only ever shared for private anonymous memory */
+	if (vma->vm_file || !vma->anon_vma)
+		return 0;
+
+	for (addr = start; addr != end; addr = next) {
+		next = (addr + PMD_SIZE) & PMD_MASK;
+		if (next - 1 >= end - 1)
+			next = end;
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		while (pte_table_shared(*pmd)) {
+			if (detach && !(addr & ~PMD_MASK) &&
+			    next - addr == PMD_SIZE) {
+				struct retired_pte *rp;
+
+				rp = kmalloc(sizeof(*rp), GFP_KERNEL);
+				if (!rp)
+					return -ENOMEM;
+				err = detach_pte_table(vma, pmd, addr, rp);
+				if (err)
+					kfree(rp);
+			} else {
+				err = unshare_pte_table(vma, pmd, addr);
+				if (err)
+					return err;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Let go of the shared pte tables retired by unshare_pte_table() and
+ * unshare_pte_range().  Must be called with mmap_sem held for write, or
+ * once the mm has no users left, so that nobody can still be walking
+ * one of them.
+ */
+void release_retired_ptes(struct mm_struct *mm)
+{
+	struct retired_pte *rp, *next;
+	LIST_HEAD(list);
+
+	if (list_empty(&mm->retired_ptes))
+		return;
+
+	spin_lock(&mm->page_table_lock);
+	list_splice_init(&mm->retired_ptes, &list);
+	spin_unlock(&mm->page_table_lock);
+
+	/* nothing may reach them through our TLB once the others free pages */
+	flush_tlb_mm(mm);
+	list_for_each_entry_safe(rp, next, &list, list) {
+		if (!pte_table_put(pmd_page(rp->pmdval)))
+			free_pte_table(mm, rp->pmdval);
+		kfree(rp);
+	}
+}
+
+/*
+ * Called by zap_pmd_range() under mmap_sem held for write, or at exit,
+ * when it meets a shared pte table.  Partly unmapped tables have already
+ * been unshared by unshare_pte_range(), except at exit where everything
+ * goes.  Returns 1 if the table was dealt with.
+ */
+static int zap_shared_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	if (WARN_ON_ONCE(!tlb->fullmm &&
+			 ((addr & ~PMD_MASK) || end - addr != PMD_SIZE)))
+		return 1;
+	return !detach_pte_table(vma, pmd, addr & PMD_MASK, NULL);
+}
+#else
+static inline int vma_shares_ptes(struct vm_area_struct *vma)
+{
+	return 0;
+}
+
+static inline int share_pte_table(struct mm_struct *dst_mm,
+		struct mm_struct *src_mm, pmd_t *dst_pmd, pmd_t *src_pmd,
+		struct vm_area_struct *vma, unsigned long addr)
+{
+	return -EAGAIN;
+}
+
+static inline int zap_shared_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	return 0;
+}
+#endif /* CONFIG_SHARE_PTE_ON_FORK */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -815,6 +1241,10 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (next - addr == PMD_SIZE && vma_shares_ptes(vma) &&
+		    !share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd,
+				     vma, addr))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -919,6 +1349,7 @@ static unsigned long zap_pte_range(struct mmu_gather *tlb,
 	init_rss_vec(rss);
 
 	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -1029,6 +1460,11 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 			(*zap_work)--;
 			continue;
 		}
+		if (unlikely(pte_table_shared(*pmd)) &&
+		    zap_shared_pte_table(tlb, vma, pmd, addr, next)) {
+			(*zap_work)--;
+			continue;
+		}
 		next = zap_pte_range(tlb, vma, pmd, addr, next,
 						zap_work, details);
 	} while (pmd++, addr = next, (addr != end && *zap_work > 0));
@@ -2755,9 +3191,9 @@ int vmtruncate_range(struct inode *inode, loff_t offset, loff_t end)
 	mutex_lock(&inode->i_mutex);
 	down_write(&inode->i_alloc_sem);
 	unmap_mapping_range(mapping, offset, (end - offset), 1);
-	truncate_inode_pages_range(mapping, offset, end);
-	unmap_mapping_range(mapping, offset, (end - offset), 1);
 	inode->i_op->truncate_range(inode, offset, end);
+	/* unmap again to remove racily COWed private pages */
+	unmap_mapping_range(mapping, offset, (end - offset), 1);
 	up_write(&inode->i_alloc_sem);
 	mutex_unlock(&inode->i_mutex);
 
@@ -3398,6 +3834,14 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* if an huge pmd materialized from under us just retry later */
 	if (unlikely(pmd_trans_huge(*pmd)))
 		return 0;
+	/* a pte table still shared with a forked mm must be copied first */
+	if (unlikely(pte_table_shared(*pmd))) {
+		if (unshare_pte_table(vma, pmd, address))
+			return VM_FAULT_OOM;
+		/* a racing MADV_DONTNEED may have dropped it instead */
+		if (unlikely(pmd_none(*pmd)))
+			return 0;
+	}
 	/*
 	 * A regular pmd is established and it can't morph into a huge pmd
 	 * from under us anymore at this point because we hold the mmap_sem
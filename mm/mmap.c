@@ -1930,6 +1930,7 @@ static void unmap_region(struct mm_struct *mm,
 	free_pgtables(tlb, vma, prev? prev->vm_end: FIRST_USER_ADDRESS,
 				 next? next->vm_start: 0);
 	tlb_finish_mmu(tlb, start, end);
+	release_retired_ptes(mm);
 }
 
 /*
@@ -2114,6 +2115,17 @@ int do_munmap(struct mm_struct *mm, unsigned long start, size_t len)
 	}
 	vma = prev? prev->vm_next: mm->mmap;
 
+	/*
+	 * Drop or copy pte tables still shared with a forked mm, so that
+	 * unmapping never has to touch another mm's ptes.
+	 */
+	for (last = vma; last && last->vm_start < end; last = last->vm_next) {
+		int error = unshare_pte_range(last, last->vm_start,
+					      last->vm_end, 1);
+		if (error)
+			return error;
+	}
+
 	/*
 	 * unlock any mlock()ed ranges before detaching vmas
 	 */
@@ -2289,6 +2301,7 @@ void exit_mmap(struct mm_struct *mm)
 	}
 
 	arch_exit_mmap(mm);
+	release_retired_ptes(mm);
 
 	vma = mm->mmap;
 	if (!vma)	/* Can happen if dup_mmap() received an OOM */
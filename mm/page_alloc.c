@@ -94,6 +94,8 @@ EXPORT_SYMBOL(node_states);
 unsigned long totalram_pages __read_mostly;
 unsigned long totalreserve_pages __read_mostly;
 int percpu_pagelist_fraction;
+int percpu_highorder_high;
+int percpu_highorder_batch;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
 #ifdef CONFIG_PM_SLEEP
@@ -646,6 +648,106 @@ static void free_one_page(struct zone *zone, struct page *page, int order,
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Limits of the per-cpu lists of order-@order blocks.  A list that could
+ * not hold at least two blocks is not worth keeping: 0 disables it.
+ */
+static inline int pcp_ho_high(struct per_cpu_pages *pcp, unsigned int order)
+{
+	int high = pcp->ho_high >> order;
+
+	return high > 1 ? high : 0;
+}
+
+static inline int pcp_ho_batch(struct per_cpu_pages *pcp, unsigned int order)
+{
+	return max(1, pcp->ho_batch >> order);
+}
+
+/*
+ * Return @count order-@order blocks from the per-cpu lists to the buddy
+ * allocator, oldest first.
+ */
+static void free_pcp_highorder_bulk(struct zone *zone,
+			struct per_cpu_pages *pcp, unsigned int order, int count)
+{
+	struct list_head *lists = pcp->ho_lists[order - 1];
+	int migratetype = 0;
+	int to_free = count;
+
+	spin_lock(&zone->lock);
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+
+	while (to_free) {
+		struct page *page;
+
+		while (list_empty(&lists[migratetype]))
+			migratetype++;
+
+		page = list_entry(lists[migratetype].prev, struct page, lru);
+		list_del(&page->lru);
+		/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
+		__free_one_page(page, zone, order, page_private(page));
+		trace_mm_page_pcpu_drain(page, order, page_private(page));
+		to_free--;
+	}
+	pcp->ho_count[order - 1] -= count;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, count << order);
+	spin_unlock(&zone->lock);
+	__count_vm_events(PCP_HIGHORDER_DRAIN, count);
+}
+
+/*
+ * Return up to @count blocks of each order from the per-cpu high-order
+ * lists to the buddy allocator.
+ */
+static void drain_pcp_highorder(struct zone *zone, struct per_cpu_pages *pcp,
+				int count)
+{
+	unsigned int order;
+
+	for (order = 1; order <= PAGE_ALLOC_COSTLY_ORDER; order++) {
+		int nr = min(count, pcp->ho_count[order - 1]);
+
+		if (nr)
+			free_pcp_highorder_bulk(zone, pcp, order, nr);
+	}
+}
+
+/*
+ * Put an order-1..PAGE_ALLOC_COSTLY_ORDER block on this CPU's lists,
+ * handing a batch back to the buddy allocator once there are too many.
+ * Returns 0 if the block must go to the buddy allocator directly.
+ *
+ * Must be called with interrupts disabled.
+ */
+static int free_pcp_highorder(struct page *page, unsigned int order,
+			      int migratetype)
+{
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pages *pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	int high = pcp_ho_high(pcp, order);
+
+	if (!high)
+		return 0;
+
+	/* See free_hot_cold_page() */
+	set_page_private(page, migratetype);
+	if (migratetype >= MIGRATE_PCPTYPES) {
+		if (unlikely(migratetype == MIGRATE_ISOLATE))
+			return 0;
+		migratetype = MIGRATE_MOVABLE;
+	}
+
+	list_add(&page->lru, &pcp->ho_lists[order - 1][migratetype]);
+	__count_vm_event(PCP_HIGHORDER_FREE);
+	if (++pcp->ho_count[order - 1] >= high)
+		free_pcp_highorder_bulk(zone, pcp, order,
+			min(pcp_ho_batch(pcp, order), pcp->ho_count[order - 1]));
+	return 1;
+}
+
 static bool free_pages_prepare(struct page *page, unsigned int order)
 {
 	int i;
@@ -675,17 +777,20 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
+	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
 	if (!free_pages_prepare(page, order))
 		return;
 
+	migratetype = get_pageblock_migratetype(page);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, order,
-					get_pageblock_migratetype(page));
+	if (order > PAGE_ALLOC_COSTLY_ORDER ||
+	    !free_pcp_highorder(page, order, migratetype))
+		free_one_page(page_zone(page), page, order, migratetype);
 	local_irq_restore(flags);
 }
 
@@ -1069,8 +1174,11 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->batch;
 	else
 		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
+	if (to_drain) {
+		free_pcppages_bulk(zone, to_drain, pcp);
+		pcp->count -= to_drain;
+	}
+	drain_pcp_highorder(zone, pcp, INT_MAX);
 	local_irq_restore(flags);
 }
 #endif
@@ -1099,6 +1207,7 @@ static void drain_pages(unsigned int cpu)
 			free_pcppages_bulk(zone, pcp->count, pcp);
 			pcp->count = 0;
 		}
+		drain_pcp_highorder(zone, pcp, INT_MAX);
 		local_irq_restore(flags);
 	}
 }
@@ -1280,6 +1389,44 @@ int split_free_page(struct page *page)
 	return 1 << order;
 }
 
+/*
+ * Take an order-1..PAGE_ALLOC_COSTLY_ORDER block off this CPU's lists,
+ * refilling them from the buddy allocator a batch at a time.  Returns
+ * NULL if the lists are disabled or no block could be found.
+ *
+ * Must be called with interrupts disabled.
+ */
+static struct page *rmqueue_pcp_highorder(struct zone *zone,
+			unsigned int order, int migratetype, int cold)
+{
+	struct per_cpu_pages *pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	struct list_head *list;
+	struct page *page;
+
+	if (!pcp_ho_high(pcp, order))
+		return NULL;
+
+	list = &pcp->ho_lists[order - 1][migratetype];
+	if (list_empty(list)) {
+		pcp->ho_count[order - 1] += rmqueue_bulk(zone, order,
+					pcp_ho_batch(pcp, order), list,
+					migratetype, cold);
+		if (unlikely(list_empty(list)))
+			return NULL;
+		__count_vm_event(PCP_HIGHORDER_REFILL);
+	} else
+		__count_vm_event(PCP_HIGHORDER_HIT);
+
+	if (cold)
+		page = list_entry(list->prev, struct page, lru);
+	else
+		page = list_entry(list->next, struct page, lru);
+
+	list_del(&page->lru);
+	pcp->ho_count[order - 1]--;
+	return page;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1331,12 +1478,20 @@ again:
 			 */
 			WARN_ON_ONCE(order > 1);
 		}
-		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue(zone, order, migratetype);
-		spin_unlock(&zone->lock);
-		if (!page)
-			goto failed;
-		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
+		local_irq_save(flags);
+		page = NULL;
+		if (order <= PAGE_ALLOC_COSTLY_ORDER)
+			page = rmqueue_pcp_highorder(zone, order,
+						     migratetype, cold);
+		if (!page) {
+			spin_lock(&zone->lock);
+			page = __rmqueue(zone, order, migratetype);
+			spin_unlock(&zone->lock);
+			if (!page)
+				goto failed;
+			__mod_zone_page_state(zone, NR_FREE_PAGES,
+					      -(1 << order));
+		}
 	}
 
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
@@ -3523,10 +3678,25 @@ static int zone_batchsize(struct zone *zone)
 #endif
 }
 
+/*
+ * setup_pageset_highorder() sets the limits of the high-order lists from
+ * the percpu_highorder_* sysctls, or from the zone's batch size if unset.
+ */
+static void setup_pageset_highorder(struct per_cpu_pageset *p,
+				    unsigned long batch)
+{
+	struct per_cpu_pages *pcp = &p->pcp;
+
+	pcp->ho_high = percpu_highorder_high ? : 2 * batch;
+	pcp->ho_batch = percpu_highorder_batch ? : batch;
+	if (pcp->ho_batch > pcp->ho_high / 2)
+		pcp->ho_batch = pcp->ho_high / 2;
+}
+
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int migratetype, order;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3536,6 +3706,14 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->batch = max(1UL, 1 * batch);
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+
+	for (order = 0; order < PAGE_ALLOC_COSTLY_ORDER; order++)
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+		     migratetype++)
+			INIT_LIST_HEAD(&pcp->ho_lists[order][migratetype]);
+	/* the boot pagesets are set up with batch 0: no high-order lists */
+	if (batch)
+		setup_pageset_highorder(p, batch);
 }
 
 /*
@@ -3643,6 +3821,7 @@ static int __zone_pcp_update(void *data)
 
 		local_irq_save(flags);
 		free_pcppages_bulk(zone, pcp->count, pcp);
+		drain_pcp_highorder(zone, pcp, INT_MAX);
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -4248,6 +4427,11 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = MAX_NR_ZONES - 1;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -5270,6 +5454,33 @@ int percpu_pagelist_fraction_sysctl_handler(ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * percpu_highorder_high, percpu_highorder_batch - change the size of the
+ * per cpu lists of order 1..PAGE_ALLOC_COSTLY_ORDER blocks for each zone
+ * on each cpu, in pages.  0 picks a default from the zone's batch size.
+ */
+int percpu_highorder_sysctl_handler(ctl_table *table, int write,
+	void __user *buffer, size_t *length, loff_t *ppos)
+{
+	struct zone *zone;
+	unsigned int cpu;
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!write || ret < 0)
+		return ret;
+	for_each_populated_zone(zone) {
+		unsigned long batch = zone_batchsize(zone);
+
+		for_each_possible_cpu(cpu)
+			setup_pageset_highorder(
+				per_cpu_ptr(zone->pageset, cpu), batch);
+	}
+	/* don't leave blocks behind on lists that just shrank */
+	drain_all_pages();
+	return 0;
+}
+
 int hashdist = HASHDIST_DEFAULT;
 
 #ifdef CONFIG_NUMA
@@ -423,13 +423,14 @@ pte_t *__page_check_address(struct page *page, struct mm_struct *mm,
 {
 	pgd_t *pgd;
 	pud_t *pud;
-	pmd_t *pmd;
+	pmd_t *pmd, pmdval;
 	pte_t *pte;
 	spinlock_t *ptl;
 
 	if (unlikely(PageHuge(page))) {
 		pte = huge_pte_offset(mm, address);
 		ptl = &mm->page_table_lock;
+		spin_lock(ptl);
 		goto check;
 	}
 
@@ -442,21 +443,30 @@ pte_t *__page_check_address(struct page *page, struct mm_struct *mm,
 		return NULL;
 
 	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd))
+	pmdval = *pmd;
+	if (!pmd_present(pmdval))
 		return NULL;
-	if (pmd_trans_huge(*pmd))
+	if (pmd_trans_huge(pmdval))
 		return NULL;
 
-	pte = pte_offset_map(pmd, address);
+	pte = pte_offset_map(&pmdval, address);
 	/* Make a quick check before getting the lock */
 	if (!sync && !pte_present(*pte)) {
 		pte_unmap(pte);
 		return NULL;
 	}
 
-	ptl = pte_lockptr(mm, pmd);
-check:
+	ptl = pte_lockptr(mm, &pmdval);
 	spin_lock(ptl);
+	/*
+	 * A pte table shared after fork maps the page for several mms at
+	 * once: leave it alone until it has been unshared.
+	 */
+	if (pte_table_shared(pmdval) || pmd_val(*pmd) != pmd_val(pmdval)) {
+		pte_unmap_unlock(pte, ptl);
+		return NULL;
+	}
+check:
 	if (pte_present(*pte) && page_to_pfn(page) == pte_pfn(*pte)) {
 		*ptlp = ptl;
 		return pte;
@@ -1017,6 +1027,102 @@ void page_remove_rmap(struct page *page)
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
  */
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+/*
+ * Flush the TLB entries of all ptes that try_to_unmap() cleared with
+ * TTU_BATCH_FLUSH.  Must be called before the pages can be freed.
+ */
+void try_to_unmap_flush(void)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = &current->tlb_ubc;
+
+	if (!tlb_ubc->flush_required)
+		return;
+
+	flush_tlb_batched(&tlb_ubc->cpumask);
+	cpumask_clear(&tlb_ubc->cpumask);
+	tlb_ubc->flush_required = false;
+	tlb_ubc->writable = false;
+}
+
+/*
+ * A cpu may still write to a page through a stale TLB entry that was
+ * dirty: flush those before the page is written back, or the write
+ * could be lost.
+ */
+void try_to_unmap_flush_dirty(void)
+{
+	if (current->tlb_ubc.writable)
+		try_to_unmap_flush();
+}
+
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, bool writable)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = &current->tlb_ubc;
+
+	cpumask_or(&tlb_ubc->cpumask, &tlb_ubc->cpumask, mm_cpumask(mm));
+	tlb_ubc->flush_required = true;
+
+	/*
+	 * Seen under the pte lock by whoever changes this mm's page tables
+	 * next, see flush_tlb_batched_pending().
+	 */
+	barrier();
+	mm->tlb_flush_batched = true;
+
+	if (writable)
+		tlb_ubc->writable = true;
+}
+
+/*
+ * Only batch if the mm may be cached by other cpus: a local flush is
+ * cheap, and flushing right away keeps the common case exact.
+ */
+static bool should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	bool should_defer = false;
+
+	if (!(flags & TTU_BATCH_FLUSH))
+		return false;
+
+	if (cpumask_any_but(mm_cpumask(mm), get_cpu()) < nr_cpu_ids)
+		should_defer = true;
+	put_cpu();
+
+	return should_defer;
+}
+
+/*
+ * Reclaim may have cleared ptes of @mm without flushing the TLBs yet.
+ * Anybody who is about to change the page tables of @mm and expects the
+ * old translations to be gone afterwards (munmap, mprotect, mremap) must
+ * flush them first.  Called with the pte lock held, which orders this
+ * against set_tlb_ubc_flush_pending().
+ */
+void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+	if (mm->tlb_flush_batched) {
+		flush_tlb_mm(mm);
+
+		/*
+		 * Do not allow the compiler to re-order the clearing of
+		 * tlb_flush_batched before the flush is issued.
+		 */
+		barrier();
+		mm->tlb_flush_batched = false;
+	}
+}
+#else
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, bool writable)
+{
+}
+
+static bool should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	return false;
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
+
 int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		     unsigned long address, enum ttu_flags flags)
 {
@@ -1051,7 +1157,17 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 
 	/* Nuke the page table entry. */
 	flush_cache_page(vma, address, page_to_pfn(page));
-	pteval = ptep_clear_flush_notify(vma, address, pte);
+	if (should_defer_flush(mm, flags)) {
+		/*
+		 * Leave the TLB flush to try_to_unmap_flush(), which the
+		 * caller issues once for a whole batch of pages, before
+		 * any of them is freed.
+		 */
+		pteval = ptep_get_and_clear(mm, address, pte);
+		set_tlb_ubc_flush_pending(mm, pte_dirty(pteval));
+		mmu_notifier_invalidate_page(mm, address);
+	} else
+		pteval = ptep_clear_flush_notify(vma, address, pte);
 
 	/* Move the dirty bit to the physical page now the pte is gone. */
 	if (pte_dirty(pteval))
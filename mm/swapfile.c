@@ -935,6 +935,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
+		if (unshare_pte_table(vma, pmd, addr))
+			return -ENOMEM;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
 			return ret;
@@ -1013,6 +1015,16 @@ static int unuse_mm(struct mm_struct *mm,
 			break;
 	}
 	up_read(&mm->mmap_sem);
+#ifdef CONFIG_SHARE_PTE_ON_FORK
+	/* unshared pte tables still hold references to the swap entries */
+	if (!list_empty(&mm->retired_ptes)) {
+		unlock_page(page);
+		down_write(&mm->mmap_sem);
+		release_retired_ptes(mm);
+		up_write(&mm->mmap_sem);
+		lock_page(page);
+	}
+#endif
 	return (ret < 0)? ret: 0;
 }
 
@@ -470,7 +470,8 @@ void refresh_cpu_vm_stats(int cpu)
 		 * Check if there are pages remaining in this pageset
 		 * if not then there is nothing to expire.
 		 */
-		if (!p->expire || !p->pcp.count)
+		if (!p->expire ||
+		    (!p->pcp.count && !pcp_highorder_count(&p->pcp)))
 			continue;
 
 		/*
@@ -485,8 +486,7 @@ void refresh_cpu_vm_stats(int cpu)
 		if (p->expire)
 			continue;
 
-		if (p->pcp.count)
-			drain_zone_pages(zone, &p->pcp);
+		drain_zone_pages(zone, &p->pcp);
 #endif
 	}
 
@@ -919,6 +919,8 @@ static const char * const vmstat_text[] = {
 	"slabs_scanned",
 	"kswapd_steal",
 	"kswapd_inodesteal",
+	"dentries_pruned",
+	"inodes_pruned",
 	"kswapd_low_wmark_hit_quickly",
 	"kswapd_high_wmark_hit_quickly",
 	"kswapd_skip_congestion_wait",
@@ -927,6 +929,11 @@ static const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+	"pcp_highorder_hit",
+	"pcp_highorder_refill",
+	"pcp_highorder_free",
+	"pcp_highorder_drain",
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
@@ -934,6 +941,13 @@ static const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_stall_lt_100us",
+	"compact_stall_lt_1ms",
+	"compact_stall_lt_10ms",
+	"compact_stall_lt_100ms",
+	"compact_stall_ge_100ms",
+	"compact_daemon_wake",
+	"compact_daemon_proactive",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -1006,6 +1020,13 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
 			   pageset->pcp.batch);
+		seq_printf(m,
+			   "\n              highorder count: %i"
+			   "\n              highorder high:  %i"
+			   "\n              highorder batch: %i",
+			   pcp_highorder_count(&pageset->pcp),
+			   pageset->pcp.ho_high,
+			   pageset->pcp.ho_batch);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
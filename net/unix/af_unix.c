@@ -114,13 +114,17 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/splice.h>
 
-static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
-static DEFINE_SPINLOCK(unix_table_lock);
+/*
+ * Bound sockets are hashed into the lower half of the table, abstract
+ * ones by name and filesystem ones by inode.  Unbound sockets, which is
+ * most of them, are spread over the upper half by their address.
+ */
+static struct hlist_head unix_socket_table[2 * UNIX_HASH_SIZE];
+static spinlock_t unix_table_locks[2 * UNIX_HASH_SIZE];
 static atomic_long_t unix_nr_socks;
 
-#define unix_sockets_unbound	(&unix_socket_table[UNIX_HASH_SIZE])
-
 #define UNIX_ABSTRACT(sk)	(unix_sk(sk)->addr->hash != UNIX_HASH_SIZE)
 
 #ifdef CONFIG_SECURITY_NETWORK
@@ -143,7 +147,10 @@ static inline void unix_set_secdata(struct scm_cookie *scm, struct sk_buff *skb)
 
 /*
  *  SMP locking strategy:
- *    hash table is protected with spinlock unix_table_lock
+ *    each hash chain is protected by its own spinlock in unix_table_locks,
+ *    and a socket keeps the index of its chain in sk->sk_hash.  Binding
+ *    moves a socket from one chain to another with both locks held,
+ *    the lower index first.
  *    each socket state is protected by separate spin lock.
  */
 
@@ -220,29 +227,74 @@ static int unix_mkname(struct sockaddr_un *sunaddr, int len, unsigned *hashp)
 	return len;
 }
 
+static inline unsigned unix_unbound_hash(struct sock *sk)
+{
+	unsigned long hash = (unsigned long)sk;
+
+	hash ^= hash>>16;
+	hash ^= hash>>8;
+	hash ^= sk->sk_type;
+	return UNIX_HASH_SIZE + (hash&(UNIX_HASH_SIZE-1));
+}
+
+static inline unsigned unix_bsd_hash(struct inode *i)
+{
+	return i->i_ino & (UNIX_HASH_SIZE-1);
+}
+
+static void unix_table_double_lock(unsigned hash1, unsigned hash2)
+{
+	if (hash1 == hash2) {
+		spin_lock(&unix_table_locks[hash1]);
+		return;
+	}
+	if (hash1 > hash2)
+		swap(hash1, hash2);
+	spin_lock(&unix_table_locks[hash1]);
+	spin_lock_nested(&unix_table_locks[hash2], SINGLE_DEPTH_NESTING);
+}
+
+static void unix_table_double_unlock(unsigned hash1, unsigned hash2)
+{
+	spin_unlock(&unix_table_locks[hash1]);
+	if (hash1 != hash2)
+		spin_unlock(&unix_table_locks[hash2]);
+}
+
 static void __unix_remove_socket(struct sock *sk)
 {
 	sk_del_node_init(sk);
 }
 
-static void __unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static void __unix_insert_socket(struct sock *sk)
 {
 	WARN_ON(!sk_unhashed(sk));
-	sk_add_node(sk, list);
+	sk_add_node(sk, &unix_socket_table[sk->sk_hash]);
+}
+
+/* Called with the locks of both the old and the new chain held */
+static void __unix_set_addr(struct sock *sk, struct unix_address *addr,
+			    unsigned hash)
+{
+	__unix_remove_socket(sk);
+	unix_sk(sk)->addr = addr;
+	sk->sk_hash = hash;
+	__unix_insert_socket(sk);
 }
 
 static inline void unix_remove_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
+	spin_lock(&unix_table_locks[sk->sk_hash]);
 	__unix_remove_socket(sk);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[sk->sk_hash]);
 }
 
-static inline void unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static inline void unix_insert_unbound_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
-	__unix_insert_socket(list, sk);
-	spin_unlock(&unix_table_lock);
+	sk->sk_hash = unix_unbound_hash(sk);
+	spin_lock(&unix_table_locks[sk->sk_hash]);
+	__unix_insert_socket(sk);
+	spin_unlock(&unix_table_locks[sk->sk_hash]);
 }
 
 static struct sock *__unix_find_socket_byname(struct net *net,
@@ -274,22 +326,22 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 {
 	struct sock *s;
 
-	spin_lock(&unix_table_lock);
+	spin_lock(&unix_table_locks[hash ^ type]);
 	s = __unix_find_socket_byname(net, sunname, len, type, hash);
 	if (s)
 		sock_hold(s);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash ^ type]);
 	return s;
 }
 
 static struct sock *unix_find_socket_byinode(struct inode *i)
 {
+	unsigned hash = unix_bsd_hash(i);
 	struct sock *s;
 	struct hlist_node *node;
 
-	spin_lock(&unix_table_lock);
-	sk_for_each(s, node,
-		    &unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
+	spin_lock(&unix_table_locks[hash]);
+	sk_for_each(s, node, &unix_socket_table[hash]) {
 		struct dentry *dentry = unix_sk(s)->dentry;
 
 		if (dentry && dentry->d_inode == i) {
@@ -299,7 +351,7 @@ static struct sock *unix_find_socket_byinode(struct inode *i)
 	}
 	s = NULL;
 found:
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash]);
 	return s;
 }
 
@@ -350,6 +402,12 @@ static void unix_sock_destructor(struct sock *sk)
 
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	/* left over from copying the linear part of skbs for splice */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
 	WARN_ON(sk->sk_socket);
@@ -516,6 +574,11 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int,
+				    size_t, int);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *,
+				       struct pipe_inode_info *, size_t,
+				       unsigned int);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -545,7 +608,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -632,7 +696,7 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
-	unix_insert_socket(unix_sockets_unbound, sk);
+	unix_insert_unbound_socket(sk);
 out:
 	if (sk == NULL)
 		atomic_long_dec(&unix_nr_socks);
@@ -692,8 +756,9 @@ static int unix_autobind(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct net *net = sock_net(sk);
 	struct unix_sock *u = unix_sk(sk);
-	static u32 ordernum = 1;
+	static atomic_t ordernum = ATOMIC_INIT(0);
 	struct unix_address *addr;
+	unsigned old_hash, new_hash;
 	int err;
 	unsigned int retries = 0;
 
@@ -711,16 +776,19 @@ static int unix_autobind(struct socket *sock)
 	addr->name->sun_family = AF_UNIX;
 	atomic_set(&addr->refcnt, 1);
 
+	old_hash = sk->sk_hash;
 retry:
-	addr->len = sprintf(addr->name->sun_path+1, "%05x", ordernum) + 1 + sizeof(short);
+	addr->len = sprintf(addr->name->sun_path+1, "%05x",
+			    atomic_inc_return(&ordernum) & 0xFFFFF) +
+		    1 + sizeof(short);
 	addr->hash = unix_hash_fold(csum_partial(addr->name, addr->len, 0));
+	new_hash = addr->hash ^ sk->sk_type;
 
-	spin_lock(&unix_table_lock);
-	ordernum = (ordernum+1)&0xFFFFF;
+	unix_table_double_lock(old_hash, new_hash);
 
 	if (__unix_find_socket_byname(net, addr->name, addr->len, sock->type,
 				      addr->hash)) {
-		spin_unlock(&unix_table_lock);
+		unix_table_double_unlock(old_hash, new_hash);
 		/*
 		 * __unix_find_socket_byname() may take long time if many names
 		 * are already in use.
@@ -734,12 +802,10 @@ retry:
 		}
 		goto retry;
 	}
-	addr->hash ^= sk->sk_type;
+	addr->hash = new_hash;
 
-	__unix_remove_socket(sk);
-	u->addr = addr;
-	__unix_insert_socket(&unix_socket_table[addr->hash], sk);
-	spin_unlock(&unix_table_lock);
+	__unix_set_addr(sk, addr, new_hash);
+	unix_table_double_unlock(old_hash, new_hash);
 	err = 0;
 
 out:	mutex_unlock(&u->readlock);
@@ -811,9 +877,8 @@ static int unix_bind(struct socket *sock, struct sockaddr *uaddr, int addr_len)
 	struct dentry *dentry = NULL;
 	struct nameidata nd;
 	int err;
-	unsigned hash;
+	unsigned hash, old_hash, new_hash;
 	struct unix_address *addr;
-	struct hlist_head *list;
 
 	err = -EINVAL;
 	if (sunaddr->sun_family != AF_UNIX)
@@ -884,7 +949,13 @@ out_mknod_drop_write:
 		addr->hash = UNIX_HASH_SIZE;
 	}
 
-	spin_lock(&unix_table_lock);
+	old_hash = sk->sk_hash;
+	if (!sunaddr->sun_path[0])
+		new_hash = addr->hash;
+	else
+		new_hash = unix_bsd_hash(dentry->d_inode);
+
+	unix_table_double_lock(old_hash, new_hash);
 
 	if (!sunaddr->sun_path[0]) {
 		err = -EADDRINUSE;
@@ -893,21 +964,16 @@ out_mknod_drop_write:
 			unix_release_addr(addr);
 			goto out_unlock;
 		}
-
-		list = &unix_socket_table[addr->hash];
 	} else {
-		list = &unix_socket_table[dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1)];
 		u->dentry = nd.path.dentry;
 		u->mnt    = nd.path.mnt;
 	}
 
 	err = 0;
-	__unix_remove_socket(sk);
-	u->addr = addr;
-	__unix_insert_socket(list, sk);
+	__unix_set_addr(sk, addr, new_hash);
 
 out_unlock:
-	spin_unlock(&unix_table_lock);
+	unix_table_double_unlock(old_hash, new_hash);
 out_up:
 	mutex_unlock(&u->readlock);
 out:
@@ -1418,10 +1484,11 @@ static int unix_dgram_sendmsg(struct kiocb *kiocb, struct socket *sock,
 
 	if (NULL == siocb->scm)
 		siocb->scm = &tmp_scm;
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, siocb->scm);
 	if (err < 0)
 		return err;
+	if (siocb->scm->fp)
+		wait_for_unix_gc();
 
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
@@ -1545,6 +1612,9 @@ restart:
 	skb_queue_tail(&other->sk_receive_queue, skb);
 	if (max_level > unix_sk(other)->recursion_level)
 		unix_sk(other)->recursion_level = max_level;
+	/* Set after queueing, see scan_inflight() */
+	if (siocb->scm->fp)
+		set_bit(UNIX_GC_MAYBE_FDS, &unix_sk(other)->gc_flags);
 	unix_state_unlock(other);
 	other->sk_data_ready(other, len);
 	sock_put(other);
@@ -1578,10 +1648,11 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 
 	if (NULL == siocb->scm)
 		siocb->scm = &tmp_scm;
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, siocb->scm);
 	if (err < 0)
 		return err;
+	if (siocb->scm->fp)
+		wait_for_unix_gc();
 
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
@@ -1659,6 +1730,9 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		skb_queue_tail(&other->sk_receive_queue, skb);
 		if (max_level > unix_sk(other)->recursion_level)
 			unix_sk(other)->recursion_level = max_level;
+		/* Set after queueing, see scan_inflight() */
+		if (siocb->scm->fp)
+			set_bit(UNIX_GC_MAYBE_FDS, &unix_sk(other)->gc_flags);
 		unix_state_unlock(other);
 		other->sk_data_ready(other, size);
 		sent += size;
@@ -1682,6 +1756,122 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ * Can a page be appended to the skb at the tail of the peer's queue?
+ * The skb must be one of ours, from the same writer and without fds,
+ * for the reader not to glue data it would otherwise have kept apart.
+ */
+static bool unix_skb_can_append(struct sk_buff *skb, struct sock *sk,
+				struct scm_cookie *scm, struct page *page,
+				int offset)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+
+	if (skb->sk != sk || UNIXCB(skb).fp ||
+	    UNIXCB(skb).pid != scm->pid || UNIXCB(skb).cred != scm->cred)
+		return false;
+
+	/* Past the send buffer, make the writer wait for a new skb */
+	if (atomic_read(&sk->sk_wmem_alloc) >= sk->sk_sndbuf)
+		return false;
+
+	return skb_can_coalesce(skb, i, page, offset) || i < MAX_SKB_FRAGS;
+}
+
+/*
+ *	Send a page without copying it: a reference to it goes into a
+ *	page fragment of the skb at the tail of the peer's receive queue,
+ *	or of a new one if that cannot take it.  Readers take skbs off the
+ *	queue before they look at them, so an skb still in the queue can be
+ *	grown under the queue lock.
+ */
+static ssize_t unix_stream_sendpage(struct socket *sock, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sock *other;
+	struct sk_buff *skb, *newskb = NULL;
+	struct scm_cookie scm;
+	struct msghdr msg = { .msg_flags = flags };
+	int err, i;
+
+	if (flags&MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other)
+		return -ENOTCONN;
+
+	memset(&scm, 0, sizeof(scm));
+	err = scm_send(sock, &msg, &scm);
+	if (err < 0)
+		return err;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	for (;;) {
+		unix_state_lock(other);
+
+		if (sock_flag(other, SOCK_DEAD) ||
+		    (other->sk_shutdown & RCV_SHUTDOWN))
+			goto pipe_err_unlock;
+
+		spin_lock(&other->sk_receive_queue.lock);
+		skb = newskb;
+		if (!skb) {
+			skb = skb_peek_tail(&other->sk_receive_queue);
+			if (skb && !unix_skb_can_append(skb, sk, &scm,
+							page, offset))
+				skb = NULL;
+		}
+		if (skb)
+			break;
+		spin_unlock(&other->sk_receive_queue.lock);
+		unix_state_unlock(other);
+
+		newskb = sock_alloc_send_pskb(sk, 0, 0, flags&MSG_DONTWAIT,
+					      &err);
+		if (!newskb)
+			goto out_err;
+		err = unix_scm_to_skb(&scm, newskb, false);
+		if (err < 0)
+			goto out_err;
+	}
+
+	i = skb_shinfo(skb)->nr_frags;
+	if (skb_can_coalesce(skb, i, page, offset)) {
+		skb_shinfo(skb)->frags[i - 1].size += size;
+	} else {
+		get_page(page);
+		skb_fill_page_desc(skb, i, page, offset, size);
+	}
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	if (skb == newskb)
+		__skb_queue_tail(&other->sk_receive_queue, skb);
+	spin_unlock(&other->sk_receive_queue.lock);
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+
+	scm_destroy(&scm);
+	return size;
+
+pipe_err_unlock:
+	unix_state_unlock(other);
+pipe_err:
+	if (!(flags&MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	err = -EPIPE;
+out_err:
+	kfree_skb(newskb);
+	scm_destroy(&scm);
+	return err;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1819,6 +2009,11 @@ out:
  *	Sleep until data has arrive. But check for races..
  */
 
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static long unix_stream_data_wait(struct sock *sk, long timeo)
 {
 	DEFINE_WAIT(wait);
@@ -1953,8 +2148,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1965,13 +2161,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
@@ -1998,6 +2194,154 @@ out:
 	return copied ? : err;
 }
 
+/*
+ * Called with the reader lock held, so never wait for the pipe here:
+ * a full pipe would keep every other reader of the socket out.  The
+ * caller waits for room itself, with the lock dropped, and retries.
+ */
+static ssize_t unix_stream_splice_to_pipe(struct sock *sk,
+					  struct pipe_inode_info *pipe,
+					  struct splice_pipe_desc *spd)
+{
+	spd->flags |= SPLICE_F_NONBLOCK;
+	return splice_to_pipe(pipe, spd);
+}
+
+static int unix_stream_splice_wait(struct pipe_inode_info *pipe)
+{
+	int err = 0;
+
+	pipe_lock(pipe);
+	while (pipe->nrbufs >= pipe->buffers) {
+		if (!pipe->readers) {
+			send_sig(SIGPIPE, current, 0);
+			err = -EPIPE;
+			break;
+		}
+		if (signal_pending(current)) {
+			err = -ERESTARTSYS;
+			break;
+		}
+		pipe->waiting_writers++;
+		pipe_wait(pipe);
+		pipe->waiting_writers--;
+	}
+	pipe_unlock(pipe);
+	return err;
+}
+
+/*
+ *	Move the data queued on the socket into a pipe.  Page fragments,
+ *	as put there by sendpage, are passed on by reference; only the
+ *	linear part of an skb is copied.  As with read(), any fds that
+ *	came with the data are closed.
+ */
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t len, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct unix_sock *u = unix_sk(sk);
+	struct scm_cookie scm;
+	ssize_t spliced = 0;
+	int err;
+	long timeo;
+
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -EINVAL;
+
+	timeo = sock_rcvtimeo(sk, sock->file->f_flags & O_NONBLOCK);
+	memset(&scm, 0, sizeof(scm));
+
+	err = mutex_lock_interruptible(&u->readlock);
+	if (err)
+		return sock_intr_errno(timeo);
+
+	while (len) {
+		struct sk_buff *skb;
+		int chunk, ret;
+
+		unix_state_lock(sk);
+		skb = skb_dequeue(&sk->sk_receive_queue);
+		if (skb == NULL) {
+			unix_sk(sk)->recursion_level = 0;
+			if (spliced)
+				goto unlock;
+
+			err = sock_error(sk);
+			if (err)
+				goto unlock;
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				goto unlock;
+
+			unix_state_unlock(sk);
+			err = -EAGAIN;
+			if (!timeo)
+				break;
+			mutex_unlock(&u->readlock);
+
+			timeo = unix_stream_data_wait(sk, timeo);
+
+			if (signal_pending(current)
+			    ||  mutex_lock_interruptible(&u->readlock)) {
+				err = sock_intr_errno(timeo);
+				goto out;
+			}
+
+			continue;
+ unlock:
+			unix_state_unlock(sk);
+			break;
+		}
+		unix_state_unlock(sk);
+
+		chunk = min_t(unsigned int, unix_skb_len(skb), len);
+		ret = skb_splice_bits(skb, sk, UNIXCB(skb).consumed, pipe,
+				      chunk, flags, unix_stream_splice_to_pipe);
+		if (ret <= 0) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			if (ret == -EAGAIN && !spliced &&
+			    !(flags & SPLICE_F_NONBLOCK)) {
+				/* the pipe is full: wait without the lock */
+				mutex_unlock(&u->readlock);
+				err = unix_stream_splice_wait(pipe);
+				if (err)
+					goto out;
+				if (mutex_lock_interruptible(&u->readlock)) {
+					err = -ERESTARTSYS;
+					goto out;
+				}
+				continue;
+			}
+			/* nothing mapped: no page for the linear part */
+			err = ret ? : -ENOMEM;
+			break;
+		}
+		spliced += ret;
+		len -= ret;
+
+		UNIXCB(skb).consumed += ret;
+		if (UNIXCB(skb).fp)
+			unix_detach_fds(&scm, skb);
+
+		/* put the skb back if the pipe did not take it all */
+		if (unix_skb_len(skb)) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			break;
+		}
+
+		consume_skb(skb);
+
+		if (scm.fp)
+			break;
+	}
+
+	mutex_unlock(&u->readlock);
+out:
+	scm_destroy(&scm);
+	return spliced ? : err;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -2064,7 +2408,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
@@ -2171,76 +2515,93 @@ static unsigned int unix_dgram_poll(struct file *file, struct socket *sock,
 }
 
 #ifdef CONFIG_PROC_FS
-static struct sock *first_unix_socket(int *i)
+
+/*
+ * The position is the index of the chain in the high bits and the
+ * position of the socket in it, counted from 1, in the low bits, so
+ * that reading can go on after the lock of the chain was dropped.
+ */
+#define BUCKET_SPACE (BITS_PER_LONG - (UNIX_HASH_BITS + 1) - 1)
+
+#define get_bucket(x) ((x) >> BUCKET_SPACE)
+#define get_offset(x) ((x) & ((1L << BUCKET_SPACE) - 1))
+#define set_bucket_offset(b, o) ((b) << BUCKET_SPACE | (o))
+
+static struct sock *unix_from_bucket(struct seq_file *seq, loff_t *pos)
 {
-	for (*i = 0; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	unsigned long offset = get_offset(*pos);
+	unsigned long bucket = get_bucket(*pos);
+	struct hlist_node *node;
+	struct sock *sk;
+	unsigned long count = 0;
+
+	sk_for_each(sk, node, &unix_socket_table[bucket]) {
+		if (sock_net(sk) != seq_file_net(seq))
+			continue;
+		if (++count == offset)
+			return sk;
 	}
+
 	return NULL;
 }
 
-static struct sock *next_unix_socket(int *i, struct sock *s)
+/* Returns with the lock of the chain of the socket held */
+static struct sock *unix_get_first(struct seq_file *seq, loff_t *pos)
 {
-	struct sock *next = sk_next(s);
-	/* More in this chain? */
-	if (next)
-		return next;
-	/* Look for next non-empty chain. */
-	for ((*i)++; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	unsigned long bucket = get_bucket(*pos);
+	struct sock *sk;
+
+	while (bucket < ARRAY_SIZE(unix_socket_table)) {
+		spin_lock(&unix_table_locks[bucket]);
+		sk = unix_from_bucket(seq, pos);
+		if (sk)
+			return sk;
+		spin_unlock(&unix_table_locks[bucket]);
+		*pos = set_bucket_offset(++bucket, 1);
 	}
+
 	return NULL;
 }
 
-struct unix_iter_state {
-	struct seq_net_private p;
-	int i;
-};
-
-static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
+static struct sock *unix_get_next(struct seq_file *seq, struct sock *sk,
+				  loff_t *pos)
 {
-	struct unix_iter_state *iter = seq->private;
-	loff_t off = 0;
-	struct sock *s;
+	unsigned long bucket = get_bucket(*pos);
 
-	for (s = first_unix_socket(&iter->i); s; s = next_unix_socket(&iter->i, s)) {
-		if (sock_net(s) != seq_file_net(seq))
-			continue;
-		if (off == pos)
-			return s;
-		++off;
-	}
-	return NULL;
+	for (sk = sk_next(sk); sk; sk = sk_next(sk))
+		if (sock_net(sk) == seq_file_net(seq))
+			return sk;
+
+	spin_unlock(&unix_table_locks[bucket]);
+	*pos = set_bucket_offset(++bucket, 1);
+
+	return unix_get_first(seq, pos);
 }
 
 static void *unix_seq_start(struct seq_file *seq, loff_t *pos)
-	__acquires(unix_table_lock)
 {
-	spin_lock(&unix_table_lock);
-	return *pos ? unix_seq_idx(seq, *pos - 1) : SEQ_START_TOKEN;
+	if (!*pos)
+		return SEQ_START_TOKEN;
+
+	return unix_get_first(seq, pos);
 }
 
 static void *unix_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
-	struct unix_iter_state *iter = seq->private;
-	struct sock *sk = v;
 	++*pos;
 
 	if (v == SEQ_START_TOKEN)
-		sk = first_unix_socket(&iter->i);
-	else
-		sk = next_unix_socket(&iter->i, sk);
-	while (sk && (sock_net(sk) != seq_file_net(seq)))
-		sk = next_unix_socket(&iter->i, sk);
-	return sk;
+		return unix_get_first(seq, pos);
+
+	return unix_get_next(seq, v, pos);
 }
 
 static void unix_seq_stop(struct seq_file *seq, void *v)
-	__releases(unix_table_lock)
 {
-	spin_unlock(&unix_table_lock);
+	struct sock *sk = v;
+
+	if (sk && sk != SEQ_START_TOKEN)
+		spin_unlock(&unix_table_locks[sk->sk_hash]);
 }
 
 static int unix_seq_show(struct seq_file *seq, void *v)
@@ -2297,7 +2658,7 @@ static const struct seq_operations unix_seq_ops = {
 static int unix_seq_open(struct inode *inode, struct file *file)
 {
 	return seq_open_net(inode, file, &unix_seq_ops,
-			    sizeof(struct unix_iter_state));
+			    sizeof(struct seq_net_private));
 }
 
 static const struct file_operations unix_seq_fops = {
@@ -2351,9 +2712,13 @@ static int __init af_unix_init(void)
 {
 	int rc = -1;
 	struct sk_buff *dummy_skb;
+	int i;
 
 	BUILD_BUG_ON(sizeof(struct unix_skb_parms) > sizeof(dummy_skb->cb));
 
+	for (i = 0; i < ARRAY_SIZE(unix_table_locks); i++)
+		spin_lock_init(&unix_table_locks[i]);
+
 	rc = proto_register(&unix_proto, 1);
 	if (rc != 0) {
 		printk(KERN_CRIT "%s: Cannot create unix_sock SLAB cache!\n",
@@ -2370,6 +2735,7 @@ out:
 static void __exit af_unix_exit(void)
 {
 	sock_unregister(PF_UNIX);
+	unix_gc_flush();
 	proto_unregister(&unix_proto);
 	unregister_pernet_subsys(&unix_net_ops);
 }
@@ -66,6 +66,11 @@
  *		Reimplement with a cycle collecting algorithm. This should
  *		solve several problems with the previous code, like being racy
  *		wrt receive and holding up unrelated socket operations.
+ *
+ *		Run the collector from a work item, so that neither closing
+ *		a socket nor sending fds waits for it, and only scan the
+ *		sockets that had fds sent to them since they were last found
+ *		without any: no other socket can be part of a cycle.
  */
 
 #include <linux/kernel.h>
@@ -79,7 +84,7 @@
 #include <linux/file.h>
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
-#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -91,7 +96,6 @@
 static LIST_HEAD(gc_inflight_list);
 static LIST_HEAD(gc_candidates);
 static DEFINE_SPINLOCK(unix_gc_lock);
-static DECLARE_WAIT_QUEUE_HEAD(unix_gc_wait);
 
 unsigned int unix_tot_inflight;
 
@@ -158,6 +162,7 @@ static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
 {
 	struct sk_buff *skb;
 	struct sk_buff *next;
+	bool has_sockets = false;
 
 	spin_lock(&x->sk_receive_queue.lock);
 	skb_queue_walk_safe(&x->sk_receive_queue, skb, next) {
@@ -180,12 +185,15 @@ static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
 				if (sk) {
 					struct unix_sock *u = unix_sk(sk);
 
+					has_sockets = true;
+
 					/*
 					 * Ignore non-candidates, they could
 					 * have been added to the queues after
 					 * starting the garbage collection
 					 */
-					if (u->gc_candidate) {
+					if (test_bit(UNIX_GC_CANDIDATE,
+						     &u->gc_flags)) {
 						hit = true;
 						func(u);
 					}
@@ -197,6 +205,16 @@ static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
 			}
 		}
 	}
+	/*
+	 * A socket without sockets queued to it is left out of the next
+	 * runs until some fds are sent to it.  Senders set the bit only
+	 * after skb_queue_tail() has dropped this lock again, so an skb
+	 * queued before the walk above was seen by it, and for one queued
+	 * after it the bit is set again after this clear.  The other bits
+	 * of gc_flags are changed meanwhile, so only use atomic bitops.
+	 */
+	if (!has_sockets)
+		clear_bit(UNIX_GC_MAYBE_FDS, &unix_sk(x)->gc_flags);
 	spin_unlock(&x->sk_receive_queue.lock);
 }
 
@@ -254,26 +272,44 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 	 * of the list, so that it's checked even if it was already
 	 * passed over
 	 */
-	if (u->gc_maybe_cycle)
+	if (test_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags))
 		list_move_tail(&u->link, &gc_candidates);
 }
 
-static bool gc_in_progress = false;
+static void unix_gc_work_fn(struct work_struct *work);
+static DECLARE_WORK(unix_gc_work, unix_gc_work_fn);
+
 #define UNIX_INFLIGHT_TRIGGER_GC 16000
 
+/* Called by senders of fds */
 void wait_for_unix_gc(void)
 {
 	/*
-	 * If number of inflight sockets is insane,
-	 * force a garbage collect right now.
+	 * If number of inflight sockets is insane, force a garbage
+	 * collect right now, and make the sender wait for it.
 	 */
-	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC && !gc_in_progress)
+	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC) {
 		unix_gc();
-	wait_event(unix_gc_wait, gc_in_progress == false);
+		flush_work(&unix_gc_work);
+	}
 }
 
-/* The external entry point: unix_gc() */
+/*
+ * The external entry point: unix_gc() queues a run of the collector,
+ * requests that come in before it starts share the same run.
+ */
 void unix_gc(void)
+{
+	queue_work(system_unbound_wq, &unix_gc_work);
+}
+
+/* Called on module exit, when no AF_UNIX socket is left */
+void unix_gc_flush(void)
+{
+	flush_work_sync(&unix_gc_work);
+}
+
+static void unix_gc_work_fn(struct work_struct *work)
 {
 	struct unix_sock *u;
 	struct unix_sock *next;
@@ -283,11 +319,6 @@ void unix_gc(void)
 
 	spin_lock(&unix_gc_lock);
 
-	/* Avoid a recursive GC. */
-	if (gc_in_progress)
-		goto out;
-
-	gc_in_progress = true;
 	/*
 	 * First, select candidates for garbage collection.  Only
 	 * in-flight sockets are considered, and from those only ones
@@ -303,11 +334,20 @@ void unix_gc(void)
 	 * receive queues.  Other, non candidate sockets _can_ be
 	 * added to queue, so we must make sure only to touch
 	 * candidates.
+	 *
+	 * A socket that no sockets are queued to (nor to its embryos,
+	 * if it listens) has no children, so it cannot be part of a
+	 * cycle.  If it is garbage, it goes away with the skb that
+	 * holds it, so it need not be a candidate.
 	 */
 	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
 		long total_refs;
 		long inflight_refs;
 
+		if (!test_bit(UNIX_GC_MAYBE_FDS, &u->gc_flags) &&
+		    u->sk.sk_state != TCP_LISTEN)
+			continue;
+
 		total_refs = file_count(u->sk.sk_socket->file);
 		inflight_refs = atomic_long_read(&u->inflight);
 
@@ -315,8 +355,8 @@ void unix_gc(void)
 		BUG_ON(total_refs < inflight_refs);
 		if (total_refs == inflight_refs) {
 			list_move_tail(&u->link, &gc_candidates);
-			u->gc_candidate = 1;
-			u->gc_maybe_cycle = 1;
+			set_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
+			set_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
 		}
 	}
 
@@ -344,7 +384,7 @@ void unix_gc(void)
 
 		if (atomic_long_read(&u->inflight) > 0) {
 			list_move_tail(&u->link, &not_cycle_list);
-			u->gc_maybe_cycle = 0;
+			clear_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
 			scan_children(&u->sk, inc_inflight_move_tail, NULL);
 		}
 	}
@@ -356,7 +396,7 @@ void unix_gc(void)
 	 */
 	while (!list_empty(&not_cycle_list)) {
 		u = list_entry(not_cycle_list.next, struct unix_sock, link);
-		u->gc_candidate = 0;
+		clear_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
 		list_move_tail(&u->link, &gc_inflight_list);
 	}
 
@@ -378,9 +418,6 @@ void unix_gc(void)
 
 	/* All candidates should have been detached by now. */
 	BUG_ON(!list_empty(&gc_candidates));
-	gc_in_progress = false;
-	wake_up(&unix_gc_wait);
 
- out:
 	spin_unlock(&unix_gc_lock);
 }
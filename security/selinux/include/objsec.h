@@ -94,6 +94,10 @@ struct netport_security_struct {
 	u8 protocol;			/* transport protocol */
 };
 
+struct tun_security_struct {
+	u32 sid;			/* SID for the tun device sockets */
+};
+
 struct sk_security_struct {
 #ifdef CONFIG_NETLABEL
 	enum {				/* NetLabel state */
@@ -0,0 +1,129 @@
+/*
+ *
+ * bench-util.c
+ *
+ * Helpers shared by the benchmarks: forking worker processes that start
+ * at the same time, and printing the rate of the work they did.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static int ready[2], go[2];
+
+/*
+ * Called by a worker once it is set up: tells the parent so, and waits
+ * until the parent starts all the workers together.
+ */
+void bench_worker_ready(void)
+{
+	char c = 0;
+	int __used ret;
+
+	ret = write(ready[1], &c, 1);
+	ret = read(go[0], &c, 1);
+}
+
+/*
+ * Fork nr workers, each of which runs worker() with its number and arg,
+ * and exits when that returns.  diff is set to the time from the start,
+ * once all of them have called bench_worker_ready(), until the last one
+ * has exited.
+ */
+void bench_run_workers(int nr, void (*worker)(int, void *), void *arg,
+		       struct timeval *diff)
+{
+	struct timeval start, stop;
+	pid_t *pids;
+	int i, wait_stat;
+	int __used ret;
+	char c = 0;
+
+	pids = calloc(nr, sizeof(*pids));
+	assert(pids);
+
+	assert(!pipe(ready));
+	assert(!pipe(go));
+
+	/* or the workers would print what is still buffered again */
+	fflush(stdout);
+	for (i = 0; i < nr; i++) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (!pids[i]) {
+			worker(i, arg);
+			exit(0);
+		}
+	}
+
+	/* Wait for everybody to be ready, then start them together */
+	for (i = 0; i < nr; i++)
+		ret = read(ready[0], &c, 1);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++)
+		ret = write(go[1], &c, 1);
+
+	for (i = 0; i < nr; i++) {
+		assert(waitpid(pids[i], &wait_stat, 0) == pids[i]);
+		assert(WIFEXITED(wait_stat) && !WEXITSTATUS(wait_stat));
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, diff);
+
+	close(ready[0]);
+	close(ready[1]);
+	close(go[0]);
+	close(go[1]);
+	free(pids);
+}
+
+/*
+ * Print the time a run took, and how long each of the nr units of work
+ * done in it took and how many were done per second.
+ */
+void bench_print_rate(struct timeval *diff, unsigned long long nr,
+		      const char *unit)
+{
+	unsigned long long result_usec;
+
+	result_usec = diff->tv_sec * 1000000ULL + diff->tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff->tv_sec,
+		       (unsigned long) (diff->tv_usec/1000));
+
+		printf(" %14lf usecs/%s\n",
+		       (double)result_usec / (double)nr, unit);
+		printf(" %14llu %ss/sec\n",
+		       (unsigned long long)((double)nr /
+			     ((double)result_usec / (double)1000000)), unit);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff->tv_sec,
+		       (unsigned long) (diff->tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
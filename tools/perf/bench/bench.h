@@ -4,6 +4,20 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_fork(int argc, const char **argv, const char *prefix);
+extern int bench_mem_highorder(int argc, const char **argv, const char *prefix);
+extern int bench_mem_reclaim(int argc, const char **argv, const char *prefix);
+extern int bench_mem_tmpfs(int argc, const char **argv, const char *prefix);
+extern int bench_fs_locks(int argc, const char **argv, const char *prefix);
+extern int bench_fs_dcache(int argc, const char **argv, const char *prefix);
+extern int bench_random_urandom(int argc, const char **argv, const char *prefix);
+extern int bench_net_conntrack(int argc, const char **argv, const char *prefix);
+extern int bench_net_tun(int argc, const char **argv, const char *prefix);
+extern int bench_net_unix(int argc, const char **argv, const char *prefix);
+extern int bench_net_unix_bulk(int argc, const char **argv, const char *prefix);
+extern int bench_events_read(int argc, const char **argv, const char *prefix);
+extern int bench_events_filter(int argc, const char **argv, const char *prefix);
+extern int bench_timer_posix(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -14,4 +28,12 @@ extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __us
 
 extern int bench_format;
 
+struct timeval;
+
+extern void bench_worker_ready(void);
+extern void bench_run_workers(int nr, void (*worker)(int, void *), void *arg,
+			      struct timeval *diff);
+extern void bench_print_rate(struct timeval *diff, unsigned long long nr,
+			     const char *unit);
+
 #endif
@@ -0,0 +1,162 @@
+/*
+ *
+ * events-filter.c
+ *
+ * filter: Benchmark for the cost of filtered tracepoint events
+ *
+ * The benchmark makes getppid() system calls in a loop: without any
+ * event, then with a counting tracepoint event that fires on every call,
+ * then with the same event and a filter, and reports the time per call
+ * for each.  The differences are the cost of an event, and of an event
+ * that goes through the filter.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../util/parse-events.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#define LOOPS_DEFAULT 1000000
+static int loops = LOOPS_DEFAULT;
+static const char *tp_name = "raw_syscalls:sys_enter";
+static const char *filter = "id == 1 || id == 2 || (id >= 1000 && id < 1024)";
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of getppid() calls per run"),
+	OPT_STRING('e', "event", &tp_name, "subsystem:event",
+		   "Specify the tracepoint event to count"),
+	OPT_STRING('f', "filter", &filter, "filter",
+		   "Specify the filter of the event"),
+	OPT_END()
+};
+
+static const char * const bench_events_filter_usage[] = {
+	"perf bench events filter <options>",
+	NULL
+};
+
+static u64 tracepoint_id(void)
+{
+	char path[MAXPATHLEN], id[16], *sys, *name;
+	ssize_t len;
+	int fd;
+
+	sys = strdup(tp_name);
+	if (!sys)
+		die("Not enough memory");
+	name = strchr(sys, ':');
+	if (!name)
+		die("invalid event name: %s", tp_name);
+	*name++ = '\0';
+
+	snprintf(path, sizeof(path), "%s/%s/%s/id", debugfs_path, sys, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die("cannot open %s: %s", path, strerror(errno));
+	len = read(fd, id, sizeof(id) - 1);
+	if (len <= 0)
+		die("cannot read %s", path);
+	id[len] = '\0';
+	close(fd);
+	free(sys);
+
+	return atoll(id);
+}
+
+/* Returns the usecs per call, and the number of events counted */
+static double run(u64 id, bool with_event, const char *filter_str,
+		  u64 *count)
+{
+	struct perf_event_attr attr;
+	struct timeval start, stop, diff;
+	int i, fd = -1;
+
+	*count = 0;
+	if (with_event) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.size = sizeof(attr);
+		attr.config = id;
+		fd = sys_perf_event_open(&attr, 0, -1, -1, 0);
+		if (fd < 0)
+			die("cannot open %s: %s", tp_name, strerror(errno));
+		if (filter_str &&
+		    ioctl(fd, PERF_EVENT_IOC_SET_FILTER, filter_str) < 0)
+			die("cannot set filter \"%s\": %s", filter_str,
+			    strerror(errno));
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++)
+		syscall(__NR_getppid);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (fd >= 0) {
+		if (read(fd, count, sizeof(*count)) < 0)
+			die("read: %s", strerror(errno));
+		close(fd);
+	}
+
+	return (diff.tv_sec * 1000000.0 + diff.tv_usec) / loops;
+}
+
+int bench_events_filter(int argc, const char **argv,
+			const char *prefix __used)
+{
+	double none, unfiltered, filtered;
+	u64 id, unfiltered_count, filtered_count;
+
+	argc = parse_options(argc, argv, options,
+			     bench_events_filter_usage, 0);
+	if (loops < 1)
+		usage_with_options(bench_events_filter_usage, options);
+
+	id = tracepoint_id();
+
+	none = run(id, false, NULL, &unfiltered_count);
+	unfiltered = run(id, true, NULL, &unfiltered_count);
+	filtered = run(id, true, filter, &filtered_count);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d getppid() calls per run, counting %s\n",
+		       loops, tp_name);
+		printf("# filter: %s\n\n", filter);
+
+		printf(" %14s: %10.3f usecs/call\n", "No event", none);
+		printf(" %14s: %10.3f usecs/call (%+.3f), %llu events\n",
+		       "Unfiltered", unfiltered, unfiltered - none,
+		       (unsigned long long)unfiltered_count);
+		printf(" %14s: %10.3f usecs/call (%+.3f), %llu events\n",
+		       "Filtered", filtered, filtered - none,
+		       (unsigned long long)filtered_count);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3f %.3f %.3f\n", none, unfiltered, filtered);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
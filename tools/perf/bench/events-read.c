@@ -0,0 +1,277 @@
+/*
+ *
+ * events-read.c
+ *
+ * read: Benchmark for reading the counts of perf events
+ *
+ * A group of counting events is opened either on the benchmark itself or
+ * on a child process that spins on another CPU, and its counts are read
+ * over and over: with one group read(), with one read() per event, or,
+ * for the benchmark's own events, straight from the counters through the
+ * mmap()ed event pages where the PMU lets user space do that.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 1000000
+static int loops = LOOPS_DEFAULT;
+static int nr_events = 4;
+static bool remote;
+static bool separate;
+static bool use_mmap;
+static bool software;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of reads"),
+	OPT_INTEGER('n', "events", &nr_events,
+		    "Specify number of events in the group"),
+	OPT_BOOLEAN('r', "remote", &remote,
+		    "Count a busy child process on another CPU instead of ourselves"),
+	OPT_BOOLEAN('s', "separate", &separate,
+		    "Read every event with a read() of its own instead of a group read"),
+	OPT_BOOLEAN('m', "mmap", &use_mmap,
+		    "Read our own counters through the mmap()ed event pages"),
+	OPT_BOOLEAN('S', "software", &software,
+		    "Use software events, even if the PMU is there"),
+	OPT_END()
+};
+
+static const char * const bench_events_read_usage[] = {
+	"perf bench events read <options>",
+	NULL
+};
+
+static const u64 hw_events[] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_REFERENCES,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BUS_CYCLES,
+};
+
+static const u64 sw_events[] = {
+	PERF_COUNT_SW_TASK_CLOCK,
+	PERF_COUNT_SW_PAGE_FAULTS,
+	PERF_COUNT_SW_CONTEXT_SWITCHES,
+	PERF_COUNT_SW_CPU_MIGRATIONS,
+	PERF_COUNT_SW_PAGE_FAULTS_MIN,
+	PERF_COUNT_SW_PAGE_FAULTS_MAJ,
+	PERF_COUNT_SW_ALIGNMENT_FAULTS,
+	PERF_COUNT_SW_EMULATION_FAULTS,
+};
+
+#define MAX_EVENTS	ARRAY_SIZE(sw_events)
+
+static int fds[MAX_EVENTS];
+static struct perf_event_mmap_page *pages[MAX_EVENTS];
+static unsigned long slow_reads;
+
+static int open_events(pid_t pid, u32 type, const u64 *configs)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < nr_events; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = type;
+		attr.size = sizeof(attr);
+		attr.config = configs[i];
+		attr.read_format = separate ? 0 : PERF_FORMAT_GROUP;
+		fds[i] = sys_perf_event_open(&attr, pid, -1,
+					     i ? fds[0] : -1, 0);
+		if (fds[i] < 0) {
+			while (i--)
+				close(fds[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static u64 rdpmc(unsigned int counter)
+{
+	unsigned int low, high;
+
+	asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+
+	return low | ((u64)high) << 32;
+}
+#define HAVE_RDPMC
+#endif
+
+#define barrier() asm volatile("" ::: "memory")
+
+/*
+ * The self monitoring read described in linux/perf_event.h, falling back
+ * to read() when the counter can't be read from here.
+ */
+static u64 mmap_read_self(int i)
+{
+	struct perf_event_mmap_page *pc = pages[i];
+	u64 values[1 + MAX_EVENTS];
+	u32 seq, idx __used;
+	s64 count, pmc __used;
+
+	do {
+		seq = pc->lock;
+		barrier();
+
+		idx = pc->index;
+		count = pc->offset;
+#ifdef HAVE_RDPMC
+		if (!pc->cap_usr_rdpmc || !idx)
+			goto slow;
+		pmc = rdpmc(idx - 1);
+		pmc <<= 64 - pc->pmc_width;
+		pmc >>= 64 - pc->pmc_width;
+		count += pmc;
+#else
+		goto slow;
+#endif
+		barrier();
+	} while (pc->lock != seq);
+
+	return count;
+
+slow:
+	slow_reads++;
+	if (read(fds[0], values, sizeof(values)) < 0)
+		die("read: %s", strerror(errno));
+	return values[1 + i];
+}
+
+static void spin(void)
+{
+	for (;;)
+		barrier();
+}
+
+static void bind_to_cpu(pid_t pid, int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	sched_setaffinity(pid, sizeof(mask), &mask);
+}
+
+int bench_events_read(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	u64 values[1 + MAX_EVENTS], sum = 0;
+	struct timeval start, stop, diff;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int i, j, nr_cpus, wait_stat;
+	const char *kind;
+	pid_t pid = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_events_read_usage, 0);
+
+	if (loops < 1 || nr_events < 1 ||
+	    nr_events > (int)ARRAY_SIZE(hw_events) ||
+	    (use_mmap && (remote || separate)))
+		usage_with_options(bench_events_read_usage, options);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (remote) {
+		pid = fork();
+		assert(pid >= 0);
+		if (!pid)
+			spin();
+		/* keep the child running on another CPU than ours */
+		if (nr_cpus > 1) {
+			bind_to_cpu(0, 0);
+			bind_to_cpu(pid, 1);
+		}
+	}
+
+	kind = "hardware";
+	if (software || open_events(pid, PERF_TYPE_HARDWARE, hw_events) < 0) {
+		kind = "software";
+		if (open_events(pid, PERF_TYPE_SOFTWARE, sw_events) < 0) {
+			if (pid)
+				kill(pid, SIGKILL);
+			die("cannot open the events: %s", strerror(errno));
+		}
+	}
+
+	if (use_mmap) {
+		for (i = 0; i < nr_events; i++) {
+			pages[i] = mmap(NULL, page_size, PROT_READ, MAP_SHARED,
+					fds[i], 0);
+			if (pages[i] == MAP_FAILED)
+				die("cannot map the event page: %s",
+				    strerror(errno));
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		if (use_mmap) {
+			for (j = 0; j < nr_events; j++)
+				sum += mmap_read_self(j);
+		} else if (separate) {
+			for (j = 0; j < nr_events; j++) {
+				if (read(fds[j], values, sizeof(values)) < 0)
+					die("read: %s", strerror(errno));
+				sum += values[0];
+			}
+		} else {
+			if (read(fds[0], values, sizeof(values)) < 0)
+				die("read: %s", strerror(errno));
+			sum += values[1];
+		}
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	for (i = 0; i < nr_events; i++) {
+		if (use_mmap)
+			munmap(pages[i], page_size);
+		close(fds[i]);
+	}
+	if (pid) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &wait_stat, 0);
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d reads of %d %s events of %s, %s\n\n",
+		       loops, nr_events, kind,
+		       remote ? "a child on another CPU" : "ourselves",
+		       use_mmap ? "through the event pages" :
+		       separate ? "one read() per event" : "one group read()");
+	bench_print_rate(&diff, loops, "read");
+	if (bench_format == BENCH_FORMAT_DEFAULT && use_mmap)
+		printf(" %14lu events read with read()\n", slow_reads);
+
+	/* keep the compiler from dropping the reads */
+	if (sum == 1)
+		printf("\n");
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ *
+ * fs-dcache.c
+ *
+ * dcache: Benchmark for dentry and inode cache churn
+ *
+ * Each worker process repeatedly creates, stats and unlinks files in a
+ * private subdirectory of one of several directories.  Pointing the
+ * directories at different filesystems shows how well dentry and inode
+ * LRU maintenance scales across superblocks.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define LOOPS_DEFAULT 10000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs = 4;
+static int nr_names = 16;
+static const char *dirs = "/tmp";
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of create/stat/unlink rounds per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of worker processes"),
+	OPT_INTEGER('n', "names", &nr_names,
+		    "Specify number of file names each process cycles through"),
+	OPT_STRING('d', "dirs", &dirs, "dir[,dir...]",
+		   "Specify comma separated directories to work in"),
+	OPT_END()
+};
+
+static const char * const bench_fs_dcache_usage[] = {
+	"perf bench fs dcache <options>",
+	NULL
+};
+
+static void dcache_worker(int nr, void *arg)
+{
+	const char *dir = ((char **)arg)[nr];
+	char path[PATH_MAX];
+	struct stat st;
+	int i, j, fd;
+
+	bench_worker_ready();
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < nr_names; j++) {
+			snprintf(path, sizeof(path), "%s/%d", dir, j);
+			fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+			if (fd < 0)
+				die("cannot create %s: %s", path,
+				    strerror(errno));
+			close(fd);
+		}
+		for (j = 0; j < nr_names; j++) {
+			snprintf(path, sizeof(path), "%s/%d", dir, j);
+			if (stat(path, &st) < 0)
+				die("stat(%s): %s", path, strerror(errno));
+		}
+		for (j = 0; j < nr_names; j++) {
+			snprintf(path, sizeof(path), "%s/%d", dir, j);
+			if (unlink(path) < 0)
+				die("unlink(%s): %s", path, strerror(errno));
+			/* a negative lookup leaves an unused dentry behind */
+			if (stat(path, &st) == 0 || errno != ENOENT)
+				die("%s still exists", path);
+		}
+	}
+}
+
+int bench_fs_dcache(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	char **dir_list, **work_dirs;
+	char *dir_buf, *tok;
+	struct timeval diff;
+	int i, nr_dirs;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_dcache_usage, 0);
+
+	if (nr_procs < 1 || nr_names < 1 || loops < 1)
+		usage_with_options(bench_fs_dcache_usage, options);
+
+	dir_buf = strdup(dirs);
+	dir_list = calloc(strlen(dirs) + 1, sizeof(*dir_list));
+	work_dirs = calloc(nr_procs, sizeof(*work_dirs));
+	assert(dir_buf && dir_list && work_dirs);
+
+	nr_dirs = 0;
+	for (tok = strtok(dir_buf, ","); tok; tok = strtok(NULL, ","))
+		dir_list[nr_dirs++] = tok;
+	if (!nr_dirs)
+		usage_with_options(bench_fs_dcache_usage, options);
+
+	for (i = 0; i < nr_procs; i++) {
+		work_dirs[i] = malloc(PATH_MAX);
+		assert(work_dirs[i]);
+		snprintf(work_dirs[i], PATH_MAX, "%s/perf-bench-dcache.%d.%d",
+			 dir_list[i % nr_dirs], getpid(), i);
+		if (mkdir(work_dirs[i], 0700) < 0)
+			die("cannot create %s: %s", work_dirs[i],
+			    strerror(errno));
+	}
+
+	bench_run_workers(nr_procs, dcache_worker, work_dirs, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d processes each doing %d create/stat/unlink rounds"
+		       " of %d files in %d directories\n\n",
+		       nr_procs, loops, nr_names, nr_dirs);
+	bench_print_rate(&diff, (unsigned long long)loops * nr_names * nr_procs,
+			 "file");
+
+	for (i = 0; i < nr_procs; i++) {
+		rmdir(work_dirs[i]);
+		free(work_dirs[i]);
+	}
+	free(work_dirs);
+	free(dir_list);
+	free(dir_buf);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ *
+ * fs-locks.c
+ *
+ * locks: Benchmark for fcntl() POSIX record locking
+ *
+ * Each worker process repeatedly takes and drops a write lock on its own
+ * byte of one of several files.  The locks never conflict, so the result
+ * shows how well lock/unlock scales across processes and files.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define LOOPS_DEFAULT 100000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs = 4;
+static int nr_files = 4;
+static const char *dir = "/tmp";
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of lock/unlock pairs per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of worker processes"),
+	OPT_INTEGER('n', "files", &nr_files,
+		    "Specify number of files to spread the locks over"),
+	OPT_STRING('d', "dir", &dir, "dir",
+		   "Specify directory to create the lock files in"),
+	OPT_END()
+};
+
+static const char * const bench_fs_locks_usage[] = {
+	"perf bench fs locks <options>",
+	NULL
+};
+
+/* Worker i locks byte i / nr_files of file i % nr_files */
+static void lock_worker(int i, void *arg)
+{
+	int *fds = arg;
+	struct flock fl;
+	int j;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_whence = SEEK_SET;
+	fl.l_start = i / nr_files;
+	fl.l_len = 1;
+
+	bench_worker_ready();
+
+	for (j = 0; j < loops; j++) {
+		fl.l_type = F_WRLCK;
+		if (fcntl(fds[i % nr_files], F_SETLK, &fl) < 0)
+			die("fcntl(F_SETLK): %s", strerror(errno));
+		fl.l_type = F_UNLCK;
+		if (fcntl(fds[i % nr_files], F_SETLK, &fl) < 0)
+			die("fcntl(F_UNLCK): %s", strerror(errno));
+	}
+}
+
+int bench_fs_locks(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	int *fds;
+	char path[PATH_MAX];
+	struct timeval diff;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_locks_usage, 0);
+
+	if (nr_procs < 1 || nr_files < 1 || loops < 1)
+		usage_with_options(bench_fs_locks_usage, options);
+
+	fds = calloc(nr_files, sizeof(*fds));
+	assert(fds);
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/perf-bench-locks.%d.%d",
+			 dir, getpid(), i);
+		fds[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fds[i] < 0)
+			die("cannot create %s: %s", path, strerror(errno));
+		unlink(path);
+	}
+
+	bench_run_workers(nr_procs, lock_worker, fds, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d processes each locking and unlocking %d times"
+		       " on %d files\n\n", nr_procs, loops, nr_files);
+	bench_print_rate(&diff, (unsigned long long)loops * nr_procs, "op");
+
+	for (i = 0; i < nr_files; i++)
+		close(fds[i]);
+	free(fds);
+
+	return 0;
+}
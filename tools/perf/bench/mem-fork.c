@@ -0,0 +1,139 @@
+/*
+ *
+ * mem-fork.c
+ *
+ * fork: Benchmark for fork() of a process with a large resident set
+ *
+ * The parent maps and touches an anonymous region of each given size,
+ * then repeatedly forks a child that optionally writes to a few pages and
+ * exits.  With vm.fork_share_ptes set, the cost of fork() should no
+ * longer grow with the size of the region.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 100
+static int loops = LOOPS_DEFAULT;
+static int nr_touch;
+static const char *sizes = "16MB,64MB,256MB";
+
+static const struct option options[] = {
+	OPT_STRING('s', "sizes", &sizes, "size[,size...]",
+		   "Specify comma separated sizes of the parent's memory "
+		   "(e.g. 100MB,1GB)"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of forks per size"),
+	OPT_INTEGER('t', "touch", &nr_touch,
+		    "Specify number of pages each child writes to before exiting"),
+	OPT_END()
+};
+
+static const char * const bench_mem_fork_usage[] = {
+	"perf bench mem fork <options>",
+	NULL
+};
+
+static unsigned long long fork_usecs(char *buf, size_t len)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t nr_pages = len / page_size;
+	struct timeval start, stop, diff;
+	int i, j, wait_stat;
+	pid_t pid;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		pid = fork();
+		assert(pid >= 0);
+		if (!pid) {
+			/* spread the writes over the whole region */
+			for (j = 0; j < nr_touch; j++)
+				buf[(j * (nr_pages / nr_touch + 1)) % nr_pages *
+				    page_size] = 1;
+			_exit(0);
+		}
+		assert(waitpid(pid, &wait_stat, 0) == pid);
+		assert(WIFEXITED(wait_stat) && !WEXITSTATUS(wait_stat));
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	return diff.tv_sec * 1000000ULL + diff.tv_usec;
+}
+
+int bench_mem_fork(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	char *size_buf, *tok;
+	unsigned long long result_usec;
+	size_t len;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_fork_usage, 0);
+
+	if (loops < 1 || nr_touch < 0)
+		usage_with_options(bench_mem_fork_usage, options);
+
+	size_buf = strdup(sizes);
+	assert(size_buf);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d forks per size, %d pages written by each child\n\n",
+		       loops, nr_touch);
+
+	for (tok = strtok(size_buf, ","); tok; tok = strtok(NULL, ",")) {
+		len = (size_t)perf_atoll(tok);
+		if ((s64)len <= 0) {
+			fprintf(stderr, "Invalid size:%s\n", tok);
+			return 1;
+		}
+
+		buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			die("cannot map %s: %s", tok, strerror(errno));
+		/* fault everything in, so that the page tables get filled */
+		memset(buf, 0, len);
+
+		result_usec = fork_usecs(buf, len);
+		munmap(buf, len);
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %14s: %14lf usecs/fork\n", tok,
+			       (double)result_usec / (double)loops);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%s %lf\n", tok,
+			       (double)result_usec / (double)loops);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+	}
+
+	free(size_buf);
+	return 0;
+}
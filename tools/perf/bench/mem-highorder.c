@@ -0,0 +1,116 @@
+/*
+ *
+ * mem-highorder.c
+ *
+ * highorder: Benchmark for kernel allocations of several contiguous pages
+ *
+ * Each worker process is bound to one of the online CPUs and sends
+ * datagrams to itself over an AF_UNIX socketpair.  The data buffer of a
+ * datagram larger than two pages is allocated from the page allocator as
+ * a single block, so the workers hammer order-2 and order-3 allocations
+ * and frees on all CPUs at the same time.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define LOOPS_DEFAULT 100000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs;
+static int size = 12000;
+static int burst = 1;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of datagrams per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of worker processes"),
+	OPT_INTEGER('s', "size", &size,
+		    "Specify number of bytes per datagram"),
+	OPT_INTEGER('b', "burst", &burst,
+		    "Specify number of datagrams queued before reading them back"),
+	OPT_END()
+};
+
+static const char * const bench_mem_highorder_usage[] = {
+	"perf bench mem highorder <options>",
+	NULL
+};
+
+/* Worker nr runs on CPU nr modulo the number of CPUs in arg */
+static void highorder_worker(int nr, void *arg)
+{
+	cpu_set_t mask;
+	int sv[2], i, j, sent;
+	char *buf;
+
+	CPU_ZERO(&mask);
+	CPU_SET(nr % *(int *)arg, &mask);
+	/* not fatal: the CPU may have gone away */
+	sched_setaffinity(0, sizeof(mask), &mask);
+
+	buf = calloc(1, size);
+	assert(buf);
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		die("socketpair: %s", strerror(errno));
+
+	bench_worker_ready();
+
+	for (i = 0; i < loops; i += sent) {
+		/*
+		 * Never block on our own socket: stop queueing as soon as
+		 * the receive queue or the send buffer is full.
+		 */
+		for (sent = 0; sent < burst && i + sent < loops; sent++) {
+			if (send(sv[0], buf, size, MSG_DONTWAIT) == size)
+				continue;
+			if (errno != EAGAIN || !sent)
+				die("send: %s", strerror(errno));
+			break;
+		}
+		for (j = 0; j < sent; j++)
+			if (recv(sv[1], buf, size, 0) != size)
+				die("recv: %s", strerror(errno));
+	}
+}
+
+int bench_mem_highorder(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval diff;
+	int nr_cpus;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_highorder_usage, 0);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nr_procs)
+		nr_procs = nr_cpus;
+	if (nr_procs < 1 || loops < 1 || size < 1 || burst < 1)
+		usage_with_options(bench_mem_highorder_usage, options);
+
+	bench_run_workers(nr_procs, highorder_worker, &nr_cpus, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d processes on %d CPUs each sending %d datagrams"
+		       " of %d bytes, %d at a time\n\n",
+		       nr_procs, nr_cpus, loops, size, burst);
+	bench_print_rate(&diff, (unsigned long long)loops * nr_procs,
+			 "datagram");
+
+	return 0;
+}
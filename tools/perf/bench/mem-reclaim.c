@@ -0,0 +1,135 @@
+/*
+ *
+ * mem-reclaim.c
+ *
+ * reclaim: Benchmark for page reclaim under multi-threaded memory pressure
+ *
+ * A number of threads of one process, so that the mm is live on many
+ * CPUs, repeatedly write to their share of an anonymous region that is
+ * meant to be larger than the memory available to the process (run it
+ * in a memory cgroup or with a size above free memory, with swap on).
+ * Every pass over the region has to reclaim what the previous pass
+ * faulted in, and each page reclaim unmaps from the shared mm needs TLB
+ * shootdowns on all the CPUs the threads run on.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 4
+static int loops = LOOPS_DEFAULT;
+static int nr_threads;
+static const char *size_str = "1GB";
+
+static const struct option options[] = {
+	OPT_STRING('s', "size", &size_str, "1GB",
+		   "Specify size of the region the threads write to"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of passes over the region"),
+	OPT_END()
+};
+
+static const char * const bench_mem_reclaim_usage[] = {
+	"perf bench mem reclaim <options>",
+	NULL
+};
+
+struct reclaim_worker {
+	pthread_t thread;
+	char *start;
+	size_t len;
+};
+
+static long page_size;
+static pthread_barrier_t start_barrier;
+
+static void *reclaim_worker(void *arg)
+{
+	struct reclaim_worker *w = arg;
+	size_t off;
+	int i;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < loops; i++)
+		for (off = 0; off < w->len; off += page_size)
+			w->start[off] = i;
+
+	return NULL;
+}
+
+int bench_mem_reclaim(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct reclaim_worker *workers;
+	struct timeval start, stop, diff;
+	size_t len, chunk;
+	char *buf;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_reclaim_usage, 0);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	len = (size_t)perf_atoll(size_str);
+	if ((s64)len <= 0 || nr_threads < 1 || loops < 1)
+		usage_with_options(bench_mem_reclaim_usage, options);
+
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (buf == MAP_FAILED)
+		die("cannot map %s: %s", size_str, strerror(errno));
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	assert(workers);
+	assert(!pthread_barrier_init(&start_barrier, NULL, nr_threads + 1));
+
+	/* page aligned slices, the last thread takes the remainder */
+	chunk = len / nr_threads / page_size * page_size;
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].start = buf + i * chunk;
+		workers[i].len = i == nr_threads - 1 ? len - i * chunk : chunk;
+		assert(!pthread_create(&workers[i].thread, NULL,
+				       reclaim_worker, &workers[i]));
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++)
+		assert(!pthread_join(workers[i].thread, NULL));
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d threads writing %d passes over %s\n\n",
+		       nr_threads, loops, size_str);
+	bench_print_rate(&diff, (unsigned long long)len / page_size * loops,
+			 "page");
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf(" %14lf MB/sec\n", (double)len * loops / (1 << 20) /
+		       (diff.tv_sec + diff.tv_usec / 1000000.0));
+
+	pthread_barrier_destroy(&start_barrier);
+	munmap(buf, len);
+	free(workers);
+	return 0;
+}
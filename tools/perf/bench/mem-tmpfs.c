@@ -0,0 +1,207 @@
+/*
+ *
+ * mem-tmpfs.c
+ *
+ * tmpfs: Benchmark for faulting a large tmpfs file back in from swap
+ *
+ * A file of the given size is created on tmpfs, mapped shared and
+ * written page by page.  Then its page table entries are dropped and
+ * every page is read again, a number of times: each fault has to find
+ * the page in the file's page cache, or the swap entry left there when
+ * the page was swapped out, and read it back.  Run it in a memory
+ * cgroup limited to less than the file, with swap on, so that the file
+ * does not fit and each pass swaps most of it back in.
+ *
+ * With a swap device given, the file is then left alone and the time
+ * swapoff takes to bring the pages of the file back is reported too,
+ * before the device is enabled again.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/swap.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 2
+static int loops = LOOPS_DEFAULT;
+static const char *size_str = "1GB";
+static const char *file_name = "/dev/shm/perf-bench-tmpfs";
+static const char *swap_dev;
+
+static const struct option options[] = {
+	OPT_STRING('s', "size", &size_str, "1GB",
+		   "Specify size of the tmpfs file"),
+	OPT_STRING('f', "file", &file_name, "path",
+		   "Specify the file to create, on a tmpfs mount"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of passes reading the file back"),
+	OPT_STRING('w', "swapoff", &swap_dev, "device",
+		   "Specify a swap device to swapoff and swapon afterwards"),
+	OPT_END()
+};
+
+static const char * const bench_mem_tmpfs_usage[] = {
+	"perf bench mem tmpfs <options>",
+	NULL
+};
+
+struct tmpfs_result {
+	struct timeval time;
+	long majflt;
+};
+
+static long page_size;
+
+static long majflt(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_majflt;
+}
+
+/* Touch every page, writing or only reading it */
+static void tmpfs_pass(char *buf, size_t len, int write,
+		       struct tmpfs_result *res)
+{
+	struct timeval start, stop;
+	volatile char *p;
+	size_t off;
+	long faults;
+
+	faults = majflt();
+	gettimeofday(&start, NULL);
+	for (off = 0; off < len; off += page_size) {
+		p = buf + off;
+		if (write)
+			*p = off / page_size;
+		else
+			(void)*p;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &res->time);
+	res->majflt = majflt() - faults;
+}
+
+static double usecs_per_page(struct timeval *tv, size_t len)
+{
+	return (tv->tv_sec * 1000000.0 + tv->tv_usec) / (len / page_size);
+}
+
+int bench_mem_tmpfs(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct tmpfs_result populate, *passes;
+	struct timeval start, stop, swapoff_time = { 0, 0 };
+	size_t len;
+	char *buf;
+	int fd, i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_tmpfs_usage, 0);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	len = (size_t)perf_atoll(size_str);
+	if ((s64)len <= 0 || loops < 1)
+		usage_with_options(bench_mem_tmpfs_usage, options);
+
+	fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die("cannot create %s: %s", file_name, strerror(errno));
+	if (ftruncate(fd, len) < 0)
+		die("cannot extend %s to %s: %s", file_name, size_str,
+		    strerror(errno));
+
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED)
+		die("cannot map %s: %s", file_name, strerror(errno));
+
+	passes = calloc(loops, sizeof(*passes));
+	if (!passes)
+		die("Not enough memory");
+
+	tmpfs_pass(buf, len, 1, &populate);
+
+	/*
+	 * Zapping the ptes leaves the pages to the file, so every read
+	 * faults and has to look its page up in the page cache again.
+	 */
+	for (i = 0; i < loops; i++) {
+		if (madvise(buf, len, MADV_DONTNEED) < 0)
+			die("madvise: %s", strerror(errno));
+		tmpfs_pass(buf, len, 0, &passes[i]);
+	}
+	munmap(buf, len);
+
+	if (swap_dev) {
+		gettimeofday(&start, NULL);
+		if (swapoff(swap_dev) < 0)
+			die("swapoff %s: %s", swap_dev, strerror(errno));
+		gettimeofday(&stop, NULL);
+		timersub(&stop, &start, &swapoff_time);
+		if (swapon(swap_dev, 0) < 0)
+			die("swapon %s: %s", swap_dev, strerror(errno));
+	}
+
+	close(fd);
+	unlink(file_name);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s tmpfs file %s, read back %d times\n\n",
+		       size_str, file_name, loops);
+
+		printf(" %14s: %lu.%03lu [sec], %10.3f usecs/page,"
+		       " %ld major faults\n", "Populate",
+		       populate.time.tv_sec,
+		       (unsigned long) (populate.time.tv_usec/1000),
+		       usecs_per_page(&populate.time, len), populate.majflt);
+		for (i = 0; i < loops; i++)
+			printf("        Pass %2d: %lu.%03lu [sec], %10.3f"
+			       " usecs/page, %ld major faults\n", i + 1,
+			       passes[i].time.tv_sec,
+			       (unsigned long) (passes[i].time.tv_usec/1000),
+			       usecs_per_page(&passes[i].time, len),
+			       passes[i].majflt);
+		if (swap_dev)
+			printf(" %14s: %lu.%03lu [sec]\n", "Swapoff",
+			       swapoff_time.tv_sec,
+			       (unsigned long) (swapoff_time.tv_usec/1000));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu", populate.time.tv_sec,
+		       (unsigned long) (populate.time.tv_usec / 1000));
+		for (i = 0; i < loops; i++)
+			printf(" %lu.%03lu", passes[i].time.tv_sec,
+			       (unsigned long) (passes[i].time.tv_usec / 1000));
+		if (swap_dev)
+			printf(" %lu.%03lu", swapoff_time.tv_sec,
+			       (unsigned long) (swapoff_time.tv_usec / 1000));
+		printf("\n");
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(passes);
+	return 0;
+}
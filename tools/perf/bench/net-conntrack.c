@@ -0,0 +1,285 @@
+/*
+ *
+ * net-conntrack.c
+ *
+ * conntrack: Benchmark for connection tracking of short-lived flows
+ *
+ * Each client process opens a new flow for every round: a UDP socket that
+ * exchanges one datagram with its echo server, or a TCP connection that
+ * the server accepts and closes right away.  Every flow has a new source
+ * port, so with nf_conntrack loaded each one creates, confirms and later
+ * destroys a conntrack.  The servers run either on the loopback device
+ * or behind a veth pair in a network namespace of their own.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef CLONE_NEWNET
+#define CLONE_NEWNET	0x40000000
+#endif
+
+#define LOOPS_DEFAULT 10000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs = 4;
+static bool use_tcp;
+static bool use_netns;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of flows per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of client processes"),
+	OPT_BOOLEAN('t', "tcp", &use_tcp,
+		    "Use TCP connections instead of UDP exchanges"),
+	OPT_BOOLEAN('n', "netns", &use_netns,
+		    "Run the servers in a network namespace behind a veth pair"),
+	OPT_END()
+};
+
+static const char * const bench_net_conntrack_usage[] = {
+	"perf bench net conntrack <options>",
+	NULL
+};
+
+#define VETH_HOST	"pbct0"
+#define VETH_PEER	"pbct1"
+#define ADDR_HOST	"10.211.0.1"
+#define ADDR_PEER	"10.211.0.2"
+
+static int server_socket(void)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, use_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket: %s", strerror(errno));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		die("bind: %s", strerror(errno));
+	if (use_tcp && listen(fd, 1024) < 0)
+		die("listen: %s", strerror(errno));
+
+	return fd;
+}
+
+static void server_loop(int fd)
+{
+	struct sockaddr_in sin;
+	socklen_t len;
+	char c;
+	int cfd;
+
+	for (;;) {
+		if (use_tcp) {
+			cfd = accept(fd, NULL, NULL);
+			/* close first, so the client side needs no TIME_WAIT */
+			if (cfd >= 0)
+				close(cfd);
+		} else {
+			len = sizeof(sin);
+			if (recvfrom(fd, &c, 1, 0, (struct sockaddr *)&sin,
+				     &len) == 1)
+				sendto(fd, &c, 1, 0, (struct sockaddr *)&sin,
+				       len);
+		}
+	}
+}
+
+/*
+ * The server leader moves to a new network namespace if asked to, waits
+ * for the host side to hand it the veth peer, then starts one server per
+ * client and reports their ports, all over its socket ctl.
+ */
+static void server_leader(int ctl)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	char c = 0;
+	int i, fd;
+	int __used ret;
+
+	setpgid(0, 0);
+
+	if (use_netns) {
+		if (unshare(CLONE_NEWNET) < 0)
+			die("unshare(CLONE_NEWNET): %s", strerror(errno));
+		ret = write(ctl, &c, 1);
+		if (read(ctl, &c, 1) != 1)
+			exit(1);
+		if (system("ip link set lo up && "
+			   "ip addr add " ADDR_PEER "/24 dev " VETH_PEER " && "
+			   "ip link set " VETH_PEER " up"))
+			die("cannot set up " VETH_PEER);
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		fd = server_socket();
+		len = sizeof(sin);
+		if (getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+			die("getsockname: %s", strerror(errno));
+		if (!fork())
+			server_loop(fd);
+		close(fd);
+		ret = write(ctl, &sin.sin_port, sizeof(sin.sin_port));
+	}
+	pause();
+	exit(0);
+}
+
+struct conntrack_servers {
+	struct sockaddr_in addr;
+	in_port_t *ports;	/* of the server of each client */
+	int result;		/* where the clients report lost flows */
+};
+
+static void conntrack_worker(int nr, void *arg)
+{
+	struct conntrack_servers *servers = arg;
+	struct sockaddr_in sin = servers->addr;
+	struct timeval tv = { .tv_sec = 1 };
+	unsigned long lost = 0;
+	char c = 0;
+	int i, fd;
+	int __used ret;
+
+	sin.sin_port = servers->ports[nr];
+	bench_worker_ready();
+
+	for (i = 0; i < loops; i++) {
+		fd = socket(AF_INET, use_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+		if (fd < 0)
+			die("socket: %s", strerror(errno));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+			lost++;
+			close(fd);
+			continue;
+		}
+		if (use_tcp) {
+			/* wait for the server to close the connection */
+			if (read(fd, &c, 1) != 0)
+				lost++;
+		} else {
+			if (send(fd, &c, 1, 0) != 1 || recv(fd, &c, 1, 0) != 1)
+				lost++;
+		}
+		close(fd);
+	}
+
+	ret = write(servers->result, &lost, sizeof(lost));
+}
+
+int bench_net_conntrack(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct conntrack_servers servers;
+	struct timeval diff;
+	unsigned long lost, total_lost = 0;
+	int ctl[2], results[2];
+	pid_t leader;
+	char cmd[256];
+	int i, wait_stat;
+	int __used ret;
+	char c = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_conntrack_usage, 0);
+
+	if (nr_procs < 1 || loops < 1)
+		usage_with_options(bench_net_conntrack_usage, options);
+
+	servers.ports = calloc(nr_procs, sizeof(*servers.ports));
+	assert(servers.ports);
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, ctl));
+	assert(!pipe(results));
+	servers.result = results[1];
+
+	leader = fork();
+	assert(leader >= 0);
+	if (!leader)
+		server_leader(ctl[1]);
+	setpgid(leader, leader);
+
+	memset(&servers.addr, 0, sizeof(servers.addr));
+	servers.addr.sin_family = AF_INET;
+	if (use_netns) {
+		if (read(ctl[0], &c, 1) != 1)
+			die("server process failed");
+		snprintf(cmd, sizeof(cmd),
+			 "ip link add " VETH_HOST " type veth peer name "
+			 VETH_PEER " && ip link set " VETH_PEER " netns %d && "
+			 "ip addr add " ADDR_HOST "/24 dev " VETH_HOST " && "
+			 "ip link set " VETH_HOST " up", leader);
+		if (system(cmd)) {
+			kill(-leader, SIGKILL);
+			die("cannot set up " VETH_HOST);
+		}
+		ret = write(ctl[0], &c, 1);
+		servers.addr.sin_addr.s_addr = inet_addr(ADDR_PEER);
+	} else {
+		servers.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		if (read(ctl[0], &servers.ports[i], sizeof(in_port_t)) !=
+		    sizeof(in_port_t)) {
+			kill(-leader, SIGKILL);
+			die("server process failed");
+		}
+	}
+
+	bench_run_workers(nr_procs, conntrack_worker, &servers, &diff);
+
+	for (i = 0; i < nr_procs; i++) {
+		if (read(results[0], &lost, sizeof(lost)) == sizeof(lost))
+			total_lost += lost;
+	}
+
+	/* the namespace goes away asynchronously, take the veth pair now */
+	if (use_netns)
+		ret = system("ip link del " VETH_HOST);
+	kill(-leader, SIGKILL);
+	waitpid(leader, &wait_stat, 0);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d processes each opening %d %s flows %s\n\n",
+		       nr_procs, loops, use_tcp ? "TCP" : "UDP",
+		       use_netns ? "over a veth pair" : "over loopback");
+	bench_print_rate(&diff, (unsigned long long)loops * nr_procs, "flow");
+	if (bench_format == BENCH_FORMAT_DEFAULT && total_lost)
+		printf(" %14lu flows failed\n", total_lost);
+
+	close(ctl[0]);
+	close(ctl[1]);
+	close(results[0]);
+	close(results[1]);
+	free(servers.ports);
+
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ *
+ * net-tun.c
+ *
+ * tun: Benchmark for multiqueue tun devices
+ *
+ * One tun device is created with a queue per writer/reader thread pair.
+ * Each writer injects ICMP echo requests through its own queue, from a
+ * few source addresses of its own; the kernel answers them through the
+ * device, and the readers drain the replies from their queues.  With flow
+ * steering, the reply to a request comes back on the queue that wrote it.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * From <linux/if_tun.h>, which needs more of <linux/types.h> than perf's
+ * own copy has.
+ */
+#define TUNSETIFF	_IOW('T', 202, int)
+#define IFF_TUN		0x0001
+#define IFF_MULTI_QUEUE	0x0100
+#define IFF_NO_PI	0x1000
+
+#define LOOPS_DEFAULT 100000
+static int loops = LOOPS_DEFAULT;
+static int nr_queues = 4;
+static int nr_flows = 16;
+static int payload = 56;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of packets per writer"),
+	OPT_INTEGER('q', "queues", &nr_queues,
+		    "Specify number of queues, each with a writer and a reader"),
+	OPT_INTEGER('f', "flows", &nr_flows,
+		    "Specify number of flows per writer"),
+	OPT_INTEGER('s', "size", &payload,
+		    "Specify number of payload bytes per packet"),
+	OPT_END()
+};
+
+static const char * const bench_net_tun_usage[] = {
+	"perf bench net tun <options>",
+	NULL
+};
+
+#define TUN_NAME	"pbtun%d"
+#define ADDR_LOCAL	"10.212.0.1"
+#define ADDR_MASK	"255.255.0.0"
+
+/* the sources of writer w are 10.212.(w + 1).(1 .. nr_flows) */
+#define FLOW_ADDR(w, f)	(0x0ad40000 | ((w) + 1) << 8 | ((f) + 1))
+#define FLOW_WRITER(a)	((int)(((a) >> 8) & 0xff) - 1)
+
+#define MAX_QUEUES	16
+#define MAX_FLOWS	254
+#define MAX_PACKET	1500
+
+struct iphdr_min {
+	u8	ver_ihl;
+	u8	tos;
+	u16	tot_len;
+	u16	id;
+	u16	frag_off;
+	u8	ttl;
+	u8	protocol;
+	u16	check;
+	u32	saddr;
+	u32	daddr;
+};
+
+struct icmphdr_min {
+	u8	type;
+	u8	code;
+	u16	checksum;
+	u16	id;
+	u16	sequence;
+};
+
+struct tun_queue {
+	pthread_t writer;
+	pthread_t reader;
+	int fd;
+	int index;
+	unsigned long sent;
+	unsigned long received;
+	unsigned long own;	/* replies to this queue's own requests */
+	struct timeval last;
+};
+
+static pthread_barrier_t start_barrier;
+static volatile int writers_done;
+
+static u16 csum(const void *buf, int len)
+{
+	const u16 *p = buf;
+	u32 sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	if (len)
+		sum += *(const u8 *)p;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static int build_request(char *buf, int writer, int flow, int seq)
+{
+	struct iphdr_min *ip = (struct iphdr_min *)buf;
+	struct icmphdr_min *icmp = (struct icmphdr_min *)(ip + 1);
+	int len = sizeof(*ip) + sizeof(*icmp) + payload;
+
+	memset(buf, 0, len);
+	ip->ver_ihl = 0x45;
+	ip->tot_len = htons(len);
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_ICMP;
+	ip->saddr = htonl(FLOW_ADDR(writer, flow));
+	ip->daddr = inet_addr(ADDR_LOCAL);
+	ip->check = csum(ip, sizeof(*ip));
+
+	icmp->type = 8;		/* echo request */
+	icmp->id = htons(writer);
+	icmp->sequence = htons(seq);
+	icmp->checksum = csum(icmp, sizeof(*icmp) + payload);
+
+	return len;
+}
+
+static void *tun_writer(void *arg)
+{
+	struct tun_queue *q = arg;
+	char buf[MAX_PACKET];
+	int i, len;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < loops; i++) {
+		len = build_request(buf, q->index, i % nr_flows, i);
+		if (write(q->fd, buf, len) == len)
+			q->sent++;
+	}
+
+	return NULL;
+}
+
+static void *tun_reader(void *arg)
+{
+	struct tun_queue *q = arg;
+	struct pollfd pfd = { .fd = q->fd, .events = POLLIN };
+	struct iphdr_min *ip;
+	char buf[MAX_PACKET];
+	ssize_t len;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (;;) {
+		len = read(q->fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno != EAGAIN)
+				break;
+			/* stop once the writers are done and nothing comes */
+			if (!poll(&pfd, 1, 100) && writers_done)
+				break;
+			continue;
+		}
+		ip = (struct iphdr_min *)buf;
+		if (len < (ssize_t)sizeof(*ip) || ip->protocol != IPPROTO_ICMP)
+			continue;
+		q->received++;
+		if (FLOW_WRITER(ntohl(ip->daddr)) == q->index)
+			q->own++;
+		gettimeofday(&q->last, NULL);
+	}
+
+	return NULL;
+}
+
+static int tun_open_queue(struct ifreq *ifr)
+{
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR);
+	if (fd < 0)
+		die("cannot open /dev/net/tun: %s", strerror(errno));
+	if (ioctl(fd, TUNSETIFF, ifr) < 0)
+		die("TUNSETIFF: %s%s", strerror(errno),
+		    errno == EINVAL ? " (no multiqueue tun support?)" : "");
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	return fd;
+}
+
+static void tun_set_addr(const char *name, unsigned long cmd,
+			 const char *addr)
+{
+	struct sockaddr_in *sin;
+	struct ifreq ifr;
+	int sk;
+
+	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sk < 0)
+		die("socket: %s", strerror(errno));
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (cmd == SIOCSIFFLAGS) {
+		ifr.ifr_flags = IFF_UP | IFF_RUNNING;
+	} else {
+		sin = (struct sockaddr_in *)&ifr.ifr_addr;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = inet_addr(addr);
+	}
+	if (ioctl(sk, cmd, &ifr) < 0)
+		die("cannot configure %s: %s", name, strerror(errno));
+	close(sk);
+}
+
+int bench_net_tun(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct tun_queue *queues;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec;
+	unsigned long sent = 0, received = 0, own = 0;
+	struct ifreq ifr;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_tun_usage, 0);
+
+	if (loops < 1 || nr_queues < 1 || nr_queues > MAX_QUEUES ||
+	    nr_flows < 1 || nr_flows > MAX_FLOWS || payload < 0 ||
+	    payload > MAX_PACKET - 28)
+		usage_with_options(bench_net_tun_usage, options);
+
+	queues = calloc(nr_queues, sizeof(*queues));
+	assert(queues);
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+	strcpy(ifr.ifr_name, TUN_NAME);
+	for (i = 0; i < nr_queues; i++) {
+		/* the first TUNSETIFF fills in the name of the new device */
+		queues[i].fd = tun_open_queue(&ifr);
+		queues[i].index = i;
+	}
+
+	tun_set_addr(ifr.ifr_name, SIOCSIFADDR, ADDR_LOCAL);
+	tun_set_addr(ifr.ifr_name, SIOCSIFNETMASK, ADDR_MASK);
+	tun_set_addr(ifr.ifr_name, SIOCSIFFLAGS, NULL);
+
+	assert(!pthread_barrier_init(&start_barrier, NULL,
+				     2 * nr_queues + 1));
+	for (i = 0; i < nr_queues; i++) {
+		assert(!pthread_create(&queues[i].reader, NULL,
+				       tun_reader, &queues[i]));
+		assert(!pthread_create(&queues[i].writer, NULL,
+				       tun_writer, &queues[i]));
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_queues; i++)
+		assert(!pthread_join(queues[i].writer, NULL));
+	gettimeofday(&stop, NULL);
+	writers_done = 1;
+
+	for (i = 0; i < nr_queues; i++) {
+		assert(!pthread_join(queues[i].reader, NULL));
+		sent += queues[i].sent;
+		received += queues[i].received;
+		own += queues[i].own;
+		if (timercmp(&queues[i].last, &stop, >))
+			stop = queues[i].last;
+	}
+	timersub(&stop, &start, &diff);
+
+	/* closing the last queue removes the device */
+	for (i = 0; i < nr_queues; i++)
+		close(queues[i].fd);
+	pthread_barrier_destroy(&start_barrier);
+
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d queues, %d flows per queue, %d packets of %d bytes per writer\n\n",
+		       nr_queues, nr_flows, loops, payload + 28);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14llu packets/sec written\n",
+		       (unsigned long long)((double)sent /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14llu packets/sec read\n",
+		       (unsigned long long)((double)received /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14lu replies lost\n", sent - received);
+		if (received)
+			printf(" %14.2lf %% replies on the writer's queue\n",
+			       100.0 * own / received);
+		for (i = 0; i < nr_queues; i++)
+			printf(" %14s %d: %lu written, %lu read\n", "queue",
+			       i, queues[i].sent, queues[i].received);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(queues);
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ *
+ * net-unix-bulk.c
+ *
+ * unix-bulk: Benchmark for bulk transfers over an AF_UNIX stream socket
+ *
+ * A child process receives a given amount of data over a socketpair
+ * from its parent, a chunk at a time, in one or both of two ways:
+ *
+ *  copy:   write() from a buffer, read() into another one, so the data
+ *          is copied into the kernel and out again.
+ *  splice: vmsplice() the buffer into a pipe and splice() that to the
+ *          socket, then splice() from the socket into a pipe and on to
+ *          /dev/null, so the pages are passed along by reference and
+ *          never copied at all.
+ *
+ * The throughput of each is reported.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#undef _GNU_SOURCE
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	1031
+#endif
+
+static const char *length_str = "1GB";
+static const char *chunk_str = "64KB";
+static const char *method = "all";
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "1GB",
+		   "Specify amount of data to transfer"),
+	OPT_STRING('c', "chunk", &chunk_str, "64KB",
+		   "Specify amount of data per system call"),
+	OPT_STRING('m', "method", &method, "all",
+		   "Specify the way to transfer: copy, splice or all"),
+	OPT_END()
+};
+
+static const char * const bench_net_unix_bulk_usage[] = {
+	"perf bench net unix-bulk <options>",
+	NULL
+};
+
+static size_t length, chunk;
+
+/*
+ * A pipe that holds a chunk, as far as the pipe size limit allows: one
+ * process both fills and drains it, so it can never take more at once.
+ */
+static size_t open_pipe(int pipefd[2])
+{
+	long size;
+
+	if (pipe(pipefd) < 0)
+		die("pipe: %s", strerror(errno));
+
+	size = fcntl(pipefd[1], F_SETPIPE_SZ, chunk);
+	if (size < 0)
+		size = 16 * sysconf(_SC_PAGESIZE);
+	return min((size_t)size, chunk);
+}
+
+static void splice_all(int in, int out, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+		if (ret <= 0)
+			die("splice: %s", ret ? strerror(errno) : "short");
+		len -= ret;
+	}
+}
+
+static void send_copy(int sock, char *buf)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < length) {
+		ret = write(sock, buf, min(chunk, length - done));
+		if (ret < 0)
+			die("write: %s", strerror(errno));
+		done += ret;
+	}
+}
+
+static void recv_copy(int sock, char *buf)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < length) {
+		ret = read(sock, buf, chunk);
+		if (ret <= 0)
+			die("read: %s", ret ? strerror(errno) : "EOF");
+		done += ret;
+	}
+}
+
+/*
+ * The buffer is handed out again while its pages may still be queued on
+ * the socket: what arrives is not checked, so that does not matter here.
+ */
+static void send_splice(int sock, char *buf)
+{
+	struct iovec iov;
+	size_t done = 0, max;
+	ssize_t ret;
+	int pipefd[2];
+
+	max = open_pipe(pipefd);
+	while (done < length) {
+		iov.iov_base = buf;
+		iov.iov_len = min(max, length - done);
+		ret = vmsplice(pipefd[1], &iov, 1, 0);
+		if (ret <= 0)
+			die("vmsplice: %s", strerror(errno));
+		splice_all(pipefd[0], sock, ret);
+		done += ret;
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+static void recv_splice(int sock)
+{
+	size_t done = 0, max;
+	ssize_t ret;
+	int pipefd[2], null;
+
+	null = open("/dev/null", O_WRONLY);
+	if (null < 0)
+		die("cannot open /dev/null: %s", strerror(errno));
+
+	max = open_pipe(pipefd);
+	while (done < length) {
+		ret = splice(sock, NULL, pipefd[1], NULL,
+			     min(max, length - done), SPLICE_F_MOVE);
+		if (ret <= 0)
+			die("splice from the socket: %s",
+			    ret ? strerror(errno) : "EOF");
+		splice_all(pipefd[0], null, ret);
+		done += ret;
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(null);
+}
+
+static void transfer(int splicing, char *buf, struct timeval *diff)
+{
+	struct timeval start, stop;
+	int sv[2], wait_stat;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		die("socketpair: %s", strerror(errno));
+
+	/* or the child would print what is still buffered again */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (!pid) {
+		close(sv[0]);
+		if (splicing)
+			recv_splice(sv[1]);
+		else
+			recv_copy(sv[1], buf);
+		exit(0);
+	}
+	close(sv[1]);
+
+	/* the time until the child has it all, not until it is all sent */
+	gettimeofday(&start, NULL);
+	if (splicing)
+		send_splice(sv[0], buf);
+	else
+		send_copy(sv[0], buf);
+	assert(waitpid(pid, &wait_stat, 0) == pid);
+	assert(WIFEXITED(wait_stat) && !WEXITSTATUS(wait_stat));
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, diff);
+
+	close(sv[0]);
+}
+
+static void print_result(const char *name, struct timeval *diff)
+{
+	double sec = diff->tv_sec + diff->tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %lu.%03lu [sec], %14lf MB/sec\n", name,
+		       diff->tv_sec, (unsigned long) (diff->tv_usec/1000),
+		       (double)length / sec / (1 << 20));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", (double)length / sec / (1 << 20));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+int bench_net_unix_bulk(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval diff;
+	int copy, splicing;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_unix_bulk_usage, 0);
+
+	length = (size_t)perf_atoll(length_str);
+	chunk = (size_t)perf_atoll(chunk_str);
+	copy = !strcmp(method, "copy") || !strcmp(method, "all");
+	splicing = !strcmp(method, "splice") || !strcmp(method, "all");
+	if ((s64)length <= 0 || (s64)chunk <= 0 || (!copy && !splicing))
+		usage_with_options(bench_net_unix_bulk_usage, options);
+
+	/* page aligned, for vmsplice() */
+	buf = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap: %s", strerror(errno));
+	memset(buf, 0x5a, chunk);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Transferring %s over an AF_UNIX stream socket,"
+		       " %s at a time\n\n", length_str, chunk_str);
+
+	if (copy) {
+		transfer(0, buf, &diff);
+		print_result("copy", &diff);
+	}
+	if (splicing) {
+		transfer(1, buf, &diff);
+		print_result("splice", &diff);
+	}
+
+	munmap(buf, chunk);
+	return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ *
+ * net-unix.c
+ *
+ * unix: Benchmark for AF_UNIX connect and fd passing latency
+ *
+ * Every worker process has a listening stream socket bound to an
+ * abstract name of its own.  In each round it connects a new socket to
+ * it, accepts the connection, passes the connecting socket over it with
+ * SCM_RIGHTS, receives it and closes everything again: a name lookup, an
+ * insertion into and removal from the socket table, and one AF_UNIX
+ * socket in flight per round.  The time of every round is recorded, so
+ * the result shows the tail of the latency as well as the throughput.
+ *
+ * Optionally a worker also leaves behind an unreachable cycle of two
+ * sockets, each in flight in the other's receive queue, every so many
+ * rounds, so that the garbage collector has work to do during the run.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#define LOOPS_DEFAULT 100000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs = 4;
+static int garbage_every;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of rounds per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of worker processes"),
+	OPT_INTEGER('g', "garbage", &garbage_every,
+		    "Leave a garbage cycle behind every this many rounds"),
+	OPT_END()
+};
+
+static const char * const bench_net_unix_usage[] = {
+	"perf bench net unix <options>",
+	NULL
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void send_fd(int sock, int fd)
+{
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char c = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, 0) != 1)
+		die("sendmsg: %s", strerror(errno));
+}
+
+static int recv_fd(int sock)
+{
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char c;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	if (recvmsg(sock, &msg, 0) != 1)
+		die("recvmsg: %s", strerror(errno));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+		die("no fd received");
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+/* Two sockets, each in flight to the other, with no fd left to them */
+static void make_garbage(void)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		die("socketpair: %s", strerror(errno));
+	send_fd(sv[0], sv[0]);
+	send_fd(sv[1], sv[1]);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static void unix_worker(int nr, u64 *lat)
+{
+	struct sockaddr_un sun;
+	socklen_t len;
+	int listener, c, a, fd, i;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	/* abstract: sun_path[0] stays '\0' */
+	len = offsetof(struct sockaddr_un, sun_path) + 1 +
+		snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1,
+			 "perf-bench-unix-%d-%d", getppid(), nr);
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+		die("socket: %s", strerror(errno));
+	if (bind(listener, (struct sockaddr *)&sun, len) < 0)
+		die("bind: %s", strerror(errno));
+	if (listen(listener, 16) < 0)
+		die("listen: %s", strerror(errno));
+
+	for (i = 0; i < loops; i++) {
+		u64 start = now_ns();
+
+		c = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (c < 0)
+			die("socket: %s", strerror(errno));
+		if (connect(c, (struct sockaddr *)&sun, len) < 0)
+			die("connect: %s", strerror(errno));
+		a = accept(listener, NULL, NULL);
+		if (a < 0)
+			die("accept: %s", strerror(errno));
+
+		send_fd(c, c);
+		fd = recv_fd(a);
+
+		close(fd);
+		close(a);
+		close(c);
+
+		lat[i] = now_ns() - start;
+
+		if (garbage_every && !((i + 1) % garbage_every))
+			make_garbage();
+	}
+
+	close(listener);
+	exit(0);
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	u64 l = *(const u64 *)a, r = *(const u64 *)b;
+
+	return l < r ? -1 : l > r;
+}
+
+/* The nearest rank percentile, of sorted samples, in usecs */
+static double percentile(u64 *lat, unsigned long nr, double pct)
+{
+	unsigned long rank = ceil(pct * nr / 100 - 1e-9);
+
+	return lat[rank ? rank - 1 : 0] / 1000.0;
+}
+
+int bench_net_unix(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long result_usec;
+	unsigned long nr, i;
+	u64 *lat, sum = 0;
+	size_t size;
+	pid_t *pids;
+	int p, wait_stat;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_unix_usage, 0);
+
+	if (loops < 1 || nr_procs < 1 || garbage_every < 0)
+		usage_with_options(bench_net_unix_usage, options);
+
+	/* the workers write the time of every round in here */
+	nr = (unsigned long)loops * nr_procs;
+	size = nr * sizeof(u64);
+	lat = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (lat == MAP_FAILED)
+		die("mmap: %s", strerror(errno));
+
+	pids = calloc(nr_procs, sizeof(*pids));
+	assert(pids);
+
+	gettimeofday(&start, NULL);
+	for (p = 0; p < nr_procs; p++) {
+		pids[p] = fork();
+		assert(pids[p] >= 0);
+		if (!pids[p])
+			unix_worker(p, lat + (unsigned long)p * loops);
+	}
+
+	for (p = 0; p < nr_procs; p++) {
+		assert(waitpid(pids[p], &wait_stat, 0) == pids[p]);
+		assert(WIFEXITED(wait_stat) && !WEXITSTATUS(wait_stat));
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	for (i = 0; i < nr; i++)
+		sum += lat[i];
+	qsort(lat, nr, sizeof(u64), u64_cmp);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d processes doing %d connect/accept/fd passing"
+		       " rounds each", nr_procs, loops);
+		if (garbage_every)
+			printf(", a garbage cycle every %d", garbage_every);
+		printf("\n\n");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14llu rounds/sec\n",
+		       (unsigned long long)((double)nr /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14.3f usecs/round average\n",
+		       (double)sum / nr / 1000);
+		printf(" %14.3f usecs p50\n", percentile(lat, nr, 50));
+		printf(" %14.3f usecs p99\n", percentile(lat, nr, 99));
+		printf(" %14.3f usecs p99.9\n", percentile(lat, nr, 99.9));
+		printf(" %14.3f usecs max\n", lat[nr - 1] / 1000.0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3f %.3f %.3f %.3f\n",
+		       (double)sum / nr / 1000, percentile(lat, nr, 50),
+		       percentile(lat, nr, 99), lat[nr - 1] / 1000.0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	munmap(lat, size);
+	free(pids);
+
+	return 0;
+}
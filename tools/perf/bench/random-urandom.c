@@ -0,0 +1,98 @@
+/*
+ *
+ * random-urandom.c
+ *
+ * urandom: Benchmark for reading /dev/urandom
+ *
+ * Worker processes read fixed size blocks from /dev/urandom as fast as
+ * they can.  Comparing one process against several shows how well the
+ * generator scales across CPUs.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define LOOPS_DEFAULT 10000
+static int loops = LOOPS_DEFAULT;
+static int nr_procs = 1;
+static int read_size = 4096;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of reads per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of reader processes"),
+	OPT_INTEGER('s', "size", &read_size,
+		    "Specify number of bytes per read"),
+	OPT_END()
+};
+
+static const char * const bench_random_urandom_usage[] = {
+	"perf bench random urandom <options>",
+	NULL
+};
+
+static void urandom_worker(int nr __used, void *arg __used)
+{
+	char *buf;
+	ssize_t n, done;
+	int fd, i;
+
+	buf = malloc(read_size);
+	assert(buf);
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		die("cannot open /dev/urandom: %s", strerror(errno));
+
+	bench_worker_ready();
+
+	for (i = 0; i < loops; i++) {
+		for (done = 0; done < read_size; done += n) {
+			n = read(fd, buf + done, read_size - done);
+			if (n <= 0)
+				die("read(/dev/urandom): %s", strerror(errno));
+		}
+	}
+}
+
+int bench_random_urandom(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct timeval diff;
+	double mb_per_sec;
+
+	argc = parse_options(argc, argv, options,
+			     bench_random_urandom_usage, 0);
+
+	if (nr_procs < 1 || read_size < 1 || loops < 1)
+		usage_with_options(bench_random_urandom_usage, options);
+
+	bench_run_workers(nr_procs, urandom_worker, NULL, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d processes each reading %d x %d bytes"
+		       " from /dev/urandom\n\n", nr_procs, loops, read_size);
+	bench_print_rate(&diff, (unsigned long long)loops * nr_procs, "read");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		mb_per_sec = (double)loops * read_size * nr_procs / (1 << 20) /
+			(diff.tv_sec + diff.tv_usec / 1000000.0);
+		printf(" %14lf MB/sec\n", mb_per_sec);
+		printf(" %14lf MB/sec per process\n", mb_per_sec / nr_procs);
+	}
+
+	return 0;
+}
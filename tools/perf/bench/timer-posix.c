@@ -0,0 +1,176 @@
+/*
+ *
+ * timer-posix.c
+ *
+ * posix: Benchmark for POSIX interval timer create/settime/delete
+ *
+ * Every worker thread creates a timer, arms it, reads it back and
+ * deletes it again, over and over.  The threads are spread over one or
+ * more processes: the threads of a process share its timer ids, the
+ * processes do not, so the result shows how timer id allocation and
+ * lookup scale inside a process and across processes.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+#define LOOPS_DEFAULT 100000
+static int loops = LOOPS_DEFAULT;
+static int nr_threads = 4;
+static int nr_procs = 1;
+static int nr_keep;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of create/settime/delete rounds per thread"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of worker threads per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of worker processes"),
+	OPT_INTEGER('k', "keep", &nr_keep,
+		    "Specify number of timers each thread keeps armed"),
+	OPT_END()
+};
+
+static const char * const bench_timer_posix_usage[] = {
+	"perf bench timer posix <options>",
+	NULL
+};
+
+static pthread_barrier_t start_barrier;
+
+/* The system calls themselves: the kernel timer id is an int */
+static int sys_timer_create(clockid_t clock, struct sigevent *sev, int *id)
+{
+	return syscall(__NR_timer_create, clock, sev, id);
+}
+
+static int sys_timer_settime(int id, const struct itimerspec *new,
+			     struct itimerspec *old)
+{
+	return syscall(__NR_timer_settime, id, 0, new, old);
+}
+
+static int sys_timer_gettime(int id, struct itimerspec *cur)
+{
+	return syscall(__NR_timer_gettime, id, cur);
+}
+
+static int sys_timer_delete(int id)
+{
+	return syscall(__NR_timer_delete, id);
+}
+
+static int create_armed_timer(void)
+{
+	struct sigevent sev;
+	struct itimerspec its;
+	int id;
+
+	/* SIGEV_NONE: the timers never expire within the run anyway */
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_NONE;
+	if (sys_timer_create(CLOCK_MONOTONIC, &sev, &id) < 0)
+		die("timer_create: %s", strerror(errno));
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = 60;
+	if (sys_timer_settime(id, &its, NULL) < 0)
+		die("timer_settime: %s", strerror(errno));
+
+	return id;
+}
+
+static void *timer_worker(void *arg __used)
+{
+	struct itimerspec its;
+	int *kept;
+	int i;
+
+	/* timers left armed, so that the lookups go through a fuller idr */
+	kept = calloc(nr_keep + 1, sizeof(*kept));
+	assert(kept);
+	for (i = 0; i < nr_keep; i++)
+		kept[i] = create_armed_timer();
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < loops; i++) {
+		int id = create_armed_timer();
+
+		if (sys_timer_gettime(id, &its) < 0)
+			die("timer_gettime: %s", strerror(errno));
+		if (sys_timer_delete(id) < 0)
+			die("timer_delete: %s", strerror(errno));
+	}
+
+	for (i = 0; i < nr_keep; i++)
+		sys_timer_delete(kept[i]);
+	free(kept);
+	return NULL;
+}
+
+static void timer_process(int nr __used, void *arg __used)
+{
+	pthread_t *threads;
+	int i;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	assert(threads);
+
+	/* the threads set up their timers, then wait for the go */
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++)
+		assert(!pthread_create(&threads[i], NULL, timer_worker, NULL));
+
+	bench_worker_ready();
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+int bench_timer_posix(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct timeval diff;
+
+	argc = parse_options(argc, argv, options,
+			     bench_timer_posix_usage, 0);
+
+	if (nr_threads < 1 || nr_procs < 1 || loops < 1 || nr_keep < 0)
+		usage_with_options(bench_timer_posix_usage, options);
+
+	bench_run_workers(nr_procs, timer_process, NULL, &diff);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		printf("# %d processes of %d threads, each doing %d"
+		       " timer create/settime/gettime/delete rounds",
+		       nr_procs, nr_threads, loops);
+		if (nr_keep)
+			printf(" with %d more timers armed", nr_keep);
+		printf("\n\n");
+	}
+	bench_print_rate(&diff,
+			 (unsigned long long)loops * nr_threads * nr_procs,
+			 "round");
+
+	return 0;
+}
@@ -13,6 +13,10 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  fs    ... file system and VFS operations
+ *  net   ... networking stack operations
+ *  events ... perf event operations
+ *  timer ... POSIX timer operations
  *
  */
 
@@ -52,6 +56,83 @@ static struct bench_suite mem_suites[] = {
 	{ "memcpy",
 	  "Simple memory copy in various ways",
 	  bench_mem_memcpy },
+	{ "fork",
+	  "fork() of a process with a large resident set",
+	  bench_mem_fork },
+	{ "highorder",
+	  "Kernel allocations of several pages on all CPUs",
+	  bench_mem_highorder },
+	{ "reclaim",
+	  "Page reclaim under multi-threaded memory pressure",
+	  bench_mem_reclaim },
+	{ "tmpfs",
+	  "Faulting a large tmpfs file back in from swap",
+	  bench_mem_tmpfs },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite fs_suites[] = {
+	{ "locks",
+	  "Concurrent fcntl() lock/unlock on several files",
+	  bench_fs_locks },
+	{ "dcache",
+	  "Concurrent create/stat/unlink in several directories",
+	  bench_fs_dcache },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite net_suites[] = {
+	{ "conntrack",
+	  "Short-lived flows through connection tracking",
+	  bench_net_conntrack },
+	{ "tun",
+	  "Parallel readers and writers on a multiqueue tun device",
+	  bench_net_tun },
+	{ "unix",
+	  "AF_UNIX connect and fd passing latency",
+	  bench_net_unix },
+	{ "unix-bulk",
+	  "Bulk AF_UNIX stream transfers, copied or spliced",
+	  bench_net_unix_bulk },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite random_suites[] = {
+	{ "urandom",
+	  "Concurrent reads from /dev/urandom",
+	  bench_random_urandom },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite events_suites[] = {
+	{ "read",
+	  "Reading the counts of a group of events",
+	  bench_events_read },
+	{ "filter",
+	  "Cost of tracepoint events, filtered and unfiltered",
+	  bench_events_filter },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite timer_suites[] = {
+	{ "posix",
+	  "Concurrent POSIX timer create/settime/delete",
+	  bench_timer_posix },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -71,6 +152,21 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "fs",
+	  "file system and VFS operations",
+	  fs_suites },
+	{ "random",
+	  "random number generation",
+	  random_suites },
+	{ "net",
+	  "networking stack operations",
+	  net_suites },
+	{ "events",
+	  "perf event operations",
+	  events_suites },
+	{ "timer",
+	  "POSIX timer operations",
+	  timer_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },
@@ -15,6 +15,7 @@
 
 #include <sys/prctl.h>
 
+#include <sched.h>
 #include <semaphore.h>
 #include <pthread.h>
 #include <math.h>
@@ -39,6 +40,13 @@ static u64			sleep_measurement_overhead;
 
 static unsigned long		nr_tasks;
 
+/* Wakeup to run latencies, for percentiles */
+struct lat_samples {
+	u64			*lat;
+	unsigned long		nr;
+	unsigned long		alloc;
+};
+
 struct sched_atom;
 
 struct task_desc {
@@ -53,10 +61,9 @@ struct task_desc {
 	pthread_t		thread;
 	sem_t			sleep_sem;
 
-	sem_t			ready_for_work;
-	sem_t			work_done_sem;
-
+	int			cpu;
 	u64			cpu_usage;
+	struct lat_samples	lat;
 };
 
 enum sched_event_type {
@@ -69,22 +76,24 @@ enum sched_event_type {
 struct sched_atom {
 	enum sched_event_type	type;
 	int			specific_wait;
+	int			cpu;
 	u64			timestamp;
 	u64			duration;
 	unsigned long		nr;
 	sem_t			*wait_sem;
 	struct task_desc	*wakee;
+	struct sched_atom	*wakee_event;
+	u64			wakeup_time;
 };
 
 static struct task_desc		*pid_to_task[MAX_PID];
 
 static struct task_desc		**tasks;
 
-static pthread_mutex_t		start_work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t	start_work_barrier;
+static pthread_barrier_t	work_done_barrier;
 static u64			start_time;
 
-static pthread_mutex_t		work_done_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 static unsigned long		nr_run_events;
 static unsigned long		nr_sleep_events;
 static unsigned long		nr_wakeup_events;
@@ -106,6 +115,11 @@ static u64			sum_fluct;
 static u64			run_avg;
 
 static unsigned int		replay_repeat = 10;
+static bool			replay_timed;
+static bool			replay_affinity;
+static int			replay_nr_cpus;
+static u64			replay_first_timestamp;
+static bool			lat_percentiles;
 static unsigned long		nr_timestamps;
 static unsigned long		nr_unordered_timestamps;
 static unsigned long		nr_state_machine_bugs;
@@ -141,6 +155,7 @@ struct work_atoms {
 	u64			total_lat;
 	u64			nb_atoms;
 	u64			total_runtime;
+	struct lat_samples	lat;
 };
 
 typedef int (*sort_fn_t)(struct work_atoms *, struct work_atoms *);
@@ -179,6 +194,88 @@ static void sleep_nsecs(u64 nsecs)
 	nanosleep(&ts, NULL);
 }
 
+/* Sleep until get_nsecs() reaches @nsecs */
+static void sleep_until_nsecs(u64 nsecs)
+{
+	struct timespec ts;
+
+	ts.tv_nsec = nsecs % 1000000000;
+	ts.tv_sec = nsecs / 1000000000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void lat_samples__add(struct lat_samples *samples, u64 lat)
+{
+	if (samples->nr == samples->alloc) {
+		samples->alloc = samples->alloc ? samples->alloc * 2 : 64;
+		samples->lat = realloc(samples->lat,
+				       samples->alloc * sizeof(u64));
+		if (!samples->lat)
+			die("No memory");
+	}
+	samples->lat[samples->nr++] = lat;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	u64 l = *(const u64 *)a, r = *(const u64 *)b;
+
+	return l < r ? -1 : l > r;
+}
+
+static void lat_samples__sort(struct lat_samples *samples)
+{
+	qsort(samples->lat, samples->nr, sizeof(u64), u64_cmp);
+}
+
+/* The nearest rank percentile, of sorted samples */
+static u64 lat_samples__percentile(struct lat_samples *samples, double pct)
+{
+	/* keep 99.9% of 1000 from rounding up to the 1000th */
+	unsigned long rank = ceil(pct * samples->nr / 100 - 1e-9);
+
+	if (!samples->nr)
+		return 0;
+
+	return samples->lat[rank ? rank - 1 : 0];
+}
+
+static void print_lat_percentiles_header(const char *count)
+{
+	printf("\n ----------------------------------------------------------------------------------------------------\n");
+	printf("  Task                  |%9s |   p50 ms   |   p90 ms   |   p99 ms   |  p99.9 ms  |   max ms   |\n",
+	       count);
+	printf(" ----------------------------------------------------------------------------------------------------\n");
+}
+
+static void print_lat_percentiles(const char *comm, int pid,
+				  struct lat_samples *samples)
+{
+	u64 p50, p90, p99, p999;
+	int i, ret;
+
+	if (!samples->nr)
+		return;
+
+	lat_samples__sort(samples);
+	p50 = lat_samples__percentile(samples, 50);
+	p90 = lat_samples__percentile(samples, 90);
+	p99 = lat_samples__percentile(samples, 99);
+	p999 = lat_samples__percentile(samples, 99.9);
+
+	ret = printf("  %s:%d ", comm, pid);
+	for (i = 0; i < 24 - ret; i++)
+		printf(" ");
+
+	printf("|%9lu | %10.3f | %10.3f | %10.3f | %10.3f | %10.3f |\n",
+	       samples->nr,
+	       (double)p50 / 1e6, (double)p90 / 1e6,
+	       (double)p99 / 1e6, (double)p999 / 1e6,
+	       (double)samples->lat[samples->nr - 1] / 1e6);
+}
+
 static void calibrate_run_measurement_overhead(void)
 {
 	u64 T0, T1, delta, min_delta = 1000000000ULL;
@@ -243,7 +340,8 @@ static struct sched_atom *last_event(struct task_desc *task)
 }
 
 static void
-add_sched_event_run(struct task_desc *task, u64 timestamp, u64 duration)
+add_sched_event_run(struct task_desc *task, u64 timestamp, u64 duration,
+		    int cpu)
 {
 	struct sched_atom *event, *curr_event = last_event(task);
 
@@ -261,6 +359,7 @@ add_sched_event_run(struct task_desc *task, u64 timestamp, u64 duration)
 
 	event->type = SCHED_EVENT_RUN;
 	event->duration = duration;
+	event->cpu = cpu;
 
 	nr_run_events++;
 }
@@ -289,6 +388,7 @@ add_sched_event_wakeup(struct task_desc *task, u64 timestamp,
 	sem_init(wakee_event->wait_sem, 0, 0);
 	wakee_event->specific_wait = 1;
 	event->wait_sem = wakee_event->wait_sem;
+	event->wakee_event = wakee_event;
 
 	nr_wakeup_events++;
 }
@@ -365,23 +465,57 @@ static void add_cross_task_wakeups(void)
 	}
 }
 
+static void bind_to_cpu(struct task_desc *task, int cpu)
+{
+	cpu_set_t cpus;
+
+	cpu %= replay_nr_cpus;
+	if (task->cpu == cpu)
+		return;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		pr_debug("cannot bind %s to cpu %d\n", task->comm, cpu);
+	task->cpu = cpu;
+}
+
 static void
-process_sched_event(struct task_desc *this_task __used, struct sched_atom *atom)
+process_sched_event(struct task_desc *this_task, struct sched_atom *atom)
 {
+	u64 sleep_time;
 	int ret = 0;
 
+	/*
+	 * Don't get ahead of the trace: the atoms that took place at a
+	 * known time wait for that time into the replay.
+	 */
+	if (replay_timed && atom->timestamp > replay_first_timestamp)
+		sleep_until_nsecs(start_time + atom->timestamp -
+				  replay_first_timestamp);
+
 	switch (atom->type) {
 		case SCHED_EVENT_RUN:
+			if (replay_affinity)
+				bind_to_cpu(this_task, atom->cpu);
 			burn_nsecs(atom->duration);
 			break;
 		case SCHED_EVENT_SLEEP:
-			if (atom->wait_sem)
-				ret = sem_wait(atom->wait_sem);
+			if (!atom->wait_sem)
+				break;
+			sleep_time = get_nsecs();
+			ret = sem_wait(atom->wait_sem);
 			BUG_ON(ret);
+			/* only count the wakeups we were asleep for */
+			if (lat_percentiles && atom->wakeup_time >= sleep_time)
+				lat_samples__add(&this_task->lat,
+						 get_nsecs() - atom->wakeup_time);
 			break;
 		case SCHED_EVENT_WAKEUP:
-			if (atom->wait_sem)
+			if (atom->wait_sem) {
+				atom->wakee_event->wakeup_time = get_nsecs();
 				ret = sem_post(atom->wait_sem);
+			}
 			BUG_ON(ret);
 			break;
 		case SCHED_EVENT_MIGRATION:
@@ -435,11 +569,23 @@ static u64 get_cpu_usage_nsec_self(int fd)
 	return runtime;
 }
 
+static void barrier_wait(pthread_barrier_t *barrier)
+{
+	int ret = pthread_barrier_wait(barrier);
+
+	BUG_ON(ret && ret != PTHREAD_BARRIER_SERIAL_THREAD);
+}
+
+/*
+ * The tasks and the parent meet at start_work_barrier, which lets all
+ * of them go at once, and again at work_done_barrier once every task
+ * is through its events.
+ */
 static void *thread_func(void *ctx)
 {
 	struct task_desc *this_task = ctx;
 	u64 cpu_usage_0, cpu_usage_1;
-	unsigned long i, ret;
+	unsigned long i;
 	char comm2[22];
 	int fd;
 
@@ -447,32 +593,23 @@ static void *thread_func(void *ctx)
 	prctl(PR_SET_NAME, comm2);
 	fd = self_open_counters();
 
-again:
-	ret = sem_post(&this_task->ready_for_work);
-	BUG_ON(ret);
-	ret = pthread_mutex_lock(&start_work_mutex);
-	BUG_ON(ret);
-	ret = pthread_mutex_unlock(&start_work_mutex);
-	BUG_ON(ret);
+	for (;;) {
+		barrier_wait(&start_work_barrier);
 
-	cpu_usage_0 = get_cpu_usage_nsec_self(fd);
+		cpu_usage_0 = get_cpu_usage_nsec_self(fd);
 
-	for (i = 0; i < this_task->nr_events; i++) {
-		this_task->curr_event = i;
-		process_sched_event(this_task, this_task->atoms[i]);
-	}
+		for (i = 0; i < this_task->nr_events; i++) {
+			this_task->curr_event = i;
+			process_sched_event(this_task, this_task->atoms[i]);
+		}
 
-	cpu_usage_1 = get_cpu_usage_nsec_self(fd);
-	this_task->cpu_usage = cpu_usage_1 - cpu_usage_0;
-	ret = sem_post(&this_task->work_done_sem);
-	BUG_ON(ret);
+		cpu_usage_1 = get_cpu_usage_nsec_self(fd);
+		this_task->cpu_usage = cpu_usage_1 - cpu_usage_0;
 
-	ret = pthread_mutex_lock(&work_done_wait_mutex);
-	BUG_ON(ret);
-	ret = pthread_mutex_unlock(&work_done_wait_mutex);
-	BUG_ON(ret);
+		barrier_wait(&work_done_barrier);
+	}
 
-	goto again;
+	return NULL;
 }
 
 static void create_tasks(void)
@@ -487,16 +624,15 @@ static void create_tasks(void)
 	err = pthread_attr_setstacksize(&attr,
 			(size_t) max(16 * 1024, PTHREAD_STACK_MIN));
 	BUG_ON(err);
-	err = pthread_mutex_lock(&start_work_mutex);
+	err = pthread_barrier_init(&start_work_barrier, NULL, nr_tasks + 1);
 	BUG_ON(err);
-	err = pthread_mutex_lock(&work_done_wait_mutex);
+	err = pthread_barrier_init(&work_done_barrier, NULL, nr_tasks + 1);
 	BUG_ON(err);
 	for (i = 0; i < nr_tasks; i++) {
 		task = tasks[i];
 		sem_init(&task->sleep_sem, 0, 0);
-		sem_init(&task->ready_for_work, 0, 0);
-		sem_init(&task->work_done_sem, 0, 0);
 		task->curr_event = 0;
+		task->cpu = -1;
 		err = pthread_create(&task->thread, &attr, thread_func, task);
 		BUG_ON(err);
 	}
@@ -506,30 +642,17 @@ static void wait_for_tasks(void)
 {
 	u64 cpu_usage_0, cpu_usage_1;
 	struct task_desc *task;
-	unsigned long i, ret;
+	unsigned long i;
 
-	start_time = get_nsecs();
 	cpu_usage = 0;
-	pthread_mutex_unlock(&work_done_wait_mutex);
-
-	for (i = 0; i < nr_tasks; i++) {
-		task = tasks[i];
-		ret = sem_wait(&task->ready_for_work);
-		BUG_ON(ret);
-		sem_init(&task->ready_for_work, 0, 0);
-	}
-	ret = pthread_mutex_lock(&work_done_wait_mutex);
-	BUG_ON(ret);
-
 	cpu_usage_0 = get_cpu_usage_nsec_parent();
 
-	pthread_mutex_unlock(&start_work_mutex);
+	start_time = get_nsecs();
+	barrier_wait(&start_work_barrier);
+	barrier_wait(&work_done_barrier);
 
 	for (i = 0; i < nr_tasks; i++) {
 		task = tasks[i];
-		ret = sem_wait(&task->work_done_sem);
-		BUG_ON(ret);
-		sem_init(&task->work_done_sem, 0, 0);
 		cpu_usage += task->cpu_usage;
 		task->cpu_usage = 0;
 	}
@@ -545,9 +668,6 @@ static void wait_for_tasks(void)
 	runavg_parent_cpu_usage = (runavg_parent_cpu_usage*9 +
 				   parent_cpu_usage)/10;
 
-	ret = pthread_mutex_lock(&start_work_mutex);
-	BUG_ON(ret);
-
 	for (i = 0; i < nr_tasks; i++) {
 		task = tasks[i];
 		sem_init(&task->sleep_sem, 0, 0);
@@ -777,6 +897,9 @@ replay_wakeup_event(struct trace_wakeup_event *wakeup_event,
 			wakeup_event->pid);
 	}
 
+	if (!replay_first_timestamp)
+		replay_first_timestamp = timestamp;
+
 	waker = register_pid(wakeup_event->common_pid, "<unknown>");
 	wakee = register_pid(wakeup_event->pid, wakeup_event->comm);
 
@@ -823,8 +946,14 @@ replay_switch_event(struct trace_switch_event *switch_event,
 	next = register_pid(switch_event->next_pid, switch_event->next_comm);
 
 	cpu_last_switched[cpu] = timestamp;
+	if (!replay_first_timestamp)
+		replay_first_timestamp = timestamp - delta;
+
+	/* the idle task only stands in for the time nothing ran */
+	if (!switch_event->prev_pid)
+		return;
 
-	add_sched_event_run(prev, timestamp, delta);
+	add_sched_event_run(prev, timestamp - delta, delta, cpu);
 	add_sched_event_sleep(prev, timestamp, switch_event->prev_state);
 }
 
@@ -1011,6 +1140,8 @@ add_sched_in_event(struct work_atoms *atoms, u64 timestamp)
 	atom->sched_in_time = timestamp;
 
 	delta = atom->sched_in_time - atom->wake_up_time;
+	if (lat_percentiles)
+		lat_samples__add(&atoms->lat, delta);
 	atoms->total_lat += delta;
 	if (delta > atoms->max_lat) {
 		atoms->max_lat = delta;
@@ -1208,6 +1339,12 @@ static void output_lat_thread(struct work_atoms *work_list)
 	all_runtime += work_list->total_runtime;
 	all_count += work_list->nb_atoms;
 
+	if (lat_percentiles) {
+		print_lat_percentiles(work_list->thread->comm,
+				      work_list->thread->pid, &work_list->lat);
+		return;
+	}
+
 	ret = printf("  %s:%d ", work_list->thread->comm, work_list->thread->pid);
 
 	for (i = 0; i < 24 - ret; i++)
@@ -1694,9 +1831,13 @@ static void __cmd_lat(void)
 	read_events();
 	sort_lat();
 
-	printf("\n ---------------------------------------------------------------------------------------------------------------\n");
-	printf("  Task                  |   Runtime ms  | Switches | Average delay ms | Maximum delay ms | Maximum delay at     |\n");
-	printf(" ---------------------------------------------------------------------------------------------------------------\n");
+	if (lat_percentiles)
+		print_lat_percentiles_header("Switches");
+	else {
+		printf("\n ---------------------------------------------------------------------------------------------------------------\n");
+		printf("  Task                  |   Runtime ms  | Switches | Average delay ms | Maximum delay ms | Maximum delay at     |\n");
+		printf(" ---------------------------------------------------------------------------------------------------------------\n");
+	}
 
 	next = rb_first(&sorted_atom_root);
 
@@ -1709,8 +1850,11 @@ static void __cmd_lat(void)
 	}
 
 	printf(" -----------------------------------------------------------------------------------------\n");
-	printf("  TOTAL:                |%11.3f ms |%9" PRIu64 " |\n",
-		(double)all_runtime/1e6, all_count);
+	if (lat_percentiles)
+		printf("  TOTAL:                |%9" PRIu64 " |\n", all_count);
+	else
+		printf("  TOTAL:                |%11.3f ms |%9" PRIu64 " |\n",
+			(double)all_runtime/1e6, all_count);
 
 	printf(" ---------------------------------------------------\n");
 
@@ -1761,10 +1905,18 @@ static void __cmd_replay(void)
 	print_task_traces();
 	add_cross_task_wakeups();
 
+	replay_nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	create_tasks();
 	printf("------------------------------------------------------------\n");
 	for (i = 0; i < replay_repeat; i++)
 		run_one_test();
+
+	if (lat_percentiles) {
+		print_lat_percentiles_header("Wakeups");
+		for (i = 0; i < nr_tasks; i++)
+			print_lat_percentiles(tasks[i]->comm, tasks[i]->pid,
+					      &tasks[i]->lat);
+	}
 }
 
 
@@ -1795,6 +1947,8 @@ static const struct option latency_options[] = {
 		    "be more verbose (show symbol address, etc)"),
 	OPT_INTEGER('C', "CPU", &profile_cpu,
 		    "CPU to profile on"),
+	OPT_BOOLEAN('P', "percentiles", &lat_percentiles,
+		    "show percentiles of the wakeup to run delays"),
 	OPT_BOOLEAN('D', "dump-raw-trace", &dump_trace,
 		    "dump raw trace in ASCII"),
 	OPT_END()
@@ -1808,6 +1962,12 @@ static const char * const replay_usage[] = {
 static const struct option replay_options[] = {
 	OPT_UINTEGER('r', "repeat", &replay_repeat,
 		     "repeat the workload replay N times (-1: infinite)"),
+	OPT_BOOLEAN('T', "timed", &replay_timed,
+		    "replay the events at the times they were recorded"),
+	OPT_BOOLEAN('a', "affinity", &replay_affinity,
+		    "run the tasks on the CPUs they ran on when recorded"),
+	OPT_BOOLEAN('P', "percentiles", &lat_percentiles,
+		    "show percentiles of the wakeup to run delays"),
 	OPT_INCR('v', "verbose", &verbose,
 		    "be more verbose (show symbol address, etc)"),
 	OPT_BOOLEAN('D', "dump-raw-trace", &dump_trace,
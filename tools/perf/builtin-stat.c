@@ -91,6 +91,9 @@ static int			big_num_opt			=  -1;
 static const char		*cpu_list;
 static const char		*csv_sep			= NULL;
 static bool			csv_output			= false;
+static unsigned int		interval			=  0;
+static u64			interval_start;
+static char			timestamp[64];
 
 static volatile int done = 0;
 
@@ -200,10 +203,15 @@ static int read_counter_aggr(struct perf_evsel *counter)
 {
 	struct perf_stat *ps = counter->priv;
 	u64 *count = counter->counts->aggr.values;
-	int i;
+	int i, err;
 
-	if (__perf_evsel__read(counter, evsel_list->cpus->nr,
-			       evsel_list->threads->nr, scale) < 0)
+	if (interval)
+		err = __perf_evsel__read_delta(counter, evsel_list->cpus->nr,
+					       evsel_list->threads->nr, scale);
+	else
+		err = __perf_evsel__read(counter, evsel_list->cpus->nr,
+					 evsel_list->threads->nr, scale);
+	if (err < 0)
 		return -1;
 
 	for (i = 0; i < 3; i++)
@@ -236,8 +244,13 @@ static int read_counter(struct perf_evsel *counter)
 	u64 *count;
 	int cpu;
 
+	if (interval && __perf_evsel__read_delta(counter, evsel_list->cpus->nr,
+						 1, scale) < 0)
+		return -1;
+
 	for (cpu = 0; cpu < evsel_list->cpus->nr; cpu++) {
-		if (__perf_evsel__read_on_cpu(counter, cpu, 0, scale) < 0)
+		if (!interval &&
+		    __perf_evsel__read_on_cpu(counter, cpu, 0, scale) < 0)
 			return -1;
 
 		count = counter->counts->cpu[cpu].values;
@@ -253,6 +266,72 @@ static int read_counter(struct perf_evsel *counter)
 	return 0;
 }
 
+static void print_counter_aggr(struct perf_evsel *counter);
+static void print_counter(struct perf_evsel *counter);
+
+/*
+ * Print what was counted since the previous interval.  The counters are
+ * only read, never stopped, so nothing is lost between two intervals.
+ */
+static void print_interval(void)
+{
+	static u64 prev_time;
+	static int nr_printed;
+	struct perf_evsel *counter;
+	struct perf_stat *ps;
+	u64 now, elapsed;
+
+	now = rdclock();
+	elapsed = now - interval_start;
+	sprintf(timestamp, csv_output ? "%" PRIu64 ".%09" PRIu64 "%s" :
+					"%6" PRIu64 ".%09" PRIu64 "%s",
+		(u64)(elapsed / NSEC_PER_SEC), (u64)(elapsed % NSEC_PER_SEC),
+		csv_sep);
+
+	/* the ratios are those of this interval only */
+	memset(runtime_nsecs_stats, 0, sizeof(runtime_nsecs_stats));
+	memset(runtime_cycles_stats, 0, sizeof(runtime_cycles_stats));
+	memset(runtime_branches_stats, 0, sizeof(runtime_branches_stats));
+	memset(&walltime_nsecs_stats, 0, sizeof(walltime_nsecs_stats));
+	update_stats(&walltime_nsecs_stats,
+		     now - (prev_time ? prev_time : interval_start));
+	prev_time = now;
+
+	list_for_each_entry(counter, &evsel_list->entries, node) {
+		ps = counter->priv;
+		memset(ps->res_stats, 0, sizeof(ps->res_stats));
+
+		if (no_aggr)
+			read_counter(counter);
+		else
+			read_counter_aggr(counter);
+	}
+
+	if (!csv_output && nr_printed++ % 25 == 0)
+		fprintf(stderr, "#           time %s            counts events\n",
+			no_aggr ? "CPU     " : "");
+
+	list_for_each_entry(counter, &evsel_list->entries, node) {
+		if (no_aggr)
+			print_counter(counter);
+		else
+			print_counter_aggr(counter);
+	}
+}
+
+/*
+ * Sleep until the end of the current interval.  The deadline is absolute,
+ * so the time spent reading and printing does not make the intervals drift.
+ */
+static void interval_sleep(struct timespec *next)
+{
+	next->tv_nsec += (interval % 1000) * 1000000;
+	next->tv_sec += interval / 1000 + next->tv_nsec / NSEC_PER_SEC;
+	next->tv_nsec %= NSEC_PER_SEC;
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+}
+
 static int run_perf_stat(int argc __used, const char **argv)
 {
 	unsigned long long t0, t1;
@@ -260,6 +339,7 @@ static int run_perf_stat(int argc __used, const char **argv)
 	int status = 0;
 	int child_ready_pipe[2], go_pipe[2];
 	const bool forks = (argc > 0);
+	struct timespec next;
 	char buf;
 
 	if (forks && (pipe(child_ready_pipe) < 0 || pipe(go_pipe) < 0)) {
@@ -344,12 +424,29 @@ static int run_perf_stat(int argc __used, const char **argv)
 	 * Enable counters and exec the command:
 	 */
 	t0 = rdclock();
+	interval_start = t0;
+	clock_gettime(CLOCK_MONOTONIC, &next);
 
 	if (forks) {
 		close(go_pipe[1]);
-		wait(&status);
+		if (interval) {
+			int exited;
+
+			do {
+				interval_sleep(&next);
+				exited = waitpid(child_pid, &status, WNOHANG);
+				print_interval();
+			} while (!exited);
+		} else
+			wait(&status);
 	} else {
-		while(!done) sleep(1);
+		while (!done) {
+			if (interval) {
+				interval_sleep(&next);
+				print_interval();
+			} else
+				sleep(1);
+		}
 	}
 
 	t1 = rdclock();
@@ -358,12 +455,14 @@ static int run_perf_stat(int argc __used, const char **argv)
 
 	if (no_aggr) {
 		list_for_each_entry(counter, &evsel_list->entries, node) {
-			read_counter(counter);
+			if (!interval)
+				read_counter(counter);
 			perf_evsel__close_fd(counter, evsel_list->cpus->nr, 1);
 		}
 	} else {
 		list_for_each_entry(counter, &evsel_list->entries, node) {
-			read_counter_aggr(counter);
+			if (!interval)
+				read_counter_aggr(counter);
 			perf_evsel__close_fd(counter, evsel_list->cpus->nr,
 					     evsel_list->threads->nr);
 		}
@@ -395,6 +494,7 @@ static void nsec_printout(int cpu, struct perf_evsel *evsel, double avg)
 			csv_output ? 0 : -4,
 			evsel_list->cpus->map[cpu], csv_sep);
 
+	fputs(timestamp, stderr);
 	fprintf(stderr, fmt, cpustr, msecs, csv_sep, event_name(evsel));
 
 	if (evsel->cgrp)
@@ -428,6 +528,7 @@ static void abs_printout(int cpu, struct perf_evsel *evsel, double avg)
 	else
 		cpu = 0;
 
+	fputs(timestamp, stderr);
 	fprintf(stderr, fmt, cpustr, avg, csv_sep, event_name(evsel));
 
 	if (evsel->cgrp)
@@ -473,6 +574,7 @@ static void print_counter_aggr(struct perf_evsel *counter)
 	int scaled = counter->counts->scaled;
 
 	if (scaled == -1) {
+		fputs(timestamp, stderr);
 		fprintf(stderr, "%*s%s%*s",
 			csv_output ? 0 : 18,
 			"<not counted>",
@@ -525,6 +627,7 @@ static void print_counter(struct perf_evsel *counter)
 		ena = counter->counts->cpu[cpu].ena;
 		run = counter->counts->cpu[cpu].run;
 		if (run == 0 || ena == 0) {
+			fputs(timestamp, stderr);
 			fprintf(stderr, "CPU%*d%s%*s%s%*s",
 				csv_output ? 0 : -4,
 				evsel_list->cpus->map[cpu], csv_sep,
@@ -671,6 +774,8 @@ static const struct option options[] = {
 	OPT_CALLBACK('G', "cgroup", &evsel_list, "name",
 		     "monitor event in cgroup name only",
 		     parse_cgroups),
+	OPT_UINTEGER('I', "interval-print", &interval,
+		    "print counts every <n> msecs, without stopping the counters"),
 	OPT_END()
 };
 
@@ -711,6 +816,15 @@ int cmd_stat(int argc, const char **argv, const char *prefix __used)
 	if (run_count <= 0)
 		usage_with_options(stat_usage, options);
 
+	if (interval && interval < 10) {
+		fprintf(stderr, "print interval must be >= 10ms\n");
+		usage_with_options(stat_usage, options);
+	}
+	if (interval && run_count > 1) {
+		fprintf(stderr, "print interval and repeat modes are exclusive\n");
+		usage_with_options(stat_usage, options);
+	}
+
 	/* no_aggr, cgroup are for system-wide only */
 	if ((no_aggr || nr_cgroups) && !system_wide) {
 		fprintf(stderr, "both cgroup and no-aggregation "
@@ -776,7 +890,7 @@ int cmd_stat(int argc, const char **argv, const char *prefix __used)
 		status = run_perf_stat(argc, argv);
 	}
 
-	if (status != -1)
+	if (status != -1 && !interval)
 		print_stat(argc, argv);
 out_free_fd:
 	list_for_each_entry(pos, &evsel_list->entries, node)
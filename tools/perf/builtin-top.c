@@ -259,7 +259,8 @@ static void print_sym_table(struct perf_session *session)
 	struct rb_root tmp = RB_ROOT;
 	const int win_width = winsize.ws_col - 1;
 	int sym_width, dso_width, dso_short_width;
-	float sum_ksamples = perf_top__decay_samples(&top, &tmp);
+	float sum_ksamples = perf_top__decay_samples(&top, &tmp,
+						     top.print_entries);
 
 	puts(CONSOLE_CLEAR);
 
@@ -686,6 +687,76 @@ static int symbol_filter(struct map *map, struct symbol *sym)
 	return 0;
 }
 
+/*
+ * Symbol tables are loaded by a thread of their own, so that reading the
+ * ring buffers doesn't stall for seconds whenever a big DSO shows up in
+ * the samples.  Until its symbols are there, samples hitting a DSO are
+ * only counted.  Loading the kernel symbols splits the kernel maps, so
+ * lookups in them take kmaps_lock for reading and give up on the sample
+ * while the loader holds it.
+ */
+struct load_request {
+	struct list_head node;
+	struct map	 *map;
+};
+
+static LIST_HEAD(load_queue);
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_cond = PTHREAD_COND_INITIALIZER;
+static pthread_rwlock_t kmaps_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void symbol_loader__queue(struct map *map)
+{
+	struct load_request *req;
+
+	if (map->dso->load_state != DSO_LOAD__NONE)
+		return;
+
+	req = malloc(sizeof(*req));
+	if (req == NULL)
+		return;
+	req->map = map;
+
+	pthread_mutex_lock(&load_lock);
+	map->dso->load_state = DSO_LOAD__QUEUED;
+	list_add_tail(&req->node, &load_queue);
+	pthread_cond_signal(&load_cond);
+	pthread_mutex_unlock(&load_lock);
+}
+
+static void *symbol_loader_thread(void *arg __used)
+{
+	struct load_request *req;
+	struct dso *dso;
+	bool kernel;
+
+	pthread_mutex_lock(&load_lock);
+	while (1) {
+		while (list_empty(&load_queue))
+			pthread_cond_wait(&load_cond, &load_lock);
+
+		req = list_entry(load_queue.next, struct load_request, node);
+		list_del(&req->node);
+		pthread_mutex_unlock(&load_lock);
+
+		dso = req->map->dso;
+		kernel = dso->kernel != DSO_TYPE_USER;
+		if (kernel)
+			pthread_rwlock_wrlock(&kmaps_lock);
+		map__load(req->map, symbol_filter);
+		if (kernel)
+			pthread_rwlock_unlock(&kmaps_lock);
+		free(req);
+
+		/* the symbols must be visible before the state is */
+		__sync_synchronize();
+		pthread_mutex_lock(&load_lock);
+		dso->load_state = DSO_LOAD__DONE;
+	}
+
+	return NULL;
+}
+
 static void perf_event__process_sample(const union perf_event *event,
 				       struct perf_sample *sample,
 				       struct perf_session *session)
@@ -694,6 +765,8 @@ static void perf_event__process_sample(const union perf_event *event,
 	struct sym_entry *syme;
 	struct addr_location al;
 	struct machine *machine;
+	struct thread *thread;
+	bool kmaps, loaded = false;
 	u8 origin = event->header.misc & PERF_RECORD_MISC_CPUMODE_MASK;
 
 	++top.samples;
@@ -735,9 +808,35 @@ static void perf_event__process_sample(const union perf_event *event,
 	if (event->header.misc & PERF_RECORD_MISC_EXACT_IP)
 		top.exact_samples++;
 
-	if (perf_event__preprocess_sample(event, session, &al, sample,
-					  symbol_filter) < 0 ||
-	    al.filtered)
+	thread = perf_session__findnew(session, event->ip.pid);
+	if (thread == NULL)
+		return;
+
+	/*
+	 * User space addresses may be in the vdso, which lives in the kernel
+	 * maps too.  Skip the sample if the kernel symbols are being loaded.
+	 */
+	kmaps = origin != PERF_RECORD_MISC_USER || (s64)ip < 0;
+	if (kmaps && pthread_rwlock_tryrdlock(&kmaps_lock))
+		return;
+
+	thread__find_addr_map(thread, session, origin, MAP__FUNCTION,
+			      event->ip.pid, ip, &al);
+	al.sym = NULL;
+	if (al.map != NULL && !al.filtered) {
+		loaded = al.map->dso->load_state == DSO_LOAD__DONE;
+		if (loaded) {
+			rmb();
+			al.sym = dso__find_symbol_cached(al.map->dso,
+							 al.map->type, al.addr);
+		} else
+			symbol_loader__queue(al.map);
+	}
+
+	if (kmaps)
+		pthread_rwlock_unlock(&kmaps_lock);
+
+	if (!loaded)
 		return;
 
 	if (al.sym == NULL) {
@@ -788,16 +887,23 @@ static void perf_event__process_sample(const union perf_event *event,
 		assert(evsel != NULL);
 		syme->count[evsel->idx]++;
 		record_precise_ip(syme, evsel->idx, ip);
-		pthread_mutex_lock(&top.active_symbols_lock);
+		/*
+		 * Only the display thread takes symbols off the list, so
+		 * there is no need to take the lock for the hot ones that
+		 * are on it already.
+		 */
 		if (list_empty(&syme->node) || !syme->node.next) {
-			static bool first = true;
-			__list_insert_active_sym(syme);
-			if (first) {
-				pthread_cond_broadcast(&top.active_symbols_cond);
-				first = false;
+			pthread_mutex_lock(&top.active_symbols_lock);
+			if (list_empty(&syme->node) || !syme->node.next) {
+				static bool first = true;
+				__list_insert_active_sym(syme);
+				if (first) {
+					pthread_cond_broadcast(&top.active_symbols_cond);
+					first = false;
+				}
 			}
+			pthread_mutex_unlock(&top.active_symbols_lock);
 		}
-		pthread_mutex_unlock(&top.active_symbols_lock);
 	}
 }
 
@@ -901,7 +1007,7 @@ out_err:
 
 static int __cmd_top(void)
 {
-	pthread_t thread;
+	pthread_t thread, loader;
 	int ret __used;
 	/*
 	 * FIXME: perf_session__new should allow passing a O_MMAP, so that all this
@@ -924,6 +1030,11 @@ static int __cmd_top(void)
 	/* Wait for a minimal set of events before starting the snapshot */
 	poll(top.evlist->pollfd, top.evlist->nr_fds, 100);
 
+	if (pthread_create(&loader, NULL, symbol_loader_thread, NULL)) {
+		printf("Could not create symbol loader thread.\n");
+		exit(-1);
+	}
+
 	perf_session__mmap_read(session);
 
 	if (pthread_create(&thread, NULL, (use_browser > 0 ? display_thread_tui :
@@ -93,6 +93,7 @@ void perf_evsel__exit(struct perf_evsel *evsel)
 	xyarray__delete(evsel->fd);
 	xyarray__delete(evsel->sample_id);
 	free(evsel->id);
+	free(evsel->prev_raw_counts);
 }
 
 void perf_evsel__delete(struct perf_evsel *evsel)
@@ -174,6 +175,77 @@ int __perf_evsel__read(struct perf_evsel *evsel,
 	return 0;
 }
 
+static s8 perf_counts_values__scale(struct perf_counts_values *count,
+				     bool scale)
+{
+	if (!scale) {
+		count->ena = count->run = 0;
+		return 0;
+	}
+
+	if (count->run == 0) {
+		count->val = 0;
+		return -1;
+	}
+
+	if (count->run < count->ena) {
+		count->val = (u64)((double)count->val * count->ena / count->run + 0.5);
+		return 1;
+	}
+
+	return 0;
+}
+
+int __perf_evsel__read_delta(struct perf_evsel *evsel,
+			     int ncpus, int nthreads, bool scale)
+{
+	size_t nv = scale ? 3 : 1;
+	int cpu, thread, i;
+	struct perf_counts_values *aggr = &evsel->counts->aggr;
+	struct perf_counts_values *prev, *delta, raw, count;
+
+	if (evsel->prev_raw_counts == NULL) {
+		evsel->prev_raw_counts = zalloc(sizeof(*evsel->prev_raw_counts) +
+						ncpus * sizeof(struct perf_counts_values));
+		if (evsel->prev_raw_counts == NULL)
+			return -ENOMEM;
+	}
+
+	memset(aggr, 0, sizeof(*aggr));
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		memset(&raw, 0, sizeof(raw));
+
+		for (thread = 0; thread < nthreads; thread++) {
+			if (FD(evsel, cpu, thread) < 0)
+				continue;
+
+			if (readn(FD(evsel, cpu, thread),
+				  &count, nv * sizeof(u64)) < 0)
+				return -errno;
+
+			raw.val += count.val;
+			if (scale) {
+				raw.ena += count.ena;
+				raw.run += count.run;
+			}
+		}
+
+		prev = &evsel->prev_raw_counts->cpu[cpu];
+		delta = &evsel->counts->cpu[cpu];
+		for (i = 0; i < 3; i++) {
+			delta->values[i] = raw.values[i] - prev->values[i];
+			aggr->values[i] += delta->values[i];
+		}
+		*prev = raw;
+
+		perf_counts_values__scale(delta, scale);
+	}
+
+	evsel->counts->scaled = perf_counts_values__scale(aggr, scale);
+	return 0;
+}
+
 static int __perf_evsel__open(struct perf_evsel *evsel, struct cpu_map *cpus,
 			      struct thread_map *threads, bool group)
 {
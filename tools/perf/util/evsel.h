@@ -52,6 +52,7 @@ struct perf_evsel {
 	struct xyarray		*sample_id;
 	u64			*id;
 	struct perf_counts	*counts;
+	struct perf_counts	*prev_raw_counts;
 	int			idx;
 	int			ids;
 	struct hists		hists;
@@ -149,4 +150,18 @@ static inline int perf_evsel__read_scaled(struct perf_evsel *evsel,
 	return __perf_evsel__read(evsel, ncpus, nthreads, true);
 }
 
+/**
+ * __perf_evsel__read_delta - Read what was counted since the last call
+ *
+ * @evsel - event selector to read value
+ * @ncpus - Number of cpus affected, from zero
+ * @nthreads - Number of threads affected, from zero
+ * @scale - scale the deltas by their own enabled and running times
+ *
+ * Fills both the per cpu and the aggregate counts, without stopping the
+ * counters.  The first call returns everything counted so far.
+ */
+int __perf_evsel__read_delta(struct perf_evsel *evsel, int ncpus, int nthreads,
+			     bool scale);
+
 #endif /* __PERF_EVSEL_H */
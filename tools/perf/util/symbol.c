@@ -234,8 +234,10 @@ static void symbols__delete(struct rb_root *self)
 void dso__delete(struct dso *self)
 {
 	int i;
-	for (i = 0; i < MAP__NR_TYPES; ++i)
+	for (i = 0; i < MAP__NR_TYPES; ++i) {
 		symbols__delete(&self->symbols[i]);
+		free(self->sym_cache[i]);
+	}
 	if (self->sname_alloc)
 		free((char *)self->short_name);
 	if (self->lname_alloc)
@@ -359,6 +361,40 @@ struct symbol *dso__find_symbol(struct dso *self,
 	return symbols__find(&self->symbols[type], addr);
 }
 
+/*
+ * Like dso__find_symbol, but remembers the last symbol found for each slot
+ * of a small direct mapped table, so that the hot addresses sampled over
+ * and over again by perf top don't walk the rb tree every time.  Only use
+ * it once the symbols of the dso have been loaded: the table is never
+ * invalidated.
+ */
+struct symbol *dso__find_symbol_cached(struct dso *self,
+				       enum map_type type, u64 addr)
+{
+	struct sym_cache_entry *cache = self->sym_cache[type], *entry;
+	struct symbol *sym;
+
+	if (cache == NULL) {
+		cache = calloc(DSO__SYM_CACHE_SIZE, sizeof(*cache));
+		if (cache == NULL)
+			return dso__find_symbol(self, type, addr);
+		self->sym_cache[type] = cache;
+	}
+
+	entry = &cache[(addr ^ (addr >> DSO__SYM_CACHE_BITS)) &
+		       (DSO__SYM_CACHE_SIZE - 1)];
+	if (entry->sym != NULL && entry->addr == addr)
+		return entry->sym;
+
+	sym = symbols__find(&self->symbols[type], addr);
+	if (sym != NULL) {
+		entry->addr = addr;
+		entry->sym  = sym;
+	}
+
+	return sym;
+}
+
 struct symbol *dso__find_symbol_by_name(struct dso *self, enum map_type type,
 					const char *name)
 {
@@ -131,10 +131,29 @@ enum dso_kernel_type {
 	DSO_TYPE_GUEST_KERNEL
 };
 
+/*
+ * State of a dso whose symbols are loaded by a thread other than the one
+ * looking them up, see perf top.
+ */
+enum dso_load_state {
+	DSO_LOAD__NONE = 0,
+	DSO_LOAD__QUEUED,
+	DSO_LOAD__DONE,
+};
+
+#define DSO__SYM_CACHE_BITS	10
+#define DSO__SYM_CACHE_SIZE	(1 << DSO__SYM_CACHE_BITS)
+
+struct sym_cache_entry {
+	u64		addr;
+	struct symbol	*sym;
+};
+
 struct dso {
 	struct list_head node;
 	struct rb_root	 symbols[MAP__NR_TYPES];
 	struct rb_root	 symbol_names[MAP__NR_TYPES];
+	struct sym_cache_entry *sym_cache[MAP__NR_TYPES];
 	enum dso_kernel_type	kernel;
 	u8		 adjust_symbols:1;
 	u8		 has_build_id:1;
@@ -145,6 +164,7 @@ struct dso {
 	unsigned char	 symtab_type;
 	u8		 sorted_by_name;
 	u8		 loaded;
+	u8		 load_state;
 	u8		 build_id[BUILD_ID_SIZE];
 	const char	 *short_name;
 	char	 	 *long_name;
@@ -212,6 +232,8 @@ void dso__set_long_name(struct dso *self, char *name);
 void dso__set_build_id(struct dso *self, void *build_id);
 void dso__read_running_kernel_build_id(struct dso *self, struct machine *machine);
 struct symbol *dso__find_symbol(struct dso *self, enum map_type type, u64 addr);
+struct symbol *dso__find_symbol_cached(struct dso *self, enum map_type type,
+				       u64 addr);
 struct symbol *dso__find_symbol_by_name(struct dso *self, enum map_type type,
 					const char *name);
 
@@ -167,7 +167,31 @@ void perf_top__reset_sample_counters(struct perf_top *top)
 	top->guest_us_samples = 0;
 }
 
-float perf_top__decay_samples(struct perf_top *top, struct rb_root *root)
+/*
+ * Keep at most max_entries (all of them if zero) of the heaviest symbols
+ * in the tree: once it is full, a symbol lighter than the lightest one in
+ * there is rejected right away instead of being sorted in for nothing.
+ */
+static void rb_insert_top_sym(struct rb_root *tree, struct sym_entry *se,
+			      struct perf_top *top, int max_entries)
+{
+	struct rb_node *last;
+
+	if (max_entries > 0 && top->rb_entries >= max_entries) {
+		last = rb_last(tree);
+		if (se->weight <= rb_entry(last, struct sym_entry,
+					   rb_node)->weight)
+			return;
+		rb_erase(last, tree);
+		--top->rb_entries;
+	}
+
+	rb_insert_active_sym(tree, se);
+	++top->rb_entries;
+}
+
+float perf_top__decay_samples(struct perf_top *top, struct rb_root *root,
+			      int max_entries)
 {
 	struct sym_entry *syme, *n;
 	float sum_ksamples = 0.0;
@@ -192,10 +216,8 @@ float perf_top__decay_samples(struct perf_top *top, struct rb_root *root)
 			}
 			syme->weight = sym_weight(syme, top);
 
-			if ((int)syme->snap_count >= top->count_filter) {
-				rb_insert_active_sym(root, syme);
-				++top->rb_entries;
-			}
+			if ((int)syme->snap_count >= top->count_filter)
+				rb_insert_top_sym(root, syme, top, max_entries);
 			sum_ksamples += syme->snap_count;
 
 			for (j = 0; j < top->evlist->nr_entries; j++)
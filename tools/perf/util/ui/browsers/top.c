@@ -75,7 +75,7 @@ static void perf_top_browser__update_rb_tree(struct perf_top_browser *browser)
 
 	browser->root = RB_ROOT;
 	browser->b.top = NULL;
-	browser->sum_ksamples = perf_top__decay_samples(top, &browser->root);
+	browser->sum_ksamples = perf_top__decay_samples(top, &browser->root, 0);
 	/*
  	 * No active symbols
  	 */
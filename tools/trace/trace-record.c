@@ -0,0 +1,397 @@
+/*
+ * trace-record: record the ftrace ring buffers of all CPUs in parallel
+ *
+ * Every CPU gets a thread of its own that splices the binary pages of
+ * per_cpu/cpuN/trace_pipe_raw through a pipe into the file trace.cpuN,
+ * so the data is never copied through user space and the CPUs never
+ * wait on each other.  With -p the merged text of trace_pipe is read
+ * instead, into trace.txt, to compare against.
+ *
+ * Tracing has to be set up beforehand, e.g. by enabling events.  The
+ * recording stops after -t seconds or on SIGINT, and then reports for
+ * every CPU how many events were read and how many were lost because
+ * the buffer overflowed, from per_cpu/cpuN/stats.
+ *
+ * Compile by:
+ *
+ * gcc -Wall -O2 -o trace-record trace-record.c -lpthread
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+struct cpu_stats {
+	unsigned long overrun;
+	unsigned long read;
+};
+
+struct reader {
+	pthread_t thread;
+	int cpu;			/* -1 for trace_pipe */
+	int in, out;
+	unsigned long long bytes;
+	struct cpu_stats start, end;
+	volatile int finished;
+};
+
+static const char *tracing_dir = "/sys/kernel/debug/tracing";
+static const char *output_dir = ".";
+static size_t splice_size = 16 * 4096;
+static int text;
+static volatile int done;
+
+static void fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (errno)
+		fprintf(stderr, ": %s", strerror(errno));
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static int open_file(const char *dir, const char *name, int flags)
+{
+	char path[4096];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, flags, 0644);
+	if (fd < 0 && !(flags & O_CREAT) && errno == ENOENT)
+		return -1;
+	if (fd < 0)
+		fatal("cannot open %s", path);
+	return fd;
+}
+
+/* Returns -1 if the kernel does not count the events read */
+static int read_stats(int cpu, struct cpu_stats *stats)
+{
+	char name[64], buf[512], *p;
+	ssize_t len;
+	int fd;
+
+	snprintf(name, sizeof(name), "per_cpu/cpu%d/stats", cpu);
+	fd = open_file(tracing_dir, name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+
+	p = strstr(buf, "\noverrun: ");
+	stats->overrun = p ? strtoul(p + 10, NULL, 10) : 0;
+	p = strstr(buf, "\nread events: ");
+	if (!p)
+		return -1;
+	stats->read = strtoul(p + 14, NULL, 10);
+	return 0;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0)
+			fatal("write");
+		buf += ret;
+		len -= ret;
+	}
+}
+
+/* Returns what tracing_on was before */
+static char set_tracing_on(char on)
+{
+	char old = '1';
+	int fd;
+
+	fd = open_file(tracing_dir, "tracing_on", O_RDWR);
+	if (fd < 0)
+		return old;
+	if (read(fd, &old, 1) < 0)
+		fatal("read tracing_on");
+	write_all(fd, &on, 1);
+	close(fd);
+	return old;
+}
+
+/*
+ * Move what is left in the buffer once the recording stopped: the whole
+ * pages first, then with read() the one the writer was still on.
+ */
+static void drain(struct reader *r, int pipefd[2])
+{
+	char buf[65536];
+	ssize_t len, ret;
+
+	fcntl(r->in, F_SETFL, fcntl(r->in, F_GETFL) | O_NONBLOCK);
+
+	while (pipefd) {
+		len = splice(r->in, NULL, pipefd[1], NULL, splice_size,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (len <= 0)
+			break;
+		r->bytes += len;
+		while (len > 0) {
+			ret = splice(pipefd[0], NULL, r->out, NULL, len,
+				     SPLICE_F_MOVE);
+			if (ret <= 0)
+				fatal("splice to the output");
+			len -= ret;
+		}
+	}
+
+	/* trace_pipe_raw hands out a page per read */
+	while ((len = read(r->in, buf, pipefd ? getpagesize() :
+			   (int)sizeof(buf))) > 0) {
+		write_all(r->out, buf, len);
+		r->bytes += len;
+	}
+}
+
+static void *record_raw(void *arg)
+{
+	struct reader *r = arg;
+	int pipefd[2];
+	ssize_t len, ret;
+
+	if (pipe(pipefd) < 0)
+		fatal("pipe");
+
+	while (!done) {
+		len = splice(r->in, NULL, pipefd[1], NULL, splice_size,
+			     SPLICE_F_MOVE);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			fatal("splice from cpu%d", r->cpu);
+		r->bytes += len;
+
+		while (len > 0) {
+			ret = splice(pipefd[0], NULL, r->out, NULL, len,
+				     SPLICE_F_MOVE);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				fatal("splice to the output");
+			len -= ret;
+		}
+	}
+
+	drain(r, pipefd);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	r->finished = 1;
+	return NULL;
+}
+
+static void *record_text(void *arg)
+{
+	struct reader *r = arg;
+	static char buf[65536];
+	ssize_t len;
+
+	while (!done) {
+		len = read(r->in, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			fatal("read trace_pipe");
+		write_all(r->out, buf, len);
+		r->bytes += len;
+	}
+
+	drain(r, NULL);
+	r->finished = 1;
+	return NULL;
+}
+
+static void wakeup(int sig __attribute__((unused)))
+{
+}
+
+static void usage(void)
+{
+	printf("Usage: trace-record [-d tracing dir] [-o output dir] "
+	       "[-t seconds] [-s splice kb] [-p]\n"
+	       "  -d  where debugfs has the tracing files "
+	       "(default /sys/kernel/debug/tracing)\n"
+	       "  -o  where to write trace.cpuN, or trace.txt (default .)\n"
+	       "  -t  stop after this many seconds, instead of on SIGINT\n"
+	       "  -s  how much to splice at once (default 64 kb)\n"
+	       "  -p  read the text of trace_pipe instead, to compare\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	struct reader *readers;
+	int nr_readers = 0;
+	int seconds = 0;
+	struct sigaction sa;
+	sigset_t stop;
+	char name[64];
+	int c, i, sig, have_stats = 1;
+	char tracing_on;
+	unsigned long long read_total = 0, lost_total = 0, bytes_total = 0;
+
+	while ((c = getopt(argc, argv, "d:o:t:s:ph")) != -1) {
+		switch (c) {
+		case 'd':
+			tracing_dir = optarg;
+			break;
+		case 'o':
+			output_dir = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			splice_size = atoi(optarg) * 1024;
+			if (splice_size < 4096)
+				usage();
+			break;
+		case 'p':
+			text = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	readers = calloc(ncpus + 1, sizeof(*readers));
+	if (!readers)
+		fatal("out of memory");
+
+	/* only main() takes the signals that stop the recording */
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	sigaddset(&stop, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+	/* and interrupts the readers with SIGUSR1, which must not restart */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = wakeup;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	for (i = 0; i < ncpus; i++) {
+		struct reader *r = &readers[nr_readers];
+
+		snprintf(name, sizeof(name), "per_cpu/cpu%d/trace_pipe_raw", i);
+		r->in = open_file(tracing_dir, name, O_RDONLY);
+		if (r->in < 0)
+			continue;	/* not a possible cpu */
+		if (text) {
+			close(r->in);
+			r->in = -1;
+		}
+		r->cpu = i;
+		if (read_stats(i, &r->start) < 0)
+			have_stats = 0;
+		nr_readers++;
+	}
+	if (!nr_readers)
+		fatal("no per_cpu buffers in %s", tracing_dir);
+
+	if (text) {
+		readers[nr_readers].cpu = -1;
+		readers[nr_readers].in = open_file(tracing_dir, "trace_pipe",
+						   O_RDONLY);
+		readers[nr_readers].out = open_file(output_dir, "trace.txt",
+						    O_WRONLY | O_CREAT | O_TRUNC);
+		if (pthread_create(&readers[nr_readers].thread, NULL,
+				   record_text, &readers[nr_readers]))
+			fatal("pthread_create");
+	} else {
+		for (i = 0; i < nr_readers; i++) {
+			struct reader *r = &readers[i];
+
+			snprintf(name, sizeof(name), "trace.cpu%d", r->cpu);
+			r->out = open_file(output_dir, name,
+					   O_WRONLY | O_CREAT | O_TRUNC);
+			if (pthread_create(&r->thread, NULL, record_raw, r))
+				fatal("pthread_create");
+		}
+	}
+
+	if (seconds)
+		alarm(seconds);
+	sigwait(&stop, &sig);
+
+	/*
+	 * Stop tracing before draining the buffers, or the readers would
+	 * keep finding the events of their own system calls.
+	 */
+	tracing_on = set_tracing_on('0');
+	done = 1;
+
+	/*
+	 * A reader may have just checked done and gone back to sleep in the
+	 * kernel, so keep poking the ones that are not finished yet.
+	 */
+	for (i = text ? nr_readers : 0; i < nr_readers + text; i++) {
+		struct reader *r = &readers[i];
+
+		while (!r->finished) {
+			pthread_kill(r->thread, SIGUSR1);
+			usleep(10000);
+		}
+		pthread_join(r->thread, NULL);
+		bytes_total += r->bytes;
+	}
+
+	printf("%5s %12s %12s %8s %14s\n", "cpu", "read", "lost", "lost%",
+	       "bytes");
+	for (i = 0; i < nr_readers; i++) {
+		struct reader *r = &readers[i];
+		unsigned long nr_read, lost;
+
+		read_stats(r->cpu, &r->end);
+		nr_read = r->end.read - r->start.read;
+		lost = r->end.overrun - r->start.overrun;
+		read_total += nr_read;
+		lost_total += lost;
+
+		printf("%5d ", r->cpu);
+		if (have_stats)
+			printf("%12lu ", nr_read);
+		else
+			printf("%12s ", "-");
+		printf("%12lu %7.2f%%", lost, nr_read + lost ?
+		       100.0 * lost / (nr_read + lost) : 0.0);
+		if (text)
+			printf(" %14s\n", "-");
+		else
+			printf(" %14llu\n", r->bytes);
+	}
+	printf("%5s ", "all");
+	if (have_stats)
+		printf("%12llu ", read_total);
+	else
+		printf("%12s ", "-");
+	printf("%12llu %7.2f%% %14llu\n", lost_total,
+	       read_total + lost_total ?
+	       100.0 * lost_total / (read_total + lost_total) : 0.0,
+	       bytes_total);
+
+	set_tracing_on(tracing_on);
+	return 0;
+}